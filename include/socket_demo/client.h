@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 // Socket client interface
 class Client {
@@ -9,5 +10,23 @@ public:
 
     virtual bool receive(std::string& data) = 0;
 
+    // Sends request and waits for its response. Clients of lossy transports retransmit it
+    // according to their retry policy, the rest just send and receive once
+    virtual bool request(const std::string& data, std::string& response) {
+        return send(data) && receive(response);
+    }
+
+    // Sends several requests back to back, responses are received with `receive` in the same order
+    // (unless a lossy transport drops some). Clients of datagram transports send them in fewer syscalls
+    virtual bool sendBatch(const std::vector<std::string>& requests) {
+        for (const auto& request: requests) {
+            if (!send(request)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
     virtual ~Client() = default;
-};
\ No newline at end of file
+};
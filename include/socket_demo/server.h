@@ -2,12 +2,22 @@
 
 #include <cstdint>
 
+#include <socket_demo/server_stats.h>
+
 class ServerDelegate;
 
 // Socker server interface
 class Server {
 public:
+    // Serves requests until `stop` is called
     virtual void eventLoop(ServerDelegate *serverDelegate = nullptr) = 0;
 
+    // Thread-safe. Wakes up the event loop, which stops accepting connections, serves requests
+    // which have already arrived, closes connections and returns
+    virtual void stop() = 0;
+
+    // Thread-safe counters snapshot
+    virtual ServerStats stats() const = 0;
+
     virtual ~Server() = default;
-};
\ No newline at end of file
+};
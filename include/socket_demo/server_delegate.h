@@ -1,6 +1,13 @@
 #pragma once
 
 #include <string>
+#include <cstddef>
+
+// Request as it lies in transport buffers. Not null-terminated
+struct RequestView {
+    const char *data;
+    size_t size;
+};
 
 // Socket server delegate interface.
 // Needed because we don't want to mix network code with data processing code.
@@ -8,5 +15,14 @@ class ServerDelegate {
 public:
     virtual std::string process(const std::string& received) noexcept = 0;
 
+    // Processes several requests at once: `responses[i]` is the answer to `requests[i]`.
+    // Transports call it whenever more than one request is ready and reuse response slots between
+    // calls, so assigning to them usually does not allocate. Default implementation calls `process`
+    virtual void processBatch(const RequestView *requests, std::string *responses, size_t numRequests) noexcept {
+        for (size_t i = 0; i < numRequests; ++i) {
+            responses[i] = process(std::string(requests[i].data, requests[i].size));
+        }
+    }
+
     virtual ~ServerDelegate() = default;
-};
\ No newline at end of file
+};
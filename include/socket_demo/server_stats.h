@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Histogram bucket `i > 0` counts durations of [2^(i-1), 2^i) us, bucket 0 ones below 1 us,
+// the last one everything longer
+static constexpr size_t LOOP_HISTOGRAM_BUCKETS = 24;
+
+// Snapshot of server counters. Values are cumulative since server creation
+struct ServerStats {
+    // Connections closed right after accept because of connection caps
+    uint64_t rejectedConnections = 0;
+
+    // Requests dropped or answered with a reject message because of peer rate limits
+    uint64_t rejectedRequests = 0;
+
+    // Payload bytes of rate-limited requests
+    uint64_t rejectedBytes = 0;
+
+    // Requests shed because event loop lag exceeded the configured threshold
+    uint64_t shedRequests = 0;
+
+    // Latency mode: event loop wakeups found while spinning and wakeups it had to sleep for.
+    // Their ratio tells whether spin budget pays off
+    uint64_t spinWakeups = 0;
+    uint64_t sleepWakeups = 0;
+
+    // Connections accepted (including ones closed because of caps) and listening socket wakeups.
+    // Accept rate is the difference of `acceptedConnections` between two snapshots over time between them
+    uint64_t acceptedConnections = 0;
+    uint64_t acceptWakeups = 0;
+
+    // Bytes of responses sent with `MSG_ZEROCOPY`: ones the kernel sent from user memory
+    // and ones it copied anyway (e.g. over loopback, where zero copy is not possible)
+    uint64_t zeroCopySentBytes = 0;
+    uint64_t zeroCopyCopiedBytes = 0;
+
+    // UDP datagrams sent as segments of GSO sends and received as segments of GRO-coalesced ones
+    uint64_t udpGsoSegments = 0;
+    uint64_t udpGroSegments = 0;
+
+    // Event loop accounting: wakeups with work, requests they brought, syscalls the loop made (so that
+    // `loopSyscalls / loopRequests` is the cost of a request) and time spent busy, of which in the delegate.
+    // Histograms of busy time per wakeup and of delegate time per batch tell whether tail latency comes
+    // from the loop or from the delegate
+    uint64_t loopWakeups = 0;
+    uint64_t loopRequests = 0;
+    uint64_t loopSyscalls = 0;
+    uint64_t loopBusyMicroseconds = 0;
+    uint64_t loopProcessMicroseconds = 0;
+    uint64_t loopMaxIterationMicroseconds = 0;
+    uint64_t loopIterationHistogram[LOOP_HISTOGRAM_BUCKETS] = {};
+    uint64_t loopProcessHistogram[LOOP_HISTOGRAM_BUCKETS] = {};
+
+    // Iterations the stall watchdog caught running longer than its threshold
+    uint64_t loopStalls = 0;
+
+    // Sums counters of several event loops
+    ServerStats& operator+=(const ServerStats& other) {
+        rejectedConnections += other.rejectedConnections;
+        rejectedRequests += other.rejectedRequests;
+        rejectedBytes += other.rejectedBytes;
+        shedRequests += other.shedRequests;
+        spinWakeups += other.spinWakeups;
+        sleepWakeups += other.sleepWakeups;
+        acceptedConnections += other.acceptedConnections;
+        acceptWakeups += other.acceptWakeups;
+        zeroCopySentBytes += other.zeroCopySentBytes;
+        zeroCopyCopiedBytes += other.zeroCopyCopiedBytes;
+        udpGsoSegments += other.udpGsoSegments;
+        udpGroSegments += other.udpGroSegments;
+        loopWakeups += other.loopWakeups;
+        loopRequests += other.loopRequests;
+        loopSyscalls += other.loopSyscalls;
+        loopBusyMicroseconds += other.loopBusyMicroseconds;
+        loopProcessMicroseconds += other.loopProcessMicroseconds;
+        loopStalls += other.loopStalls;
+
+        if (other.loopMaxIterationMicroseconds > loopMaxIterationMicroseconds) {
+            loopMaxIterationMicroseconds = other.loopMaxIterationMicroseconds;
+        }
+
+        for (size_t i = 0; i < LOOP_HISTOGRAM_BUCKETS; ++i) {
+            loopIterationHistogram[i] += other.loopIterationHistogram[i];
+            loopProcessHistogram[i] += other.loopProcessHistogram[i];
+        }
+
+        return *this;
+    }
+};
+
+// Upper bound of the histogram bucket holding `quantile` of values, in microseconds. 0 if it is empty
+inline uint64_t getHistogramQuantileMicroseconds(const uint64_t (&histogram)[LOOP_HISTOGRAM_BUCKETS], double quantile) {
+    uint64_t total = 0;
+
+    for (const uint64_t count: histogram) {
+        total += count;
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    const double target = quantile * static_cast<double>(total);
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < LOOP_HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram[i];
+
+        if (static_cast<double>(seen) >= target) {
+            return uint64_t(1) << i;
+        }
+    }
+
+    return uint64_t(1) << (LOOP_HISTOGRAM_BUCKETS - 1);
+}
@@ -0,0 +1,97 @@
+#include <cerrno>
+#include <algorithm>
+
+#include <sys/socket.h>
+
+#include <socket_demo/defines.h>
+
+#include "async_handler.h"
+#include "server_policies.h"
+
+Task<ssize_t> AsyncConnection::read(char *buffer, size_t size) {
+    for (;;) {
+        const ssize_t numBytesReceived = recv(fd, buffer, size, MSG_DONTWAIT);
+
+        if (numBytesReceived >= 0) {
+            co_return numBytesReceived;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            co_return -1;
+        }
+
+        co_await reactor.readable(fd);
+    }
+}
+
+Task<bool> AsyncConnection::write(const char *data, size_t size) {
+    size_t numBytesSent = 0;
+
+    while (numBytesSent < size) {
+        const ssize_t result = send(fd, data + numBytesSent, size - numBytesSent, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (result >= 0) {
+            numBytesSent += result;
+            continue;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            co_return false;
+        }
+
+        co_await reactor.writable(fd);
+    }
+
+    co_return true;
+}
+
+DelegateHandler::DelegateHandler(ServerDelegate *serverDelegate, std::ostream& logStream, bool offload)
+    : serverDelegate(serverDelegate), logStream(logStream), offload(offload)
+{}
+
+Task<void> DelegateHandler::serve(AsyncConnection& connection) {
+    std::unique_ptr<char[]> buffer(new char[MAX_MESSAGE_LENGTH_BYTES]);
+
+    for (;;) {
+        // 1. Read message
+
+        const ssize_t numBytesReceived = co_await connection.read(buffer.get(), MAX_MESSAGE_LENGTH_BYTES);
+
+        if (numBytesReceived <= 0) {
+            logStream << (numBytesReceived == 0 ? "Disconnected " : "Cannot read message from ")
+                      << connection.getFd() << std::endl;
+            co_return;
+        }
+
+        logStream << "Received message from " << connection.getFd() << " [" << numBytesReceived << "]: "
+                  << LoggedMessage{ buffer.get(), static_cast<size_t>(numBytesReceived) } << std::endl;
+
+        // 2. Process it, possibly on a worker thread
+
+        std::string request(buffer.get(), numBytesReceived);
+        std::string response;
+
+        if (serverDelegate && offload) {
+            response = co_await connection.offload([this, &request] { return serverDelegate->process(request); });
+        } else if (serverDelegate) {
+            response = serverDelegate->process(request);
+        }
+
+        // 3. Send response
+
+        if (response.empty()) {
+            continue;
+        }
+
+        if (response.size() >= MAX_MESSAGE_LENGTH_BYTES) {
+            logStream << "Response is too long, it will be truncated to "
+                      << MAX_MESSAGE_LENGTH_BYTES << " bytes" << std::endl;
+        }
+
+        const size_t actualResponseSize = std::min(response.size(), static_cast<size_t>(MAX_MESSAGE_LENGTH_BYTES));
+
+        if (!co_await connection.write(response.data(), actualResponseSize)) {
+            logStream << "Cannot send message to " << connection.getFd() << std::endl;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+// Requires C++20, see `SOCKET_DEMO_COROUTINES` CMake option
+
+#include <string>
+#include <ostream>
+#include <memory>
+
+#include <socket_demo/server_delegate.h>
+
+#include "async_task.h"
+#include "async_reactor.h"
+
+// Non-blocking connection whose operations suspend the calling coroutine instead of the event loop
+class AsyncConnection {
+public:
+    AsyncConnection(Reactor& reactor, int fd) : reactor(reactor), fd(fd) {}
+
+    // Reads whatever is available (at least one byte). Returns 0 on disconnection, -1 on error
+    Task<ssize_t> read(char *buffer, size_t size);
+
+    // Writes the whole buffer
+    Task<bool> write(const char *data, size_t size);
+
+    // Runs `function` on a reactor worker thread, so the event loop keeps serving other connections
+    template<typename F>
+    Reactor::OffloadAwaiter<F> offload(F function) { return reactor.offload(std::move(function)); }
+
+    Reactor& getReactor() { return reactor; }
+
+    int getFd() const { return fd; }
+
+private:
+    Reactor& reactor;
+    int fd;
+};
+
+// Coroutine-based counterpart of `ServerDelegate`: handler owns the whole conversation over
+// the connection and may `co_await` reads, writes and offloaded work at any point
+class AsyncHandler {
+public:
+    // Serves connection until it is closed. Connection is closed by server once the task finishes
+    virtual Task<void> serve(AsyncConnection& connection) = 0;
+
+    virtual ~AsyncHandler() = default;
+};
+
+// Runs synchronous `ServerDelegate` through the async server: each read is a message, just as in
+// `RawFraming`. With `offload` set, `process` runs on reactor workers and overlaps with other I/O,
+// so delegate has to be thread safe then
+class DelegateHandler: public AsyncHandler {
+public:
+    DelegateHandler(ServerDelegate *serverDelegate, std::ostream& logStream, bool offload = false);
+
+    Task<void> serve(AsyncConnection& connection) override;
+
+private:
+    ServerDelegate *serverDelegate;
+    std::ostream& logStream;
+    bool offload;
+};
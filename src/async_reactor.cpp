@@ -0,0 +1,176 @@
+#include <iostream>
+#include <stdexcept>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "async_reactor.h"
+#include "utils.h"
+
+const short Reactor::POLL_READ = POLLIN;
+const short Reactor::POLL_WRITE = POLLOUT;
+
+Reactor::Reactor(size_t numWorkers) {
+    wakeupFd = createEventFd();
+
+    for (size_t i = 0; i < numWorkers; ++i) {
+        workers.emplace_back(&Reactor::workerLoop, this);
+    }
+}
+
+Reactor::~Reactor() {
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        isShuttingDown = true;
+    }
+
+    jobsCondition.notify_all();
+
+    for (auto& worker: workers) {
+        worker.join();
+    }
+
+    // Destroy suspended coroutines before anything they may reference
+    tasks.clear();
+
+    close(wakeupFd);
+}
+
+void Reactor::spawn(Task<void> task) {
+    tasks.push_back(std::move(task));
+    tasks.back().start();
+}
+
+void Reactor::watch(int fd, short events, std::coroutine_handle<> handle) {
+    watchers.push_back({ fd, events, handle });
+}
+
+void Reactor::submit(std::function<void()> job) {
+    if (workers.empty()) {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        jobs.push_back(std::move(job));
+    }
+
+    jobsCondition.notify_one();
+}
+
+void Reactor::post(std::coroutine_handle<> handle) {
+    {
+        std::lock_guard<std::mutex> lock(postedMutex);
+        posted.push_back(handle);
+    }
+
+    notifyEventFd(wakeupFd);
+}
+
+void Reactor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(postedMutex);
+        isStopped = true;
+    }
+
+    notifyEventFd(wakeupFd);
+}
+
+void Reactor::workerLoop() {
+    for (;;) {
+        std::function<void()> job;
+
+        {
+            std::unique_lock<std::mutex> lock(jobsMutex);
+            jobsCondition.wait(lock, [this] { return isShuttingDown || !jobs.empty(); });
+
+            if (isShuttingDown) {
+                return;
+            }
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        job();
+    }
+}
+
+void Reactor::reapTasks() {
+    for (auto it = tasks.begin(); it != tasks.end();) {
+        if (!it->isDone()) {
+            ++it;
+            continue;
+        }
+
+        try {
+            it->rethrowIfFailed();
+        } catch (const std::exception& e) {
+            std::cerr << "Coroutine failed: " << e.what() << std::endl;
+        }
+
+        it = tasks.erase(it);
+    }
+}
+
+void Reactor::run() {
+    std::vector<pollfd> descriptors;
+    std::vector<std::coroutine_handle<>> ready;
+
+    for (;;) {
+        // 1. Wait for watched descriptors or posted completions
+
+        descriptors.clear();
+        descriptors.push_back({ .fd = wakeupFd, .events = POLLIN, .revents = 0 });
+
+        for (const auto& watcher: watchers) {
+            descriptors.push_back({ .fd = watcher.fd, .events = watcher.events, .revents = 0 });
+        }
+
+        if (poll(descriptors.data(), descriptors.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw std::runtime_error("Reactor polling failed: " + getError());
+        }
+
+        // 2. Collect coroutines to resume. Resumed coroutines register new watchers,
+        // so the list of fired ones is detached first
+
+        ready.clear();
+
+        if (descriptors[0].revents & POLLIN) {
+            drainEventFd(wakeupFd);
+
+            std::lock_guard<std::mutex> lock(postedMutex);
+
+            if (isStopped) {
+                return;
+            }
+
+            ready.swap(posted);
+        }
+
+        size_t numPending = 0;
+
+        for (size_t i = 0; i < watchers.size(); ++i) {
+            if (descriptors[i + 1].revents != 0) {
+                ready.push_back(watchers[i].handle);
+            } else {
+                watchers[numPending++] = watchers[i];
+            }
+        }
+
+        watchers.resize(numPending);
+
+        // 3. Resume them and forget finished top-level tasks
+
+        for (auto handle: ready) {
+            handle.resume();
+        }
+
+        reapTasks();
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+// Requires C++20, see `SOCKET_DEMO_COROUTINES` CMake option
+
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <condition_variable>
+#include <optional>
+#include <type_traits>
+
+#include "async_task.h"
+
+// Single-threaded poll reactor resuming coroutines once their descriptors become ready or their
+// offloaded work completes. Offloaded work runs on a small pool of worker threads; completions are
+// handed back to the reactor thread through an eventfd, so coroutines are always resumed on it
+class Reactor {
+public:
+    explicit Reactor(size_t numWorkers);
+
+    ~Reactor();
+
+    // Forbid copying
+
+    Reactor(Reactor&) = delete;
+    Reactor operator=(Reactor&) = delete;
+
+    // Starts top-level coroutine. Reactor owns it and destroys it once it finishes
+    void spawn(Task<void> task);
+
+    // Runs until `stop` is called
+    void run();
+
+    // Thread-safe
+    void stop();
+
+    struct FdAwaiter {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { reactor.watch(fd, events, handle); }
+        void await_resume() const noexcept {}
+
+        Reactor& reactor;
+        int fd;
+        short events;
+    };
+
+    // `co_await reactor.readable(fd)` suspends until `fd` is readable (or hung up)
+    FdAwaiter readable(int fd) { return { *this, fd, POLL_READ }; }
+
+    FdAwaiter writable(int fd) { return { *this, fd, POLL_WRITE }; }
+
+    template<typename F>
+    struct OffloadAwaiter {
+        using Result = std::invoke_result_t<F>;
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            reactor.submit([this, handle] {
+                result.emplace(function());
+                reactor.post(handle);
+            });
+        }
+
+        Result await_resume() { return std::move(*result); }
+
+        Reactor& reactor;
+        F function;
+        std::optional<Result> result;
+    };
+
+    // `co_await reactor.offload(f)` runs `f` on a worker thread and resumes with its result.
+    // Without workers `f` runs in place
+    template<typename F>
+    OffloadAwaiter<F> offload(F function) { return { *this, std::move(function), std::nullopt }; }
+
+    size_t getNumWorkers() const { return workers.size(); }
+
+private:
+    static const short POLL_READ;
+    static const short POLL_WRITE;
+
+    struct Watcher {
+        int fd;
+        short events;
+        std::coroutine_handle<> handle;
+    };
+
+    void watch(int fd, short events, std::coroutine_handle<> handle);
+
+    // Queues job for worker threads (or runs it in place without workers)
+    void submit(std::function<void()> job);
+
+    // Thread-safe: schedules coroutine resumption on the reactor thread
+    void post(std::coroutine_handle<> handle);
+
+    void workerLoop();
+
+    // Destroys finished top-level tasks
+    void reapTasks();
+
+    std::vector<Watcher> watchers;
+    std::list<Task<void>> tasks;
+
+    int wakeupFd;
+    bool isStopped = false;
+
+    std::mutex postedMutex;
+    std::vector<std::coroutine_handle<>> posted;
+
+    std::mutex jobsMutex;
+    std::condition_variable jobsCondition;
+    std::deque<std::function<void()>> jobs;
+    bool isShuttingDown = false;
+    std::vector<std::thread> workers;
+};
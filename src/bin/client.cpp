@@ -1,21 +1,287 @@
 #include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+
+#include "client_factory.h"
+#include "command_line.h"
+#include "binary_protocol.h"
+#include "projection.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Extracts integer tokens from the line for binary protocol
+static std::vector<Number> parseNumbers(const std::string& line) {
+    std::stringstream ss(line);
+    std::string token;
+    std::vector<Number> numbers;
+
+    while (ss >> token) {
+        Number number;
+
+        if (std::stringstream(token) >> number) {
+            numbers.push_back(number);
+        }
+    }
+
+    return numbers;
+}
+
+// Builds request from the input line: numbers are encoded if binary protocol is requested,
+// together with the projection directive if the line starts with one (see `projection.h`).
+// Returns false with the reason in `error` if the line cannot be sent
+static bool buildRequest(const std::string& line, bool useBinary, std::string& request, std::string& error) {
+    request = line;
+
+    if (useBinary) {
+        const std::vector<Number> numbers = parseNumbers(line);
+
+        std::string directive;
+        Projection projection;
+
+        if (std::stringstream(line) >> directive &&
+            parseProjection(directive.data(), directive.data() + directive.size(), projection))
+        {
+            if (!encodeBinaryProjectionRequest(projection, numbers, request)) {
+                error = "Too many numbers or too large k, at most " + std::to_string(BINARY_PROJECTION_MAX_NUMBERS) +
+                        " numbers are allowed";
+                return false;
+            }
+        } else if (!numbers.empty() && !encodeBinaryRequest(numbers, request)) {
+            error = "Too many numbers, at most " + std::to_string(BINARY_MAX_NUMBERS) + " are allowed";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Renders response for printing, binary one is rendered just like the text one
+static std::string renderResponse(const std::string& request, const std::string& response, bool isReceived) {
+    std::vector<Number> sortedNumbers;
+    Number sum;
+
+    if (!isReceived) {
+        return "Error receiving response from server";
+    } else if (isBinaryMessage(request) && decodeBinaryResponse(request, response, sortedNumbers, sum)) {
+        return formatBinaryResponse(sortedNumbers, sum);
+    } else if (isBinaryProjectionMessage(request) && decodeBinaryProjectionResponse(response, sortedNumbers)) {
+        return formatProjectionResponse(sortedNumbers);
+    } else if (isBinaryMessage(request) || isBinaryProjectionMessage(request)) {
+        return "Server does not support binary protocol or rejected the request";
+    }
+
+    return response;
+}
+
+// Input line in flight, kept until its response is written out in input order
+struct BulkEntry {
+    std::string request;
+    std::string response;
+    bool isDone = false;
+    bool isReceived = false;
+    double latencyUs = 0;
+};
+
+// Sends every non-empty input line with a pool of clients, each having one request in flight
+// (stream transports have no message boundaries, so requests cannot be pipelined over one connection).
+// Coalescing UDP client is thread-safe, so it is the same for every worker.
+// Responses are written in input order, summary goes to stderr. Returns exit code
+static int runBulk(const std::vector<Client*>& clients, std::istream& input, std::ostream& output,
+                   bool useBinary)
+{
+    // Lines are read ahead at most this far behind the oldest unanswered one
+    const size_t maxWindowSize = 4 * clients.size();
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<BulkEntry> window;
+    size_t numSent = 0;
+    bool isInputOver = false;
+
+    const Clock::time_point start = Clock::now();
+
+    // 1. Reader fills the window. It blocks on input apart from the rest, so slowly fed input
+    // does not hold back responses which have already arrived
+
+    std::thread reader([&] {
+        std::string line;
+
+        while (std::getline(input, line)) {
+            if (line.empty()) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&] { return window.size() < maxWindowSize; });
+
+            window.emplace_back();
+            window.back().request = std::move(line);
+            condition.notify_all();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        isInputOver = true;
+        condition.notify_all();
+    });
+
+    // 2. Each worker takes the oldest unsent line. Deque keeps references to its elements valid,
+    // and the entry is not written out until it is done
+
+    std::vector<std::thread> workers;
+    size_t numWritten = 0;
+
+    for (Client *client: clients) {
+        workers.emplace_back([&, client] {
+            std::string request;
+            std::string error;
+
+            for (;;) {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [&] { return numSent < numWritten + window.size() || isInputOver; });
+
+                if (numSent == numWritten + window.size()) {
+                    return;
+                }
+
+                BulkEntry& entry = window[numSent++ - numWritten];
+                lock.unlock();
+
+                bool isReceived = false;
+                const Clock::time_point sentAt = Clock::now();
+
+                if (buildRequest(entry.request, useBinary, request, error)) {
+                    isReceived = client->request(request, entry.response);
+                    entry.response = renderResponse(request, entry.response, isReceived);
+                } else {
+                    entry.response = error;
+                }
+
+                const double latencyUs = std::chrono::duration<double, std::micro>(Clock::now() - sentAt).count();
+
+                lock.lock();
+                entry.isDone = true;
+                entry.isReceived = isReceived;
+                entry.latencyUs = latencyUs;
+                condition.notify_all();
+            }
+        });
+    }
+
+    // 3. Write responses in order as soon as the oldest one is done
+
+    std::vector<double> latencies;
+    size_t numFailures = 0;
+    size_t numBytes = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        for (;;) {
+            condition.wait(lock, [&] {
+                return window.empty() ? isInputOver : window.front().isDone;
+            });
+
+            if (window.empty()) {
+                break;
+            }
+
+            BulkEntry entry = std::move(window.front());
+            window.pop_front();
+            ++numWritten;
+            condition.notify_all();
+            lock.unlock();
+
+            output << entry.response << '\n';
+
+            if (entry.isReceived) {
+                latencies.push_back(entry.latencyUs);
+                numBytes += entry.request.size() + entry.response.size();
+            } else {
+                ++numFailures;
+            }
+
+            lock.lock();
+        }
+    }
+
+    output.flush();
+
+    reader.join();
+
+    for (auto& worker: workers) {
+        worker.join();
+    }
+
+    // 4. Summarize
+
+    const double elapsedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    const size_t numRequests = latencies.size() + numFailures;
+
+    std::cerr << std::fixed << std::setprecision(1)
+              << numRequests << " requests, " << numFailures << " failed in " << elapsedSeconds << " s: "
+              << numRequests / elapsedSeconds << " req/s, " << numBytes / elapsedSeconds / 1024 << " KiB/s" << std::endl;
 
-#include "client_udp.h"
-#include "client_tcp.h"
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+
+        auto percentile = [&](double p) {
+            return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+        };
+
+        double sum = 0;
+
+        for (const double latency: latencies) {
+            sum += latency;
+        }
+
+        std::cerr << "latency us: mean " << sum / latencies.size() << ", min " << latencies.front()
+                  << ", p50 " << percentile(0.5) << ", p90 " << percentile(0.9) << ", p99 " << percentile(0.99)
+                  << ", max " << latencies.back() << std::endl;
+    }
+
+    return numFailures == 0 ? 0 : 1;
+}
 
 int main(int argc, char **argv) {
     static const uint8_t numRequiredParameters = 3;
 
+    CommandLineOptions options;
+    argc = extractOptions(argc, argv, options);
+
     if (argc < numRequiredParameters + 1) {
         std::cout << "Usage: " << argv[0]
-                  << " <server_address> <port> <protocol:TCP|UDP> [operations_timeout_s]\n"
+                  << " <server_address> <port> <protocol:TCP|UDP|UNIX|SEQPACKET|SHM> [operations_timeout_s]\n"
                   << "e.g. " << argv[0] << " 127.0.0.1 8888 TCP 5\n"
                   << "Arguments:\n"
-                  << "* server_address - server address\n"
-                  << "* port - port to use\n"
-                  << "* protocol - protocol to use ('TCP' or 'UDP')\n"
+                  << "* server_address - server address, or socket path for unix protocols\n"
+                  << "* port - port to use (ignored for unix protocols)\n"
+                  << "* protocol - protocol to use ('TCP', 'UDP', 'UNIX' for unix stream socket"
+                     ", 'SEQPACKET' for unix sequenced-packet socket"
+                     " or 'SHM' for shared memory)\n"
                   << "* operations_timeout_s - all operations timeout in seconds, default is 5\n"
-                  << "* udp_max_tries - number of send-receive attempts to make (only when UDP is used), default is 10"
+                  << "* udp_max_tries - number of send-receive attempts to make (only when UDP is used), default is 10\n"
+                  << "Options:\n"
+                  << "* --udp-initial-rto-ms=N - UDP retransmission timeout until round trip time is measured, default is 200\n"
+                  << "* --udp-min-rto-ms=N, --udp-max-rto-ms=N - bounds of UDP retransmission timeout, defaults are 10 and 2000\n"
+                  << "* --binary - send numbers using binary protocol, messages without numbers are still sent as text\n"
+                  << "Messages starting with @sum, @count, @minmax, @smallest=K or @largest=K ask for that part"
+                     " of the response only\n"
+                  << "* --fast-open - carry the first message in SYN with TCP Fast Open (only when TCP is used)\n"
+                  << "* --bulk - send newline-delimited messages from stdin without prompts and print a summary\n"
+                  << "* --input=PATH - read messages from file instead of stdin (implies --bulk)\n"
+                  << "* --output=PATH - write responses to file instead of stdout (bulk mode only)\n"
+                  << "* --in-flight=N - bulk mode keeps up to N requests in flight over N connections, default is 16\n"
+                  << "* --udp-coalesce - bulk mode packs requests in flight into shared UDP datagrams over one socket\n"
+                  << "* --linger-us=N, --max-datagram=N - how long coalesced requests wait for others and size limit\n"
+                  << "  of their datagrams, defaults are 100 and 1472"
                   << std::endl;
         return 0;
     }
@@ -26,21 +292,23 @@ int main(int argc, char **argv) {
 
     // 2. Parse server port
 
-    uint16_t port;
+    std::string protocol(argv[3]);
+
+    uint16_t port = 0;
 
-    try {
-        port = std::stoi(argv[2]);
-    } catch (...) {
-        std::cerr << "Invalid port number: " << argv[1] << std::endl;
-        return 1;
+    if (!isUnixProtocol(protocol)) {
+        try {
+            port = std::stoi(argv[2]);
+        } catch (...) {
+            std::cerr << "Invalid port number: " << argv[2] << std::endl;
+            return 1;
+        }
     }
 
     // 3. Parse protocol
 
-    std::string protocol(argv[3]);
-
-    if (protocol != "TCP" && protocol != "UDP") {
-        std::cerr << "Invalid protocol : " << argv[2] << std::endl;
+    if (!isValidProtocol(protocol)) {
+        std::cerr << "Invalid protocol : " << argv[3] << std::endl;
         return 1;
     }
 
@@ -59,73 +327,127 @@ int main(int argc, char **argv) {
 
     // 5. Try to parse UDP max tries number
 
-    size_t udpMaxTries = 10;
+    ClientOptions clientOptions;
 
     if (argc > 5) {
         try {
-            udpMaxTries = std::stoull(argv[5]);
+            clientOptions.udpRetry.maxTries = std::stoull(argv[5]);
         } catch (...) {
             std::cerr << "Invalid UDP max tries number: " << argv[5] << std::endl;
             return 1;
         }
     }
 
-    // 6. Create client
+    bool useBinary = false;
+    bool isBulk = false;
+    std::string inputPath;
+    std::string outputPath;
+    size_t numInFlight = 16;
+
+    if (!getOption(options, "binary", useBinary) || !getOption(options, "fast-open", clientOptions.tcpFastOpen) ||
+        !getOption(options, "udp-initial-rto-ms", clientOptions.udpRetry.initialTimeoutMs) ||
+        !getOption(options, "udp-min-rto-ms", clientOptions.udpRetry.minTimeoutMs) ||
+        !getOption(options, "udp-max-rto-ms", clientOptions.udpRetry.maxTimeoutMs) ||
+        !getOption(options, "bulk", isBulk) || !getOption(options, "input", inputPath) ||
+        !getOption(options, "output", outputPath) || !getOption(options, "in-flight", numInFlight) ||
+        !getOption(options, "udp-coalesce", clientOptions.udpCoalescing.enabled) ||
+        !getOption(options, "linger-us", clientOptions.udpCoalescing.lingerMicroseconds) ||
+        !getOption(options, "max-datagram", clientOptions.udpCoalescing.maxDatagramBytes) ||
+        !checkUnknownOptions(options))
+    {
+        return 1;
+    }
+
+    isBulk = isBulk || !inputPath.empty();
+
+    if (numInFlight == 0) {
+        std::cerr << "Number of requests in flight should be a positive value" << std::endl;
+        return 1;
+    }
+
+    if (clientOptions.udpCoalescing.enabled && protocol != "UDP") {
+        std::cerr << "--udp-coalesce requires UDP" << std::endl;
+        return 1;
+    }
+
+    // 6. In bulk mode open files and connections, stdout is left for responses
 
-    Client *client = nullptr;
+    if (isBulk) {
+        std::ifstream inputFile;
+        std::ofstream outputFile;
 
-    if (protocol == "TCP") {
-        client = new ClientTcp(serverAddress, port, std::cout, operationsTimoutSeconds);
-    } else if (protocol == "UDP") {
-        client = new ClientUdp(serverAddress, port, std::cout, operationsTimoutSeconds);
-    } else {
-        // Should never be there
-        throw;
+        if (!inputPath.empty()) {
+            inputFile.open(inputPath);
+
+            if (!inputFile) {
+                std::cerr << "Cannot open input file: " << inputPath << std::endl;
+                return 1;
+            }
+        }
+
+        if (!outputPath.empty()) {
+            outputFile.open(outputPath);
+
+            if (!outputFile) {
+                std::cerr << "Cannot open output file: " << outputPath << std::endl;
+                return 1;
+            }
+        }
+
+        std::vector<std::unique_ptr<Client>> ownedClients;
+        std::vector<Client*> clients;
+
+        for (size_t i = 0; i < numInFlight; ++i) {
+            if (ownedClients.empty() || !clientOptions.udpCoalescing.enabled) {
+                ownedClients.emplace_back(createClient(protocol, serverAddress, port, std::cerr,
+                                                       operationsTimoutSeconds, clientOptions));
+            }
+
+            clients.push_back(ownedClients.back().get());
+        }
+
+        return runBulk(clients, inputPath.empty() ? std::cin : inputFile,
+                       outputPath.empty() ? std::cout : outputFile, useBinary);
     }
 
-    // 7. Start input-send loop
+    // 7. Create client
+
+    Client *client = createClient(protocol, serverAddress, port, std::cout, operationsTimoutSeconds, clientOptions);
+
+    // 8. Start input-send loop, it ends with the input
 
     std::string msg;
+    std::string request;
+    std::string response;
+    std::string error;
 
     for (;;) {
         std::cout << "Enter your message: ";
-        std::getline(std::cin, msg);
 
-        if (msg.length() != 0) {
-            client->send(msg);
+        if (!std::getline(std::cin, msg)) {
+            std::cout << std::endl;
+            break;
+        }
 
-            if (protocol == "TCP") {
-                // TCP is simple one
+        if (msg.length() != 0) {
+            // 8.1. Encode numbers if binary protocol is requested
 
-                if (client->receive(msg)) {
-                    std::cout << msg << std::endl;
-                } else {
-                    std::cout << "Error receiving response from server" << std::endl;
-                }
-            } else {
-                // Try several times and then give up
+            if (!buildRequest(msg, useBinary, request, error)) {
+                std::cout << error << std::endl;
+                continue;
+            }
 
-                bool isReceived = false;
+            // 8.2. Send request and receive response, UDP client retransmits lost ones itself
 
-                for (size_t i = 0; i < udpMaxTries; ++i) {
-                    if (client->receive(msg)) {
-                        isReceived = true;
-                        break;
-                    }
+            const bool isReceived = client->request(request, response);
 
-                    client->send(msg);
-                }
+            // 8.3. Print response
 
-                if (isReceived) {
-                    std::cout << msg << std::endl;
-                } else {
-                    std::cout << "Error receiving response from server" << std::endl;
-                }
-            }
+            std::cout << renderResponse(request, response, isReceived) << std::endl;
         }
     }
 
     delete client;
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,44 +1,230 @@
+#include <mutex>
 #include <memory>
+#include <thread>
+#include <chrono>
+#include <csignal>
+#include <functional>
+#include <type_traits>
+#include <condition_variable>
+#include <fstream>
 #include <iostream>
 
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "command_line.h"
 #include "echo_server_delegate.h"
 #include "server_tcp.h"
 #include "server_udp.h"
+#include "server_unix.h"
+#include "server_shm.h"
+#include "client_factory.h"
+#include "trace.h"
+
+#ifdef SOCKET_DEMO_HAS_COROUTINES
+#include "server_async.h"
+#endif
+
+// Lets helper threads sleep until the event loop returns
+class ShutdownNotice {
+public:
+    void notify() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            isNotified = true;
+        }
+
+        condition.notify_all();
+    }
+
+    // Returns true if notified before `timeout` expired
+    bool waitFor(std::chrono::seconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return condition.wait_for(lock, timeout, [this] { return isNotified; });
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool isNotified = false;
+};
+
+// Prints counters of `server` every `interval` together with their rates until `shutdown` is notified
+static void reportStats(const Server& server, std::chrono::seconds interval, ShutdownNotice& shutdown) {
+    ServerStats previous = server.stats();
+
+    while (!shutdown.waitFor(interval)) {
+        const ServerStats current = server.stats();
+        const double seconds = static_cast<double>(interval.count());
+        const uint64_t numAccepted = current.acceptedConnections - previous.acceptedConnections;
+        const uint64_t numAcceptWakeups = current.acceptWakeups - previous.acceptWakeups;
+
+        std::cout << "Stats: accepted " << current.acceptedConnections
+                  << " (" << numAccepted / seconds << "/s, "
+                  << (numAcceptWakeups > 0 ? static_cast<double>(numAccepted) / numAcceptWakeups : 0.0)
+                  << " per wakeup), rejected connections " << current.rejectedConnections
+                  << ", rejected requests " << current.rejectedRequests
+                  << ", shed requests " << current.shedRequests
+                  << ", spin/sleep wakeups " << current.spinWakeups << "/" << current.sleepWakeups
+                  << ", zero copy sent/copied bytes " << current.zeroCopySentBytes << "/" << current.zeroCopyCopiedBytes
+                  << ", UDP GSO/GRO segments " << current.udpGsoSegments << "/" << current.udpGroSegments
+                  << std::endl;
+
+        // Loop busy time beyond delegate time is what the server itself adds to latency
+
+        uint64_t iterationHistogram[LOOP_HISTOGRAM_BUCKETS];
+        uint64_t processHistogram[LOOP_HISTOGRAM_BUCKETS];
+
+        for (size_t i = 0; i < LOOP_HISTOGRAM_BUCKETS; ++i) {
+            iterationHistogram[i] = current.loopIterationHistogram[i] - previous.loopIterationHistogram[i];
+            processHistogram[i] = current.loopProcessHistogram[i] - previous.loopProcessHistogram[i];
+        }
+
+        const uint64_t numRequests = current.loopRequests - previous.loopRequests;
+        const uint64_t numSyscalls = current.loopSyscalls - previous.loopSyscalls;
+        const uint64_t busyMicroseconds = current.loopBusyMicroseconds - previous.loopBusyMicroseconds;
+
+        std::cout << "Loop: wakeups " << current.loopWakeups << ", requests " << current.loopRequests
+                  << " (" << numRequests / seconds << "/s, "
+                  << (numRequests > 0 ? static_cast<double>(numSyscalls) / numRequests : 0.0) << " syscalls each)"
+                  << ", busy " << busyMicroseconds / (seconds * 10000) << "%"
+                  << ", delegate/busy us " << current.loopProcessMicroseconds << "/" << current.loopBusyMicroseconds
+                  << ", p99 iteration/delegate us <= "
+                  << getHistogramQuantileMicroseconds(iterationHistogram, 0.99) << "/"
+                  << getHistogramQuantileMicroseconds(processHistogram, 0.99)
+                  << ", max iteration us " << current.loopMaxIterationMicroseconds
+                  << ", stalls " << current.loopStalls << std::endl;
+
+        previous = current;
+    }
+}
+
+// Signals are handled by a dedicated thread with `sigwait` instead of signal handlers, so that it may
+// call anything. They have to be blocked before any other thread is started, threads inherit the mask
+static sigset_t blockHandledSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    return signals;
+}
+
+// Writes collected trace into `traceFile` on SIGUSR1. Calls `stop` and returns on SIGINT or SIGTERM
+static void handleSignals(const sigset_t& signals, const std::function<void()>& stop, const std::string& traceFile) {
+    for (;;) {
+        int signal = 0;
+
+        if (sigwait(&signals, &signal) != 0) {
+            continue;
+        }
+
+        if (signal != SIGUSR1) {
+            std::cout << "Stopping..." << std::endl;
+            stop();
+            return;
+        }
+
+        std::ofstream file(traceFile);
+        writeChromeTrace(file);
+
+        if (file) {
+            std::cout << "Trace written to " << traceFile << std::endl;
+        } else {
+            std::cerr << "Cannot write trace to " << traceFile << std::endl;
+        }
+    }
+}
 
 int main(int argc, char **argv) {
     static const uint8_t numRequiredParameters = 2;
 
+    CommandLineOptions options;
+    argc = extractOptions(argc, argv, options);
+
     if (argc < numRequiredParameters + 1) {
-        std::cout << "Usage: " << argv[0] << " <port> <protocol:TCP|UDP> [connection_queue_size] [operations_timeout_s]\n"
+        std::cout << "Usage: " << argv[0] << " <port> <protocol:TCP|UDP|UNIX|SEQPACKET|SHM> [connection_queue_size] [operations_timeout_s]\n"
                   << "e.g. " << argv[0] << " 8888 TCP 10 5\n"
                   << "Arguments:\n"
-                  << "* port - port to use\n"
-                  << "* protocol - protocol to use ('TCP' or 'UDP')\n"
+                  << "* port - port to use, or socket path for unix protocols\n"
+                  << "* protocol - protocol to use ('TCP', 'UDP', 'UNIX' for unix stream socket"
+                     ", 'SEQPACKET' for unix sequenced-packet socket"
+                     " or 'SHM' for shared memory)\n"
                   << "* connection_queue_size - number of connection requests to be queued before further"
-                     " requests are refused, default is 1024 (only when TCP is used)\n"
-                  << "* operations_timeout_s - all operations timeout in seconds, default is 5 (only when TCP is used)"
+                     " requests are refused, default is 1024 (not used for UDP)\n"
+                  << "* operations_timeout_s - all operations timeout in seconds, default is 5 (not used for UDP)\n"
+                  << "Options:\n"
+                  << "* --max-connections=N - maximum number of opened connections (not used for UDP)\n"
+                  << "* --max-connections-per-ip=N - maximum number of opened connections from a single IP"
+                     " or unix user (not used for UDP)\n"
+                  << "* --requests-per-second=R, --requests-burst=B - per peer IP requests token bucket\n"
+                  << "* --bytes-per-second=R, --bytes-burst=B - per peer IP payload bytes token bucket\n"
+                  << "* --max-loop-lag-ms=T - shed requests which waited in the server longer than T ms\n"
+                  << "Limits are disabled by default\n"
+                  << "* --shm-slots=N - number of message slots per shared memory ring, default is 8 (only when SHM is used)\n"
+                  << "* --shm-spin-us=T - time to spin over rings before sleeping, default is 50 (only when SHM is used)\n"
+                  << "* --spin-us=T - latency mode: spin over non-blocking socket checks for T us before sleeping"
+                     " (not used for SHM and async)\n"
+                  << "* --cpus=LIST - pin event loop to comma separated CPUs and steer socket to the first one"
+                     " with SO_INCOMING_CPU (not used for SHM and async)\n"
+                  << "* --so-busy-poll-us=T - set SO_BUSY_POLL (not used for SHM and async)\n"
+                  << "* --defer-accept-s=T - wake up accept only when client data arrives, or after T s (only when TCP is used)\n"
+                  << "* --fast-open=N - enable TCP Fast Open with N pending connections (only when TCP is used)\n"
+                  << "* --tcp-nodelay, --tcp-cork - set TCP_NODELAY or TCP_CORK on connections (only when TCP is used)\n"
+                  << "* --zerocopy-min-bytes=N - send responses of at least N bytes (4096 or more) with MSG_ZEROCOPY"
+                     " (only when TCP is used, not used for async)\n"
+                  << "* --udp-shards=N - serve UDP with N SO_REUSEPORT sockets and event loop threads,"
+                     " each pinned to its own CPU of --cpus (only when UDP is used)\n"
+                  << "* --udp-steering=kernel|cpu|flow - spread datagrams over shards by kernel hash (default),"
+                     " receiving CPU or source address and port\n"
+                  << "* --udp-gso - send runs of same-size responses to a peer as one UDP_SEGMENT datagram"
+                     " (only when UDP is used)\n"
+                  << "* --udp-gro - receive datagrams coalesced with UDP_GRO (only when UDP is used)\n"
+                  << "* --stats-interval-s=T - print server counters and rates every T s (not used with --quiet)\n"
+                  << "* --stall-threshold-ms=T - report event loop iterations busy for longer than T ms"
+                     " (not used for SHM and async)\n"
+                  << "* --capture=PATH - record received requests into PATH for replay (not used for SHM and async)\n"
+                  << "* --trace-sample=N - trace one of N event loop iterations, SIGUSR1 writes spans into --trace-file"
+                     " as Chrome Trace JSON (not used for SHM and async)\n"
+                  << "* --trace-file=PATH - trace file, default is socket_demo_trace.json\n"
+                  << "* --quiet - run request path specialized for echo delegate with logging compiled out"
+                     " (SHM only stops logging requests)\n"
+                  << "* --async - serve TCP connections with coroutines (only if built with C++20 coroutines)\n"
+                  << "* --async-workers=N - number of threads requests are processed on in async mode,"
+                     " default is 0 (process in place)\n"
+                  << "* --parallel-threads=N - process large requests on N threads, default is 0 (sequentially)\n"
+                  << "* --parallel-min-bytes=N - requests from N bytes are processed in parallel, default is 16384"
                   << std::endl;
         return 0;
     }
 
-    // 1. Parse port
+    // 1. Parse protocol
 
-    uint16_t port;
+    std::string protocol(argv[2]);
 
-    try {
-        port = std::stoi(argv[1]);
-    } catch (...) {
-        std::cerr << "Invalid port number: " << argv[1] << std::endl;
+    if (!isValidProtocol(protocol)) {
+        std::cerr << "Invalid protocol : " << argv[2] << std::endl;
         return 1;
     }
 
-    // 2. Parse protocol
+    // 2. Parse port, unix protocols use socket path instead
 
-    std::string protocol(argv[2]);
+    uint16_t port = 0;
+    std::string socketPath;
 
-    if (protocol != "TCP" && protocol != "UDP") {
-        std::cerr << "Invalid protocol : " << argv[2] << std::endl;
-        return 1;
+    if (isUnixProtocol(protocol)) {
+        socketPath = argv[1];
+    } else {
+        try {
+            port = std::stoi(argv[1]);
+        } catch (...) {
+            std::cerr << "Invalid port number: " << argv[1] << std::endl;
+            return 1;
+        }
     }
 
     // 3. Try to parse connection queue size and timeout
@@ -64,31 +250,250 @@ int main(int argc, char **argv) {
         }
     }
 
-    // 4. Create server
+    // 4. Parse optional limits
+
+    ServerOptions serverOptions;
+    OverloadLimits& limits = serverOptions.overload;
+
+    if (!getOption(options, "max-connections", limits.maxConnections) ||
+        !getOption(options, "max-connections-per-ip", limits.maxConnectionsPerIp) ||
+        !getOption(options, "requests-per-second", limits.requestsPerSecond) ||
+        !getOption(options, "requests-burst", limits.requestsBurst) ||
+        !getOption(options, "bytes-per-second", limits.bytesPerSecond) ||
+        !getOption(options, "bytes-burst", limits.bytesBurst) ||
+        !getOption(options, "max-loop-lag-ms", limits.maxLoopLagMs))
+    {
+        return 1;
+    }
+
+    uint32_t shmSlots = 8;
+    long shmSpinMicroseconds = 50;
+
+    if (!getOption(options, "shm-slots", shmSlots) || !getOption(options, "shm-spin-us", shmSpinMicroseconds)) {
+        return 1;
+    }
+
+    BusyPollOptions& busyPoll = serverOptions.busyPoll;
+
+    if (!getOption(options, "spin-us", busyPoll.spinMicroseconds) || !getOption(options, "cpus", busyPoll.cpus) ||
+        !getOption(options, "so-busy-poll-us", busyPoll.socketBusyPollMicroseconds))
+    {
+        return 1;
+    }
+
+    if (!getOption(options, "defer-accept-s", serverOptions.tcp.deferAcceptSeconds) ||
+        !getOption(options, "fast-open", serverOptions.tcp.fastOpenQueueLength) ||
+        !getOption(options, "tcp-nodelay", serverOptions.tcp.noDelay) ||
+        !getOption(options, "tcp-cork", serverOptions.tcp.cork) ||
+        !getOption(options, "zerocopy-min-bytes", serverOptions.tcp.zeroCopyMinBytes))
+    {
+        return 1;
+    }
+
+    std::string udpSteering = "kernel";
+
+    if (!getOption(options, "udp-shards", serverOptions.udp.numShards) ||
+        !getOption(options, "udp-steering", udpSteering) ||
+        !getOption(options, "udp-gso", serverOptions.udpOffload.segmentation) ||
+        !getOption(options, "udp-gro", serverOptions.udpOffload.receiveOffload))
+    {
+        return 1;
+    }
+
+    if (udpSteering == "kernel") {
+        serverOptions.udp.steering = UdpSteering::Kernel;
+    } else if (udpSteering == "cpu") {
+        serverOptions.udp.steering = UdpSteering::Cpu;
+    } else if (udpSteering == "flow") {
+        serverOptions.udp.steering = UdpSteering::FlowHash;
+    } else {
+        std::cerr << "Invalid value of --udp-steering: " << udpSteering << std::endl;
+        return 1;
+    }
+
+    long statsIntervalSeconds = 0;
+
+    if (!getOption(options, "stats-interval-s", statsIntervalSeconds) ||
+        !getOption(options, "stall-threshold-ms", serverOptions.watchdog.stallThresholdMs) ||
+        !getOption(options, "capture", serverOptions.capturePath))
+    {
+        return 1;
+    }
+
+    uint32_t traceSampling = 0;
+    std::string traceFile = "socket_demo_trace.json";
+
+    if (!getOption(options, "trace-sample", traceSampling) || !getOption(options, "trace-file", traceFile)) {
+        return 1;
+    }
+
+    bool quiet = false;
+    bool async = false;
+    size_t asyncWorkers = 0;
+
+    if (!getOption(options, "quiet", quiet) || !getOption(options, "async", async) ||
+        !getOption(options, "async-workers", asyncWorkers))
+    {
+        return 1;
+    }
+
+    EchoParallelOptions parallelOptions;
+
+    if (!getOption(options, "parallel-threads", parallelOptions.numThreads) ||
+        !getOption(options, "parallel-min-bytes", parallelOptions.minRequestBytes) ||
+        !checkUnknownOptions(options))
+    {
+        return 1;
+    }
+
+#ifndef SOCKET_DEMO_HAS_COROUTINES
+    if (async) {
+        std::cerr << "Async mode is not available: server is built without C++20 coroutines" << std::endl;
+        return 1;
+    }
+#endif
+
+    if (async && protocol != "TCP") {
+        std::cerr << "Async mode is supported only for TCP" << std::endl;
+        return 1;
+    }
+
+    if (!serverOptions.capturePath.empty() && (async || protocol == "SHM")) {
+        std::cerr << "Capture is not supported for SHM and async mode" << std::endl;
+        return 1;
+    }
+
+    setTraceSampling(traceSampling);
+
+    const sigset_t handledSignals = blockHandledSignals();
+
+    // 5. Quiet mode bypasses `Server` interface and runs statically dispatched request path
+
+    if (quiet && !async && protocol != "SHM") {
+        EchoServerDelegate echoServerDelegate(parallelOptions);
+        std::unique_ptr<CaptureWriter> capture;
+
+        // Stalls are worth reporting even with logging compiled out
+        const std::chrono::milliseconds stallThreshold(serverOptions.watchdog.stallThresholdMs);
+
+        if (!serverOptions.capturePath.empty()) {
+            capture.reset(new CaptureWriter(serverOptions.capturePath));
+        }
+
+        if (protocol == "UDP") {
+            using Core = ServerUdp::Core<EchoServerDelegate, NullLogger>;
+
+            std::vector<FdGuard> sockets = ServerUdp::createShardSockets(port, serverOptions.udp);
+            std::vector<std::unique_ptr<Core>> cores;
+
+            for (size_t i = 0; i < sockets.size(); ++i) {
+                cores.emplace_back(new Core(NullLogger(std::cout), std::move(sockets[i]), limits,
+                                            ServerUdp::getShardBusyPollOptions(busyPoll, i), serverOptions.udpOffload));
+                cores.back()->setCapture(capture.get(), CaptureProtocol::UDP);
+                cores.back()->setStallWatchdog(stallThreshold, std::cerr);
+            }
+
+            std::thread signalThread(handleSignals, std::cref(handledSignals), [&cores] {
+                for (const auto& core: cores) {
+                    core->stop();
+                }
+            }, traceFile);
+
+            std::vector<std::thread> shards;
+
+            for (const auto& core: cores) {
+                shards.emplace_back([&core, &echoServerDelegate] { core->run(&echoServerDelegate); });
+            }
+
+            for (auto& shard: shards) {
+                shard.join();
+            }
+
+            signalThread.join();
+        } else {
+            using Core = ServerTcp::Core<EchoServerDelegate, NullLogger>;
+            static_assert(std::is_same<Core, ServerUnix::Core<EchoServerDelegate, NullLogger>>::value,
+                          "TCP and unix servers are expected to share the request path");
+
+            FdGuard listeningSocket(protocol == "TCP"
+                ? ServerTcp::createListeningSocket(port, connectionQueueSize, operationsTimoutSeconds, serverOptions.tcp)
+                : ServerUnix::createListeningSocket(socketPath, protocol == "UNIX" ? SOCK_STREAM : SOCK_SEQPACKET,
+                                                    connectionQueueSize, operationsTimoutSeconds));
+
+            Core core(NullLogger(std::cout), std::move(listeningSocket), limits, busyPoll, serverOptions.tcp.zeroCopyMinBytes);
+            core.setCapture(capture.get(), protocol == "TCP" ? CaptureProtocol::TCP
+                                           : protocol == "UNIX" ? CaptureProtocol::UNIX : CaptureProtocol::SEQPACKET);
+            core.setStallWatchdog(stallThreshold, std::cerr);
+
+            std::thread signalThread(handleSignals, std::cref(handledSignals), [&core] { core.stop(); }, traceFile);
+
+            core.run(&echoServerDelegate);
+            signalThread.join();
+
+            if (protocol != "TCP") {
+                unlink(socketPath.c_str());
+            }
+        }
+
+        return 0;
+    }
+
+    // 6. Create server
 
     Server *server = nullptr;
 
-    if (protocol == "TCP") {
-        server = new ServerTcp(port, std::cout, connectionQueueSize, operationsTimoutSeconds);
+    if (async) {
+#ifdef SOCKET_DEMO_HAS_COROUTINES
+        server = new ServerAsync(port, std::cout, connectionQueueSize, operationsTimoutSeconds, asyncWorkers,
+                                 serverOptions);
+#endif
+    } else if (protocol == "TCP") {
+        server = new ServerTcp(port, std::cout, connectionQueueSize, operationsTimoutSeconds, serverOptions);
     } else if (protocol == "UDP") {
-        server = new ServerUdp(port, std::cout);
+        server = new ServerUdp(port, std::cout, serverOptions);
+    } else if (protocol == "UNIX") {
+        server = new ServerUnix(socketPath, SOCK_STREAM, std::cout, connectionQueueSize,
+                                operationsTimoutSeconds, serverOptions);
+    } else if (protocol == "SEQPACKET") {
+        server = new ServerUnix(socketPath, SOCK_SEQPACKET, std::cout, connectionQueueSize,
+                                operationsTimoutSeconds, serverOptions);
+    } else if (protocol == "SHM") {
+        server = new ServerShm(socketPath, std::cout, connectionQueueSize, shmSlots, shmSpinMicroseconds,
+                               serverOptions, !quiet);
     } else {
         // Should never be there
         throw;
     }
 
-    // 5. Create echo server delegate
+    // 7. Create echo server delegate
 
-    ServerDelegate *serverDelegate = new EchoServerDelegate;
+    ServerDelegate *serverDelegate = new EchoServerDelegate(parallelOptions);
 
-    // 6. Run event loop
+    // 8. Stop on signals, report counters periodically if requested, then run event loop until stopped
+
+    std::thread signalThread(handleSignals, std::cref(handledSignals), [server] { server->stop(); }, traceFile);
+
+    ShutdownNotice shutdown;
+    std::thread statsThread;
+
+    if (statsIntervalSeconds > 0) {
+        statsThread = std::thread(reportStats, std::cref(*server), std::chrono::seconds(statsIntervalSeconds),
+                                  std::ref(shutdown));
+    }
 
     server->eventLoop(serverDelegate);
 
-    // 7. Deallocate stuff (actually control flow will never be here)
+    shutdown.notify();
+    signalThread.join();
+
+    if (statsThread.joinable()) {
+        statsThread.join();
+    }
+
+    // 9. Deallocate stuff
 
     delete serverDelegate;
     delete server;
 
     return 0;
-}
\ No newline at end of file
+}
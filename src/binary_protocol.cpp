@@ -0,0 +1,132 @@
+#include <cstring>
+#include <sstream>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "binary_protocol.h"
+
+static constexpr bool IS_LITTLE_ENDIAN = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+bool isBinaryMessage(const std::string& message) {
+    return isBinaryMessage(message.data(), message.size());
+}
+
+bool isBinaryMessage(const char *data, size_t size) {
+    return size >= BINARY_MAGIC_SIZE && std::memcmp(data, BINARY_MAGIC, BINARY_MAGIC_SIZE) == 0;
+}
+
+void loadNumbers(const char *data, size_t count, Number *numbers) {
+    if (IS_LITTLE_ENDIAN) {
+        std::memcpy(numbers, data, count * sizeof(Number));
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t value = 0;
+
+        for (size_t byte = 0; byte < sizeof(Number); ++byte) {
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(data[i * sizeof(Number) + byte])) << (8 * byte);
+        }
+
+        numbers[i] = static_cast<Number>(value);
+    }
+}
+
+void storeNumbers(const Number *numbers, size_t count, std::string& message) {
+    const size_t offset = message.size();
+    message.resize(offset + count * sizeof(Number));
+
+    char *data = &message[offset];
+
+    if (IS_LITTLE_ENDIAN) {
+        std::memcpy(data, numbers, count * sizeof(Number));
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const uint64_t value = static_cast<uint64_t>(numbers[i]);
+
+        for (size_t byte = 0; byte < sizeof(Number); ++byte) {
+            data[i * sizeof(Number) + byte] = static_cast<char>(value >> (8 * byte));
+        }
+    }
+}
+
+Number sumNumbers(const char *data, size_t count) {
+    // Unsigned arithmetic makes overflow wrap instead of being undefined
+    uint64_t sum = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    if (IS_LITTLE_ENDIAN) {
+        // Two independent accumulators hide the latency of additions
+        __m128i first = _mm_setzero_si128();
+        __m128i second = _mm_setzero_si128();
+
+        for (; i + 4 <= count; i += 4) {
+            first = _mm_add_epi64(first, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i * sizeof(Number))));
+            second = _mm_add_epi64(second, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + (i + 2) * sizeof(Number))));
+        }
+
+        uint64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), _mm_add_epi64(first, second));
+        sum = lanes[0] + lanes[1];
+    }
+#endif
+
+    for (; i < count; ++i) {
+        Number number;
+        loadNumbers(data + i * sizeof(Number), 1, &number);
+        sum += static_cast<uint64_t>(number);
+    }
+
+    return static_cast<Number>(sum);
+}
+
+bool encodeBinaryRequest(const std::vector<Number>& numbers, std::string& message) {
+    if (numbers.size() > BINARY_MAX_NUMBERS) {
+        return false;
+    }
+
+    message.assign(BINARY_MAGIC, BINARY_MAGIC_SIZE);
+    storeNumbers(numbers.data(), numbers.size(), message);
+
+    return true;
+}
+
+bool decodeBinaryResponse(const std::string& request, const std::string& message, std::vector<Number>& sortedNumbers,
+                          Number& sum) {
+    if (!isBinaryMessage(request) || !isBinaryMessage(message)) {
+        return false;
+    }
+
+    // Response holds every number of the request and the sum
+
+    const size_t numNumbers = (request.size() - BINARY_MAGIC_SIZE) / sizeof(Number);
+
+    if (message.size() != BINARY_MAGIC_SIZE + (numNumbers + 1) * sizeof(Number)) {
+        return false;
+    }
+
+    const char *payload = message.data() + BINARY_MAGIC_SIZE;
+
+    sortedNumbers.resize(numNumbers);
+    loadNumbers(payload, numNumbers, sortedNumbers.data());
+    loadNumbers(payload + numNumbers * sizeof(Number), 1, &sum);
+
+    return true;
+}
+
+std::string formatBinaryResponse(const std::vector<Number>& sortedNumbers, Number sum) {
+    std::stringstream ss;
+
+    for (size_t i = 0; i < sortedNumbers.size(); ++i) {
+        ss << (i ? " " : "") << sortedNumbers[i];
+    }
+
+    ss << '\n' << sum;
+
+    return ss.str();
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <socket_demo/defines.h>
+
+using Number = int64_t;
+
+// Binary alternative to the text protocol for clients which already hold integers.
+// Every binary message starts with `BINARY_MAGIC`, so the server tells protocols apart per message
+// and no connection state is needed (which is what UDP requires anyway). Text stays the default:
+// a server without binary support echoes the request back, magic included. Client detects it by the number
+// count, since response holds one number more than the request.
+//
+// Request:  magic, N little-endian int64 numbers
+// Response: magic, N little-endian int64 numbers sorted ascending, little-endian int64 sum.
+// Response consisting of magic only means malformed request
+
+static constexpr char BINARY_MAGIC[] = { '\0', 'S', 'D', 'B' };
+static constexpr size_t BINARY_MAGIC_SIZE = sizeof(BINARY_MAGIC);
+
+// Response carries one extra number (sum), and it still has to fit a single message
+static constexpr size_t BINARY_MAX_NUMBERS = (MAX_MESSAGE_LENGTH_BYTES - BINARY_MAGIC_SIZE) / sizeof(Number) - 1;
+
+bool isBinaryMessage(const std::string& message);
+
+bool isBinaryMessage(const char *data, size_t size);
+
+// Fails if there are more than `BINARY_MAX_NUMBERS` numbers
+bool encodeBinaryRequest(const std::vector<Number>& numbers, std::string& message);
+
+// Returns false for malformed or text responses, and for responses which do not answer binary `request`
+// (e.g. its echo)
+bool decodeBinaryResponse(const std::string& request, const std::string& message, std::vector<Number>& sortedNumbers,
+                          Number& sum);
+
+// Renders decoded response the same way as the text protocol does
+std::string formatBinaryResponse(const std::vector<Number>& sortedNumbers, Number sum);
+
+// Reads `count` little-endian int64 numbers
+void loadNumbers(const char *data, size_t count, Number *numbers);
+
+// Appends numbers in little-endian order
+void storeNumbers(const Number *numbers, size_t count, std::string& message);
+
+// Sums `count` little-endian int64 numbers in place (SIMD where available), wrapping on overflow
+Number sumNumbers(const char *data, size_t count);
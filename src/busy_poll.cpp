@@ -0,0 +1,59 @@
+#include <sched.h>
+#include <sys/socket.h>
+
+#include "busy_poll.h"
+#include "utils.h"
+
+BusyPoller::BusyPoller(const BusyPollOptions& options)
+    : spinBudget(std::chrono::microseconds(options.spinMicroseconds))
+{}
+
+void BusyPoller::fillStats(ServerStats& stats) const {
+    stats.spinWakeups = spinWakeups.load(std::memory_order_relaxed);
+    stats.sleepWakeups = sleepWakeups.load(std::memory_order_relaxed);
+}
+
+std::string setBusyPollSocketOptions(int socketDescriptor, const BusyPollOptions& options) {
+    std::string errors;
+
+    if (options.socketBusyPollMicroseconds > 0) {
+        const int value = options.socketBusyPollMicroseconds;
+
+        if (setsockopt(socketDescriptor, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) < 0) {
+            errors += "cannot set SO_BUSY_POLL: " + getError();
+        }
+    }
+
+    if (!options.cpus.empty()) {
+        const int cpu = options.cpus.front();
+
+        if (setsockopt(socketDescriptor, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0) {
+            errors += (errors.empty() ? "" : ", ") + std::string("cannot set SO_INCOMING_CPU: ") + getError();
+        }
+    }
+
+    return errors;
+}
+
+std::string pinCurrentThread(const BusyPollOptions& options) {
+    if (options.cpus.empty()) {
+        return "";
+    }
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+
+    for (const int cpu: options.cpus) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            return "invalid CPU " + std::to_string(cpu);
+        }
+
+        CPU_SET(cpu, &cpuSet);
+    }
+
+    if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) < 0) {
+        return "cannot set CPU affinity: " + getError();
+    }
+
+    return "";
+}
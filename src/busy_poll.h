@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <socket_demo/server_stats.h>
+
+#include "overload_guard.h"
+
+// Latency mode knobs. Zero values keep the plain blocking behaviour
+struct BusyPollOptions {
+    // Time event loop keeps checking sockets without blocking before it goes to sleep
+    long spinMicroseconds = 0;
+
+    // CPUs event loop thread is pinned to. The first one is also reported to the kernel
+    // with `SO_INCOMING_CPU`, so that packets of the socket are processed on the same core
+    std::vector<int> cpus;
+
+    // `SO_BUSY_POLL` value: time kernel busy polls device queue on blocking reads.
+    // Raising it above `net.core.busy_read` requires `CAP_NET_ADMIN`
+    int socketBusyPollMicroseconds = 0;
+};
+
+// Spins over non-blocking readiness checks for a limited time before event loop blocks,
+// and counts how often it paid off. Not thread safe, except `fillStats`
+class BusyPoller {
+public:
+    explicit BusyPoller(const BusyPollOptions& options);
+
+    bool isEnabled() const { return spinBudget != Clock::duration::zero(); }
+
+    // Calls `tryOnce` until it returns non-zero or spin budget runs out. Returns the last result,
+    // i.e. 0 means that caller has to block
+    template<typename F>
+    int spin(F&& tryOnce);
+
+    void fillStats(ServerStats& stats) const;
+
+private:
+    Clock::duration spinBudget;
+
+    std::atomic<uint64_t> spinWakeups{ 0 };
+    std::atomic<uint64_t> sleepWakeups{ 0 };
+};
+
+template<typename F>
+int BusyPoller::spin(F&& tryOnce) {
+    const Clock::time_point deadline = Clock::now() + spinBudget;
+
+    do {
+        const int result = tryOnce();
+
+        if (result != 0) {
+            spinWakeups.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+    } while (Clock::now() < deadline);
+
+    sleepWakeups.fetch_add(1, std::memory_order_relaxed);
+
+    return 0;
+}
+
+// Sets `SO_BUSY_POLL` and `SO_INCOMING_CPU` if requested. Kernel may refuse them, in which case
+// the socket stays usable and the reason is returned (empty string means success)
+std::string setBusyPollSocketOptions(int socketDescriptor, const BusyPollOptions& options);
+
+// Pins calling thread to `options.cpus` if there are any. Returns the reason of failure or empty string
+std::string pinCurrentThread(const BusyPollOptions& options);
+
+// Applies both of the above to event loop socket and thread, problems are only logged.
+// Connections accepted later inherit socket options of the listening socket
+template<typename Logger>
+void enterLatencyMode(int socketDescriptor, const BusyPollOptions& options, Logger& logger) {
+    const std::string socketError = setBusyPollSocketOptions(socketDescriptor, options);
+
+    if (!socketError.empty()) {
+        logger.log("Busy polling socket options are not applied: ", socketError);
+    }
+
+    const std::string pinError = pinCurrentThread(options);
+
+    if (!pinError.empty()) {
+        logger.log("Event loop thread is not pinned: ", pinError);
+    }
+}
@@ -0,0 +1,227 @@
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "utils.h"
+
+namespace {
+
+void putUint(std::vector<char>& buffer, uint64_t value, size_t numBytes) {
+    for (size_t i = 0; i < numBytes; ++i) {
+        buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+uint64_t getUint(const char *data, size_t numBytes) {
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < numBytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+
+    return value;
+}
+
+} // namespace
+
+constexpr std::chrono::seconds CaptureWriter::FLUSH_PERIOD;
+
+CaptureWriter::CaptureWriter(const std::string& path)
+    : startTime(std::chrono::steady_clock::now())
+{
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open capture file " + path + ": " + getError());
+    }
+
+    buffer.reserve(BUFFER_SIZE);
+    buffer.insert(buffer.end(), CAPTURE_MAGIC, CAPTURE_MAGIC + CAPTURE_MAGIC_SIZE);
+
+    thread = std::thread(&CaptureWriter::run, this);
+}
+
+CaptureWriter::~CaptureWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        handOverBuffer();
+        isStopped = true;
+    }
+
+    condition.notify_all();
+    thread.join();
+
+    close(fd);
+}
+
+void CaptureWriter::appendRequest(CaptureProtocol protocol, uint64_t peer, const char *data, size_t size) {
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - startTime).count();
+
+    append(timestampNs, peer, CaptureRecordType::Request, protocol, data, size);
+}
+
+void CaptureWriter::append(const CaptureRecord& record) {
+    append(record.timestampNs, record.peer, record.type, record.protocol, record.payload.data(),
+           record.payload.size());
+}
+
+void CaptureWriter::append(uint64_t timestampNs, uint64_t peer, CaptureRecordType type, CaptureProtocol protocol,
+                           const char *data, size_t size) {
+    bool isFull;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        putUint(buffer, timestampNs, 8);
+        putUint(buffer, peer, 8);
+        putUint(buffer, size, 4);
+        putUint(buffer, static_cast<uint8_t>(type), 1);
+        putUint(buffer, static_cast<uint8_t>(protocol), 1);
+        putUint(buffer, 0, 2);
+        buffer.insert(buffer.end(), data, data + size);
+
+        isFull = buffer.size() >= BUFFER_SIZE;
+
+        if (isFull) {
+            handOverBuffer();
+        }
+    }
+
+    if (isFull) {
+        condition.notify_all();
+    }
+}
+
+void CaptureWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    handOverBuffer();
+    const uint64_t numToWrite = numHandedOver;
+
+    condition.notify_all();
+    condition.wait(lock, [&] { return numWritten >= numToWrite; });
+}
+
+void CaptureWriter::handOverBuffer() {
+    if (buffer.empty()) {
+        return;
+    }
+
+    fullBuffers.push_back(std::move(buffer));
+    ++numHandedOver;
+
+    // Emptied buffers keep their capacity, so steady state does not allocate
+
+    if (freeBuffers.empty()) {
+        buffer = std::vector<char>();
+        buffer.reserve(BUFFER_SIZE);
+    } else {
+        buffer = std::move(freeBuffers.back());
+        freeBuffers.pop_back();
+    }
+}
+
+void CaptureWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+        // 1. Wait for a full buffer. Quiet periods should not keep records in memory for long,
+        // so the current buffer is taken once the period passes without one
+
+        if (fullBuffers.empty() && !isStopped &&
+            !condition.wait_for(lock, FLUSH_PERIOD, [this] { return isStopped || !fullBuffers.empty(); })) {
+            handOverBuffer();
+        }
+
+        if (fullBuffers.empty()) {
+            if (isStopped) {
+                return;
+            }
+
+            continue;
+        }
+
+        // 2. Write it without holding the lock, buffers go out in order they were handed over
+
+        std::vector<char> data = std::move(fullBuffers.front());
+        fullBuffers.pop_front();
+
+        lock.unlock();
+        writeBuffer(data);
+        data.clear();
+        lock.lock();
+
+        freeBuffers.push_back(std::move(data));
+        ++numWritten;
+
+        condition.notify_all();
+    }
+}
+
+void CaptureWriter::writeBuffer(const std::vector<char>& data) {
+    size_t numBytesWritten = 0;
+
+    while (numBytesWritten < data.size()) {
+        const ssize_t result = write(fd, data.data() + numBytesWritten, data.size() - numBytesWritten);
+
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // Capture must not break serving, the rest of the buffer is lost
+            break;
+        }
+
+        numBytesWritten += result;
+    }
+}
+
+std::vector<CaptureRecord> readCaptureFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file) {
+        throw std::runtime_error("Cannot open capture file " + path);
+    }
+
+    const std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (content.compare(0, CAPTURE_MAGIC_SIZE, std::string(CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE)) != 0) {
+        throw std::runtime_error("Not a capture file: " + path);
+    }
+
+    std::vector<CaptureRecord> records;
+
+    for (size_t offset = CAPTURE_MAGIC_SIZE; offset < content.size();) {
+        if (content.size() - offset < CAPTURE_RECORD_HEADER_SIZE) {
+            throw std::runtime_error("Truncated capture record header in " + path);
+        }
+
+        const char *header = content.data() + offset;
+        const size_t size = getUint(header + 16, 4);
+
+        if (content.size() - offset - CAPTURE_RECORD_HEADER_SIZE < size) {
+            throw std::runtime_error("Truncated capture record payload in " + path);
+        }
+
+        CaptureRecord record;
+        record.timestampNs = getUint(header, 8);
+        record.peer = getUint(header + 8, 8);
+        record.type = static_cast<CaptureRecordType>(getUint(header + 20, 1));
+        record.protocol = static_cast<CaptureProtocol>(getUint(header + 21, 1));
+        record.payload.assign(header + CAPTURE_RECORD_HEADER_SIZE, size);
+
+        records.push_back(std::move(record));
+
+        offset += CAPTURE_RECORD_HEADER_SIZE + size;
+    }
+
+    return records;
+}
+
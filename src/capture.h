@@ -0,0 +1,112 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <condition_variable>
+
+// Capture file keeps traffic for later replay (see `replay`). It starts with `CAPTURE_MAGIC`,
+// then records follow, each being a little-endian header and payload:
+//   uint64 timestamp - nanoseconds since capture start (latency for `Response` records)
+//   uint64 peer      - connection number for stream transports, IPv4 address << 16 | port for UDP
+//   uint32 size      - payload size
+//   uint8 type, uint8 protocol, uint16 reserved
+
+static constexpr char CAPTURE_MAGIC[] = { 'S', 'D', 'C', '1' };
+static constexpr size_t CAPTURE_MAGIC_SIZE = sizeof(CAPTURE_MAGIC);
+static constexpr size_t CAPTURE_RECORD_HEADER_SIZE = 24;
+
+enum class CaptureRecordType : uint8_t {
+    // Request received by server
+    Request = 0,
+
+    // Response received by `replay` for request with the same index, timestamp is its latency
+    Response = 1,
+
+    // Request with the same index got no response during replay
+    Failure = 2,
+
+    // Last record of `replay` results, timestamp is the duration of the whole replay
+    Summary = 3
+};
+
+enum class CaptureProtocol : uint8_t {
+    TCP = 0,
+    UDP = 1,
+    UNIX = 2,
+    SEQPACKET = 3,
+    SHM = 4
+};
+
+struct CaptureRecord {
+    uint64_t timestampNs;
+    uint64_t peer;
+    CaptureRecordType type;
+    CaptureProtocol protocol;
+    std::string payload;
+};
+
+// Appends records to capture file through a large buffer. Full buffers are handed over to a writer thread,
+// which also writes out the current one every `FLUSH_PERIOD`, so event loops never wait for the disk.
+// Thread safe, so sharded servers share one writer
+class CaptureWriter {
+public:
+    // Truncates existing file
+    explicit CaptureWriter(const std::string& path);
+
+    ~CaptureWriter();
+
+    // Forbid copying
+
+    CaptureWriter(CaptureWriter&) = delete;
+    CaptureWriter operator=(CaptureWriter&) = delete;
+
+    // Records request with the current timestamp
+    void appendRequest(CaptureProtocol protocol, uint64_t peer, const char *data, size_t size);
+
+    void append(const CaptureRecord& record);
+
+    // Waits until everything appended so far is written
+    void flush();
+
+private:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+    static constexpr std::chrono::seconds FLUSH_PERIOD{ 1 };
+
+    void append(uint64_t timestampNs, uint64_t peer, CaptureRecordType type, CaptureProtocol protocol,
+                const char *data, size_t size);
+
+    // Requires `mutex` to be held
+    void handOverBuffer();
+
+    void run();
+
+    void writeBuffer(const std::vector<char>& data);
+
+    int fd;
+    std::chrono::steady_clock::time_point startTime;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<char> buffer;
+
+    // Buffers waiting for the writer thread in order, and emptied ones kept for reuse
+    std::deque<std::vector<char>> fullBuffers;
+    std::vector<std::vector<char>> freeBuffers;
+
+    // Number of buffers handed over and written so far, `flush` waits for them to match
+    uint64_t numHandedOver = 0;
+    uint64_t numWritten = 0;
+
+    bool isStopped = false;
+    std::thread thread;
+};
+
+// Reads the whole capture file. Throws on I/O errors and malformed files
+std::vector<CaptureRecord> readCaptureFile(const std::string& path);
+
@@ -0,0 +1,47 @@
+#include <stdexcept>
+
+#include <sys/socket.h>
+
+#include "client_factory.h"
+#include "client_tcp.h"
+#include "client_udp.h"
+#include "client_udp_coalescing.h"
+#include "client_unix.h"
+#include "client_shm.h"
+#include "client_loopback.h"
+
+bool isValidProtocol(const std::string& protocol) {
+    return protocol == "TCP" || protocol == "UDP" || isUnixProtocol(protocol);
+}
+
+bool isUnixProtocol(const std::string& protocol) {
+    return protocol == "UNIX" || protocol == "SEQPACKET" || protocol == "SHM";
+}
+
+bool isLossyProtocol(const std::string& protocol) {
+    return protocol == "UDP";
+}
+
+Client *createClient(const std::string& protocol, const std::string& address, uint16_t port,
+                     std::ostream& logStream, long timeoutSeconds, const ClientOptions& options)
+{
+    if (protocol == "TCP") {
+        return new ClientTcp(address, port, logStream, timeoutSeconds, options.tcpFastOpen);
+    } else if (protocol == "UDP" && options.udpCoalescing.enabled) {
+        return new ClientUdpCoalescing(address, port, logStream, timeoutSeconds, options.udpRetry,
+                                       options.udpCoalescing);
+    } else if (protocol == "UDP") {
+        return new ClientUdp(address, port, logStream, timeoutSeconds, options.udpRetry,
+                             options.udpSegmentation, options.udpReceiveOffload);
+    } else if (protocol == "UNIX") {
+        return new ClientUnix(address, SOCK_STREAM, logStream, timeoutSeconds);
+    } else if (protocol == "SEQPACKET") {
+        return new ClientUnix(address, SOCK_SEQPACKET, logStream, timeoutSeconds);
+    } else if (protocol == "SHM") {
+        return new ClientShm(address, logStream, timeoutSeconds);
+    } else if (protocol == "LOOPBACK") {
+        return new ClientLoopback(address, logStream, timeoutSeconds);
+    }
+
+    throw std::invalid_argument("Invalid protocol: " + protocol);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <cstdint>
+
+#include <socket_demo/client.h>
+
+#include "client_options.h"
+
+// Protocol names accepted by binaries: TCP, UDP, UNIX (unix stream socket),
+// SEQPACKET (unix sequenced-packet socket) and SHM (shared memory rings)
+bool isValidProtocol(const std::string& protocol);
+
+// Unix protocols (including SHM, which uses unix socket for handshake) address the server by socket path instead of address and port
+bool isUnixProtocol(const std::string& protocol);
+
+// Only datagram protocols may silently lose messages, `Client::request` retransmits them
+bool isLossyProtocol(const std::string& protocol);
+
+// Creates client for the protocol. `address` is socket path for unix protocols, `port` is ignored then.
+// LOOPBACK (see `ServerLoopback`) is accepted too: `address` is the name of a server in the same process
+Client *createClient(const std::string& protocol, const std::string& address, uint16_t port,
+                     std::ostream& logStream, long timeoutSeconds, const ClientOptions& options = ClientOptions());
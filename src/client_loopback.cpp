@@ -0,0 +1,134 @@
+#include <ostream>
+#include <chrono>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <socket_demo/defines.h>
+
+#include "utils.h"
+#include "client_loopback.h"
+
+using Clock = std::chrono::steady_clock;
+
+ClientLoopback::ClientLoopback(const std::string& name, std::ostream& logStream, long timeoutSeconds,
+                               long spinMicroseconds)
+    : timeoutSeconds(timeoutSeconds), spinMicroseconds(spinMicroseconds), logStream(logStream)
+{
+    if (timeoutSeconds <= 0) {
+        throw std::runtime_error("Timeout should be a positive value!");
+    }
+
+    connection = LoopbackListener::connect(name);
+}
+
+bool ClientLoopback::send(const std::string& data) {
+    if (data.empty()) {
+        return false;
+    }
+
+    if (data.size() >= MAX_MESSAGE_LENGTH_BYTES) {
+        logStream << "Data is too long, it will be truncated to "
+                  << MAX_MESSAGE_LENGTH_BYTES << " bytes" << std::endl;
+    }
+
+    // Ring fills up when requests are pipelined: server takes no more of them than there are free response slots.
+    // Responses are moved aside meanwhile, so that server can go on, and `receive` returns them later
+
+    const Clock::time_point deadline = Clock::now() + std::chrono::seconds(timeoutSeconds);
+    ShmSlot *slot;
+
+    while (!(slot = connection->requests.reserve())) {
+        while (const ShmSlot *response = connection->responses.peek()) {
+            receivedResponses.emplace_back(response->data,
+                                           std::min<size_t>(response->length, MAX_MESSAGE_LENGTH_BYTES));
+            connection->responses.release();
+        }
+
+        if (connection->isServerClosed.load(std::memory_order_acquire) || Clock::now() >= deadline) {
+            return false;
+        }
+
+        usleep(100);
+    }
+
+    slot->length = std::min(data.size(), static_cast<size_t>(MAX_MESSAGE_LENGTH_BYTES));
+    std::memcpy(slot->data, data.data(), slot->length);
+
+    if (connection->requests.publish()) {
+        notifyEventFd(connection->requestEventFd);
+    }
+
+    return true;
+}
+
+bool ClientLoopback::receive(std::string& message) {
+    ShmRing& responses = connection->responses;
+
+    const Clock::time_point spinDeadline = Clock::now() + std::chrono::microseconds(spinMicroseconds);
+    const Clock::time_point deadline = Clock::now() + std::chrono::seconds(timeoutSeconds);
+
+    if (!receivedResponses.empty()) {
+        message.swap(receivedResponses.front());
+        receivedResponses.pop_front();
+        return true;
+    }
+
+    for (;;) {
+        // 1. Take response in place if it is ready
+
+        if (const ShmSlot *response = responses.peek()) {
+            message.assign(response->data, std::min<size_t>(response->length, MAX_MESSAGE_LENGTH_BYTES));
+            responses.release();
+            return true;
+        }
+
+        // Server publishes responses before it closes connection, so the ring is checked once more after the flag
+        // is seen: response could have been published after the peek above
+
+        if (connection->isServerClosed.load(std::memory_order_acquire) && !responses.peek()) {
+            logStream << "Cannot receive message: server disconnected" << std::endl;
+            return false;
+        }
+
+        const Clock::time_point now = Clock::now();
+
+        if (now < spinDeadline) {
+            continue;
+        }
+
+        if (now >= deadline) {
+            logStream << "Cannot receive message: timeout" << std::endl;
+            return false;
+        }
+
+        // 2. Spinning is over, sleep until server kicks eventfd (it does so when it closes connection too)
+
+        if (!responses.prepareToSleep()) {
+            responses.wakeUp();
+            continue;
+        }
+
+        pollfd fd{ .fd = connection->responseEventFd, .events = POLLIN, .revents = 0 };
+
+        const int timeoutMs = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+        const int numReady = poll(&fd, 1, timeoutMs);
+
+        responses.wakeUp();
+
+        if (numReady < 0 && errno != EINTR) {
+            logStream << "Cannot receive message: " << getError() << std::endl;
+            return false;
+        }
+
+        if (fd.revents & POLLIN) {
+            drainEventFd(connection->responseEventFd);
+        }
+    }
+}
+
+ClientLoopback::~ClientLoopback() {
+    connection->isClientClosed.store(true, std::memory_order_release);
+    notifyEventFd(connection->requestEventFd);
+}
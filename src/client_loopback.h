@@ -0,0 +1,39 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include <socket_demo/client.h>
+
+#include "loopback_backend.h"
+
+// In-process client, counterpart of `ServerLoopback` living in the same process. Waits for responses
+// spinning for `spinMicroseconds` first and sleeping on eventfd afterwards, just like `ClientShm`
+class ClientLoopback : public Client {
+public:
+    ClientLoopback(const std::string& name, std::ostream& logStream, long timeoutSeconds = 5,
+                   long spinMicroseconds = 50);
+
+    bool send(const std::string& data) override;
+
+    bool receive(std::string& data) override;
+
+    ~ClientLoopback() override;
+
+    // Forbid copying
+
+    ClientLoopback(ClientLoopback&) = delete;
+    ClientLoopback operator=(ClientLoopback&) = delete;
+
+private:
+    std::shared_ptr<LoopbackConnection> connection;
+
+    // Responses moved out of the ring by `send` waiting for a free request slot
+    std::deque<std::string> receivedResponses;
+
+    long timeoutSeconds;
+    long spinMicroseconds;
+    std::ostream& logStream;
+};
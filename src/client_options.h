@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+
+// Retransmission policy of UDP requests (see `Client::request`). Timeout of each attempt follows round trip
+// time estimated like TCP does (RFC 6298), doubles after every timeout and gets random jitter,
+// so that clients losing datagrams at the same moment do not retry in lockstep
+struct UdpRetryOptions {
+    // Number of times a request is sent before giving up
+    size_t maxTries = 10;
+
+    // Timeout of the first attempt until there is a round trip time sample
+    long initialTimeoutMs = 200;
+
+    // Bounds of the estimated timeout, backoff does not grow it above `maxTimeoutMs` either
+    long minTimeoutMs = 10;
+    long maxTimeoutMs = 2000;
+};
+
+// Coalescing UDP client (see `ClientUdpCoalescing`): requests of concurrent callers are packed into shared
+// datagrams (see `packed_protocol.h`), so that a high rate of small requests costs fewer datagrams and syscalls
+struct UdpCoalescingOptions {
+    bool enabled = false;
+
+    // How long the oldest queued request waits for others before a datagram which is not full goes out
+    long lingerMicroseconds = 100;
+
+    // Size limit of a packed datagram. Default keeps it within Ethernet MTU, so that it is not fragmented.
+    // Larger requests go alone
+    size_t maxDatagramBytes = 1472;
+};
+
+// Optional client tuning knobs. Defaults reproduce plain behaviour without any extras
+struct ClientOptions {
+    // TCP only: carry the first request in SYN with TCP Fast Open once server has issued a cookie.
+    // Kernel has to allow it for clients in `net.ipv4.tcp_fastopen`
+    bool tcpFastOpen = false;
+
+    UdpRetryOptions udpRetry;
+
+    // UDP only: send runs of same-size requests of a batch as one `UDP_SEGMENT` datagram (GSO) and accept
+    // coalesced responses (`UDP_GRO`). Both fall back silently if the kernel does not support them
+    bool udpSegmentation = false;
+    bool udpReceiveOffload = false;
+
+    UdpCoalescingOptions udpCoalescing;
+};
@@ -0,0 +1,230 @@
+#include <ostream>
+#include <chrono>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <socket_demo/defines.h>
+
+#include "utils.h"
+#include "client_shm.h"
+
+using Clock = std::chrono::steady_clock;
+
+ClientShm::ClientShm(const std::string& socketPath, std::ostream& logStream, long timeoutSeconds,
+                     long spinMicroseconds)
+    : timeoutSeconds(timeoutSeconds), spinMicroseconds(spinMicroseconds), logStream(logStream)
+{
+    sockaddr_un socketAddress{};
+    std::memset(&socketAddress, 0, sizeof(socketAddress));
+
+    if (socketPath.empty() || socketPath.size() >= sizeof(socketAddress.sun_path)) {
+        throw std::invalid_argument("Invalid unix socket path: " + socketPath);
+    }
+
+    if (timeoutSeconds <= 0) {
+        throw std::runtime_error("Timeout should be a positive value!");
+    }
+
+    // 1. Connect to control socket
+
+    controlFd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (controlFd < 0) {
+        throw std::runtime_error("Cannot create unix socket: " + getError());
+    }
+
+    timeval timeout{ timeoutSeconds, 0 };
+
+    if (setsockopt(controlFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        release();
+        throw std::runtime_error("Cannot set READ timeout: " + getError());
+    }
+
+    socketAddress.sun_family = AF_UNIX;
+    std::strncpy(socketAddress.sun_path, socketPath.c_str(), sizeof(socketAddress.sun_path) - 1);
+
+    if (connect(controlFd, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) < 0) {
+        release();
+        throw std::invalid_argument("Connection failed: " + getError());
+    }
+
+    // 2. Receive segment and eventfds
+
+    ShmHandshake handshake{};
+    int fds[SHM_HANDSHAKE_NUM_FDS];
+
+    iovec iov{ &handshake, sizeof(handshake) };
+    char control[CMSG_SPACE(sizeof(fds))];
+
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    if (recvmsg(controlFd, &message, MSG_CMSG_CLOEXEC) != sizeof(handshake)) {
+        release();
+        throw std::runtime_error("Shared memory handshake failed: " + getError());
+    }
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || handshake.numSlots == 0) {
+        release();
+        throw std::runtime_error("Invalid shared memory handshake");
+    }
+
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    requestEventFd = fds[1];
+    responseEventFd = fds[2];
+
+    // 3. Map segment. Descriptor is not needed after that
+
+    segmentSize = shmSegmentSize(handshake.numSlots);
+    segment = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+
+    if (segment == MAP_FAILED) {
+        segment = nullptr;
+        release();
+        throw std::runtime_error("Cannot map shared memory: " + getError());
+    }
+
+    requests = shmRequestRing(segment, handshake.numSlots);
+    responses = shmResponseRing(segment, handshake.numSlots);
+}
+
+bool ClientShm::send(const std::string& data) {
+    if (data.empty()) {
+        return false;
+    }
+
+    if (data.size() >= MAX_MESSAGE_LENGTH_BYTES) {
+        logStream << "Data is too long, it will be truncated to "
+                  << MAX_MESSAGE_LENGTH_BYTES << " bytes" << std::endl;
+    }
+
+    // Ring fills up when requests are pipelined: server takes no more of them than there are free response slots.
+    // Responses are moved aside meanwhile, so that server can go on, and `receive` returns them later
+
+    const Clock::time_point deadline = Clock::now() + std::chrono::seconds(timeoutSeconds);
+    ShmSlot *slot;
+
+    while (!(slot = requests.reserve())) {
+        while (const ShmSlot *response = responses.peek()) {
+            receivedResponses.emplace_back(response->data,
+                                           std::min<size_t>(response->length, MAX_MESSAGE_LENGTH_BYTES));
+            responses.release();
+        }
+
+        if (Clock::now() >= deadline) {
+            return false;
+        }
+
+        usleep(100);
+    }
+
+    slot->length = std::min(data.size(), static_cast<size_t>(MAX_MESSAGE_LENGTH_BYTES));
+    std::memcpy(slot->data, data.data(), slot->length);
+
+    if (requests.publish()) {
+        notifyEventFd(requestEventFd);
+    }
+
+    return true;
+}
+
+bool ClientShm::receive(std::string& message) {
+    const Clock::time_point spinDeadline = Clock::now() + std::chrono::microseconds(spinMicroseconds);
+    const Clock::time_point deadline = Clock::now() + std::chrono::seconds(timeoutSeconds);
+
+    if (!receivedResponses.empty()) {
+        message.swap(receivedResponses.front());
+        receivedResponses.pop_front();
+        return true;
+    }
+
+    for (;;) {
+        // 1. Take response in place if it is ready
+
+        if (const ShmSlot *response = responses.peek()) {
+            message.assign(response->data, std::min<size_t>(response->length, MAX_MESSAGE_LENGTH_BYTES));
+            responses.release();
+            return true;
+        }
+
+        const Clock::time_point now = Clock::now();
+
+        if (now < spinDeadline) {
+            continue;
+        }
+
+        if (now >= deadline) {
+            logStream << "Cannot receive message: timeout" << std::endl;
+            return false;
+        }
+
+        // 2. Spinning is over, sleep until server kicks eventfd or closes control socket
+
+        if (!responses.prepareToSleep()) {
+            responses.wakeUp();
+            continue;
+        }
+
+        pollfd fds[2] = {
+            { .fd = responseEventFd, .events = POLLIN, .revents = 0 },
+            { .fd = controlFd, .events = POLLIN, .revents = 0 }
+        };
+
+        const int timeoutMs = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+        const int numReady = poll(fds, 2, timeoutMs);
+
+        responses.wakeUp();
+
+        if (numReady < 0 && errno != EINTR) {
+            logStream << "Cannot receive message: " << getError() << std::endl;
+            return false;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            drainEventFd(responseEventFd);
+        }
+
+        if ((fds[1].revents & (POLLIN | POLLHUP | POLLERR)) && !responses.peek()) {
+            logStream << "Cannot receive message: server disconnected" << std::endl;
+            return false;
+        }
+    }
+}
+
+void ClientShm::release() {
+    if (segment) {
+        munmap(segment, segmentSize);
+        segment = nullptr;
+    }
+
+    if (requestEventFd >= 0) {
+        close(requestEventFd);
+    }
+
+    if (responseEventFd >= 0) {
+        close(responseEventFd);
+    }
+
+    if (controlFd >= 0) {
+        shutdown(controlFd, SHUT_RDWR);
+        close(controlFd);
+    }
+
+    controlFd = requestEventFd = responseEventFd = -1;
+}
+
+ClientShm::~ClientShm() {
+    release();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <deque>
+#include <string>
+
+#include <socket_demo/client.h>
+
+#include "shm_ring.h"
+
+// Shared memory client implementation, counterpart of `ServerShm`. Waits for responses
+// spinning for `spinMicroseconds` first and sleeping on eventfd afterwards
+class ClientShm : public Client {
+public:
+    ClientShm(const std::string& socketPath, std::ostream& logStream, long timeoutSeconds = 5,
+              long spinMicroseconds = 50);
+
+    bool send(const std::string& data) override;
+
+    bool receive(std::string& data) override;
+
+    ~ClientShm() override;
+
+    // Forbid copying
+
+    ClientShm(ClientShm&) = delete;
+    ClientShm operator=(ClientShm&) = delete;
+
+private:
+    // Releases everything acquired so far, used by constructor and destructor
+    void release();
+
+    int controlFd = -1;
+    int requestEventFd = -1;
+    int responseEventFd = -1;
+    void *segment = nullptr;
+    size_t segmentSize = 0;
+    ShmRing requests;
+    ShmRing responses;
+
+    // Responses moved out of the ring by `send` waiting for a free request slot
+    std::deque<std::string> receivedResponses;
+
+    long timeoutSeconds;
+    long spinMicroseconds;
+    std::ostream& logStream;
+};
@@ -2,6 +2,7 @@
 #include <cstring>
 
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <poll.h>
@@ -11,7 +12,8 @@
 #include "utils.h"
 #include "client_tcp.h"
 
-ClientTcp::ClientTcp(const std::string& address, uint16_t port, std::ostream& logStream, long timeoutSeconds)
+ClientTcp::ClientTcp(const std::string& address, uint16_t port, std::ostream& logStream, long timeoutSeconds,
+                     bool fastOpen)
     : socketAddress(new sockaddr_in), logStream(logStream)
 {
     std::memset(socketAddress, 0, sizeof(sockaddr_in));
@@ -40,7 +42,17 @@ ClientTcp::ClientTcp(const std::string& address, uint16_t port, std::ostream& lo
         throw std::runtime_error("Cannot set SEND timeout: " + getError());
     }
 
-    // 3. Establish connection
+    // 3. With Fast Open connect returns immediately, and handshake is made by the first send
+
+    if (fastOpen) {
+        int enable = 1;
+
+        if (setsockopt(socketDescriptor, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &enable, sizeof(enable)) < 0) {
+            throw std::runtime_error("Cannot set TCP_FASTOPEN_CONNECT: " + getError());
+        }
+    }
+
+    // 4. Establish connection
 
     socketAddress->sin_family = AF_INET;
     socketAddress->sin_port = htons(port);
@@ -7,7 +7,9 @@ struct sockaddr_in;
 // TCP client implementation
 class ClientTcp : public Client {
 public:
-    ClientTcp(const std::string& address, uint16_t port, std::ostream& logStream, long timeoutSeconds = 5);
+    // `fastOpen` - send the first message in SYN (TCP Fast Open), see `ClientOptions`
+    ClientTcp(const std::string& address, uint16_t port, std::ostream& logStream, long timeoutSeconds = 5,
+              bool fastOpen = false);
 
     bool send(const std::string& data) override;
 
@@ -1,7 +1,10 @@
 #include <ostream>
 #include <cstring>
 
+#include <poll.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 
@@ -10,8 +13,14 @@
 #include "utils.h"
 #include "client_udp.h"
 
-ClientUdp::ClientUdp(const std::string& address, uint16_t port, std::ostream& logStream, long timeoutSeconds)
-    : serverAddress(new sockaddr_in), logStream(logStream)
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t ClientUdp::MAX_GSO_SEGMENTS;
+
+ClientUdp::ClientUdp(const std::string& address, uint16_t port, std::ostream& logStream, long timeoutSeconds,
+                     const UdpRetryOptions& retryOptions, bool useSegmentation, bool useReceiveOffload)
+    : serverAddress(new sockaddr_in), timeout(timeoutSeconds), retryOptions(retryOptions),
+      rttEstimator(retryOptions), buffer(MAX_MESSAGE_LENGTH_BYTES), logStream(logStream)
 {
     std::memset(serverAddress, 0, sizeof(sockaddr_in));
 
@@ -19,27 +28,42 @@ ClientUdp::ClientUdp(const std::string& address, uint16_t port, std::ostream& lo
     serverAddress->sin_port = htons(port);
 
     if (!inet_pton(AF_INET, address.c_str(), &serverAddress->sin_addr)) {
+        delete serverAddress;
         throw std::invalid_argument("Invalid socket address: " + address);
     }
 
-    // 1. Create UDP socket
+    // 1. Check timeouts. They are enforced with poll, so that retransmission timeouts are not limited to seconds
+
+    if (timeoutSeconds <= 0) {
+        delete serverAddress;
+        throw std::runtime_error("Timeout should be a positive value!");
+    }
+
+    if (retryOptions.maxTries == 0 || retryOptions.minTimeoutMs <= 0) {
+        delete serverAddress;
+        throw std::invalid_argument("Number of tries and minimal retransmission timeout should be positive values");
+    }
+
+    // 2. Create UDP socket
 
     socketDescriptor = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
 
     if (socketDescriptor < 0) {
-        throw std::runtime_error("Cannot create TCP socket: " + getError());
+        delete serverAddress;
+        throw std::runtime_error("Cannot create UDP socket: " + getError());
     }
 
-    // 2. Set timeout on reading (writing is async))
+    // 3. Negotiate offloads, the plain path is used without them
 
-    if (timeoutSeconds <= 0) {
-        throw std::runtime_error("Timeout should be a positive value!");
+    if (useReceiveOffload) {
+        int enable = 1;
+        isGroEnabled = setsockopt(socketDescriptor, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) == 0;
     }
 
-    timeval timeout{ timeoutSeconds, 0 };
-
-    if (setsockopt(socketDescriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
-        throw std::runtime_error("Cannot set READ timeout: " + getError());
+    if (useSegmentation) {
+        int segmentSize = 0;
+        socklen_t optionLength = sizeof(segmentSize);
+        isGsoEnabled = getsockopt(socketDescriptor, SOL_UDP, UDP_SEGMENT, &segmentSize, &optionLength) == 0;
     }
 }
 
@@ -59,26 +83,256 @@ bool ClientUdp::send(const std::string& data) {
                   reinterpret_cast<sockaddr*>(serverAddress), sizeof(*serverAddress)) == actualDataSize;
 }
 
+bool ClientUdp::sendBatch(const std::vector<std::string>& requests) {
+    bool isSent = true;
+
+    for (size_t i = 0; i < requests.size();) {
+        // 1. Find a run the kernel can split: every request but the last has the same size
+
+        size_t count = 1;
+
+        if (isGsoEnabled) {
+            const size_t segmentSize = requests[i].size();
+            size_t numBytes = segmentSize;
+
+            while (i + count < requests.size() && count < MAX_GSO_SEGMENTS &&
+                   requests[i + count - 1].size() == segmentSize && requests[i + count].size() <= segmentSize &&
+                   !requests[i + count].empty() && numBytes + requests[i + count].size() <= MAX_MESSAGE_LENGTH_BYTES)
+            {
+                numBytes += requests[i + count].size();
+                ++count;
+            }
+        }
+
+        // 2. Send it at once. Refused segmentation is not retried, requests go out as separate datagrams instead
+
+        if (count > 1 && sendSegmented(requests, i, count)) {
+            i += count;
+            continue;
+        }
+
+        if (count > 1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            isGsoEnabled = false;
+        }
+
+        // Without segmentation the rest goes out as separate datagrams of a single syscall
+
+        if (!isGsoEnabled) {
+            count = requests.size() - i;
+        }
+
+        isSent = sendMultiple(requests, i, count) && isSent;
+        i += count;
+    }
+
+    return isSent;
+}
+
+bool ClientUdp::sendMultiple(const std::vector<std::string>& requests, size_t first, size_t count) {
+    std::vector<iovec> chunks;
+    std::vector<mmsghdr> headers;
+    bool isSent = true;
+
+    chunks.reserve(count);
+
+    for (size_t i = first; i < first + count; ++i) {
+        if (requests[i].empty()) {
+            isSent = false;
+            continue;
+        }
+
+        if (requests[i].size() >= MAX_MESSAGE_LENGTH_BYTES) {
+            logStream << "Data is too long, it will be truncated to "
+                      << MAX_MESSAGE_LENGTH_BYTES << " bytes" << std::endl;
+        }
+
+        chunks.push_back(iovec{ const_cast<char*>(requests[i].data()),
+                                std::min(requests[i].size(), static_cast<size_t>(MAX_MESSAGE_LENGTH_BYTES)) });
+    }
+
+    headers.resize(chunks.size());
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        headers[i].msg_hdr.msg_name = serverAddress;
+        headers[i].msg_hdr.msg_namelen = sizeof(*serverAddress);
+        headers[i].msg_hdr.msg_iov = &chunks[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    for (size_t numSent = 0; numSent < headers.size();) {
+        const int result = sendmmsg(socketDescriptor, headers.data() + numSent,
+                                    static_cast<unsigned int>(headers.size() - numSent), MSG_DONTWAIT);
+
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (result <= 0) {
+            return false;
+        }
+
+        numSent += static_cast<size_t>(result);
+    }
+
+    return isSent;
+}
+
+bool ClientUdp::sendSegmented(const std::vector<std::string>& requests, size_t first, size_t count) {
+    std::vector<iovec> chunks(count);
+    size_t numBytes = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        chunks[i].iov_base = const_cast<char*>(requests[first + i].data());
+        chunks[i].iov_len = requests[first + i].size();
+        numBytes += chunks[i].iov_len;
+    }
+
+    union {
+        char data[CMSG_SPACE(sizeof(uint16_t))];
+        cmsghdr alignment;
+    } control;
+
+    msghdr message{};
+    message.msg_name = serverAddress;
+    message.msg_namelen = sizeof(*serverAddress);
+    message.msg_iov = chunks.data();
+    message.msg_iovlen = count;
+    message.msg_control = control.data;
+    message.msg_controllen = sizeof(control.data);
+
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_UDP;
+    header->cmsg_type = UDP_SEGMENT;
+    header->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+    const uint16_t segmentSize = static_cast<uint16_t>(requests[first].size());
+    std::memcpy(CMSG_DATA(header), &segmentSize, sizeof(segmentSize));
+
+    return sendmsg(socketDescriptor, &message, MSG_DONTWAIT) == static_cast<ssize_t>(numBytes);
+}
+
 bool ClientUdp::receive(std::string& message) {
-    char *buffer = new char[MAX_MESSAGE_LENGTH_BYTES];
+    return receiveWithin(timeout, message);
+}
 
-    int numBytesReceived = recv(socketDescriptor, buffer, MAX_MESSAGE_LENGTH_BYTES, 0);
+bool ClientUdp::request(const std::string& data, std::string& response) {
+    // 1. Late responses to previous requests would be taken for the response to this one
 
-    if (numBytesReceived <= 0) {
-        // Don't even report anything because failed receiving is common for UDP
-        delete[] buffer;
-        return false;
+    discardStaleResponses();
+
+    // 2. Send request until response arrives. Only the first attempt gives a valid round trip sample
+
+    const Clock::time_point deadline = Clock::now() + timeout;
+
+    for (size_t attempt = 0; attempt < retryOptions.maxTries; ++attempt) {
+        const Clock::time_point sentAt = Clock::now();
+
+        if (sentAt >= deadline) {
+            break;
+        }
+
+        // Failed send is treated as a lost datagram: socket buffer may be full just for a moment
+
+        send(data);
+
+        const std::chrono::microseconds attemptTimeout = std::min(
+            rttEstimator.nextTimeout(), std::chrono::duration_cast<std::chrono::microseconds>(deadline - sentAt));
+
+        if (receiveWithin(attemptTimeout, response)) {
+            if (attempt == 0) {
+                rttEstimator.addSample(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - sentAt));
+            }
+
+            return true;
+        }
+
+        rttEstimator.onTimeout();
     }
 
-    message.assign(buffer, numBytesReceived);
+    // Don't even report anything because failed receiving is common for UDP
+    return false;
+}
+
+bool ClientUdp::receiveWithin(std::chrono::microseconds waitTime, std::string& message) {
+    if (!receivedSegments.empty()) {
+        message.swap(receivedSegments.front());
+        receivedSegments.pop_front();
+        return true;
+    }
+
+    const Clock::time_point deadline = Clock::now() + waitTime;
+
+    iovec chunk{ buffer.data(), buffer.size() };
+
+    union {
+        char data[CMSG_SPACE(sizeof(int))];
+        cmsghdr alignment;
+    } control;
+
+    for (;;) {
+        msghdr header{};
+        header.msg_iov = &chunk;
+        header.msg_iovlen = 1;
+
+        if (isGroEnabled) {
+            header.msg_control = control.data;
+            header.msg_controllen = sizeof(control.data);
+        }
+
+        const ssize_t numBytesReceived = recvmsg(socketDescriptor, &header, MSG_DONTWAIT);
+
+        if (numBytesReceived > 0) {
+            // Coalesced responses are returned one by one, the first one right away
+
+            size_t segmentSize = static_cast<size_t>(numBytesReceived);
+
+            for (cmsghdr *item = CMSG_FIRSTHDR(&header); item != nullptr; item = CMSG_NXTHDR(&header, item)) {
+                if (item->cmsg_level == SOL_UDP && item->cmsg_type == UDP_GRO) {
+                    int coalescedSize = 0;
+                    std::memcpy(&coalescedSize, CMSG_DATA(item), sizeof(coalescedSize));
+                    segmentSize = coalescedSize > 0 ? static_cast<size_t>(coalescedSize) : segmentSize;
+                }
+            }
+
+            message.assign(buffer.data(), std::min(segmentSize, static_cast<size_t>(numBytesReceived)));
+
+            for (size_t offset = segmentSize; offset < static_cast<size_t>(numBytesReceived); offset += segmentSize) {
+                receivedSegments.emplace_back(buffer.data() + offset,
+                                              std::min(segmentSize, static_cast<size_t>(numBytesReceived) - offset));
+            }
+
+            return true;
+        }
+
+        if (numBytesReceived == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return false;
+        }
+
+        // Wait rounding the rest up to milliseconds, so that short timeouts are not turned into busy loops
+
+        const Clock::duration left = deadline - Clock::now();
+
+        if (left <= Clock::duration::zero()) {
+            return false;
+        }
+
+        pollfd fd{ .fd = socketDescriptor, .events = POLLIN, .revents = 0 };
+        const long timeoutMs = (std::chrono::duration_cast<std::chrono::microseconds>(left).count() + 999) / 1000;
+
+        if (poll(&fd, 1, static_cast<int>(timeoutMs)) < 0 && errno != EINTR) {
+            return false;
+        }
+    }
+}
 
-    delete[] buffer;
+void ClientUdp::discardStaleResponses() {
+    receivedSegments.clear();
 
-    return true;
+    while (recv(socketDescriptor, buffer.data(), buffer.size(), MSG_DONTWAIT) >= 0) {}
 }
 
 ClientUdp::~ClientUdp() {
     delete serverAddress;
     shutdown(socketDescriptor, SHUT_RDWR);
     close(socketDescriptor);
-};
\ No newline at end of file
+};
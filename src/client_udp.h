@@ -1,18 +1,42 @@
 #pragma once
 
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+
 #include <socket_demo/client.h>
 
+#include "client_options.h"
+#include "rtt_estimator.h"
+
 struct sockaddr_in;
 
-// UDP client implementation
+// UDP client implementation. `request` retransmits lost requests with timeouts derived from measured
+// round trip times (see `RttEstimator`), `receive` alone waits for `timeoutSeconds`.
+// Segmentation offloads are used only if requested and supported by the kernel
 class ClientUdp : public Client {
 public:
-    ClientUdp(const std::string& address, uint16_t port, std::ostream& logStream, long timeoutSeconds = 5);
+    ClientUdp(const std::string& address, uint16_t port, std::ostream& logStream, long timeoutSeconds = 5,
+              const UdpRetryOptions& retryOptions = UdpRetryOptions(), bool useSegmentation = false,
+              bool useReceiveOffload = false);
 
     bool send(const std::string& data) override;
 
     bool receive(std::string& data) override;
 
+    // Gives up after `maxTries` attempts or once `timeoutSeconds` have passed
+    bool request(const std::string& data, std::string& response) override;
+
+    // Runs of same-size requests go out as GSO datagrams of up to `MAX_GSO_SEGMENTS` segments,
+    // the rest with `sendmmsg`
+    bool sendBatch(const std::vector<std::string>& requests) override;
+
+    bool isSegmentationEnabled() const { return isGsoEnabled; }
+    bool isReceiveOffloadEnabled() const { return isGroEnabled; }
+
+    const RttEstimator& getRttEstimator() const { return rttEstimator; }
+
     ~ClientUdp() override;
 
     // Forbid copying
@@ -21,7 +45,31 @@ public:
     ClientUdp operator=(ClientUdp&) = delete;
 
 private:
+    static constexpr size_t MAX_GSO_SEGMENTS = 64;
+
+    // Sends requests `[first, first + count)` as a single GSO datagram
+    bool sendSegmented(const std::vector<std::string>& requests, size_t first, size_t count);
+
+    // Sends requests `[first, first + count)` as separate datagrams with `sendmmsg`
+    bool sendMultiple(const std::vector<std::string>& requests, size_t first, size_t count);
+
+    // Waits for a datagram at most `waitTime`, millisecond resolution
+    bool receiveWithin(std::chrono::microseconds waitTime, std::string& message);
+
+    // Drops responses which have arrived too late, e.g. duplicates caused by retransmission
+    void discardStaleResponses();
+
     sockaddr_in *serverAddress;
     int socketDescriptor;
+    std::chrono::seconds timeout;
+    UdpRetryOptions retryOptions;
+    RttEstimator rttEstimator;
+    std::vector<char> buffer;
+
+    bool isGsoEnabled = false;
+    bool isGroEnabled = false;
+
+    // Segments of a coalesced datagram which have not been returned by `receive` yet
+    std::deque<std::string> receivedSegments;
     std::ostream& logStream;
-};
\ No newline at end of file
+};
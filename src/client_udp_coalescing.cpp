@@ -0,0 +1,455 @@
+#include <ostream>
+#include <cstring>
+#include <algorithm>
+
+#include <poll.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <socket_demo/defines.h>
+
+#include "utils.h"
+#include "client_udp_coalescing.h"
+
+constexpr size_t ClientUdpCoalescing::RECEIVE_BATCH_SIZE;
+
+namespace {
+
+// Request has to fit into a packed datagram alone
+bool isValidRequest(const std::string& data) {
+    return !data.empty() && getPackedMessageSize(1, data.size()) <= MAX_MESSAGE_LENGTH_BYTES;
+}
+
+} // namespace
+
+ClientUdpCoalescing::ClientUdpCoalescing(const std::string& address, uint16_t port, std::ostream& logStream,
+                                         long timeoutSeconds, const UdpRetryOptions& retryOptions,
+                                         const UdpCoalescingOptions& coalescingOptions)
+    : linger(coalescingOptions.lingerMicroseconds), maxDatagramBytes(coalescingOptions.maxDatagramBytes),
+      timeout(timeoutSeconds), retryOptions(retryOptions), rttEstimator(retryOptions), logStream(logStream),
+      receiveBuffers(RECEIVE_BATCH_SIZE * MAX_MESSAGE_LENGTH_BYTES)
+{
+    // 1. Check options
+
+    sockaddr_in serverAddress{};
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons(port);
+
+    if (!inet_pton(AF_INET, address.c_str(), &serverAddress.sin_addr)) {
+        throw std::invalid_argument("Invalid socket address: " + address);
+    }
+
+    if (timeoutSeconds <= 0) {
+        throw std::runtime_error("Timeout should be a positive value!");
+    }
+
+    if (retryOptions.maxTries == 0 || retryOptions.minTimeoutMs <= 0) {
+        throw std::invalid_argument("Number of tries and minimal retransmission timeout should be positive values");
+    }
+
+    if (coalescingOptions.lingerMicroseconds < 0 || maxDatagramBytes <= getPackedMessageSize(1, 0) ||
+        maxDatagramBytes > MAX_MESSAGE_LENGTH_BYTES)
+    {
+        throw std::invalid_argument("Linger time should not be negative and datagram should fit a request");
+    }
+
+    // 2. Create UDP socket connected to the server, so that only its datagrams are received
+    // and `sendmmsg` needs no addresses
+
+    socketDescriptor = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    if (socketDescriptor < 0) {
+        throw std::runtime_error("Cannot create UDP socket: " + getError());
+    }
+
+    if (connect(socketDescriptor, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress)) < 0) {
+        const std::string error = getError();
+        close(socketDescriptor);
+        throw std::runtime_error("Cannot connect UDP socket: " + error);
+    }
+
+    try {
+        wakeupDescriptor = createEventFd();
+    } catch (...) {
+        close(socketDescriptor);
+        throw;
+    }
+
+    // 3. Start I/O thread
+
+    thread = std::thread(&ClientUdpCoalescing::run, this);
+}
+
+bool ClientUdpCoalescing::send(const std::string& data) {
+    if (!isValidRequest(data)) {
+        return false;
+    }
+
+    std::shared_ptr<Call> call(new Call);
+    call->request = data;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        unclaimed.push_back(call);
+    }
+
+    enqueue(&call, 1);
+
+    return true;
+}
+
+bool ClientUdpCoalescing::sendBatch(const std::vector<std::string>& requests) {
+    if (!std::all_of(requests.begin(), requests.end(), isValidRequest)) {
+        return false;
+    }
+
+    std::vector<std::shared_ptr<Call>> calls(requests.size());
+
+    for (size_t i = 0; i < requests.size(); ++i) {
+        calls[i].reset(new Call);
+        calls[i]->request = requests[i];
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        unclaimed.insert(unclaimed.end(), calls.begin(), calls.end());
+    }
+
+    enqueue(calls.data(), calls.size());
+
+    return true;
+}
+
+bool ClientUdpCoalescing::receive(std::string& data) {
+    std::shared_ptr<Call> call;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (unclaimed.empty()) {
+            return false;
+        }
+
+        call = std::move(unclaimed.front());
+        unclaimed.pop_front();
+    }
+
+    return wait(*call, data);
+}
+
+bool ClientUdpCoalescing::request(const std::string& data, std::string& response) {
+    if (!isValidRequest(data)) {
+        return false;
+    }
+
+    std::shared_ptr<Call> call(new Call);
+    call->request = data;
+
+    enqueue(&call, 1);
+
+    return wait(*call, response);
+}
+
+void ClientUdpCoalescing::enqueue(const std::shared_ptr<Call> *calls, size_t numCalls) {
+    bool shouldWake = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (queued.empty()) {
+            lingerDeadline = Clock::now() + linger;
+            shouldWake = true;
+        }
+
+        for (size_t i = 0; i < numCalls; ++i) {
+            queued.push_back(calls[i]);
+            queuedBytes += PACKED_ENTRY_HEADER_SIZE + calls[i]->request.size();
+        }
+
+        shouldWake = shouldWake || PACKED_HEADER_SIZE + queuedBytes >= maxDatagramBytes;
+    }
+
+    if (shouldWake) {
+        notifyEventFd(wakeupDescriptor);
+    }
+}
+
+bool ClientUdpCoalescing::wait(Call& call, std::string& response) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Call given up by the caller is still finished by I/O thread, which owns it too
+
+    if (!condition.wait_until(lock, Clock::now() + timeout, [&] { return call.isDone; }) || !call.isAnswered) {
+        return false;
+    }
+
+    response.swap(call.response);
+
+    return true;
+}
+
+void ClientUdpCoalescing::run() {
+    pollfd fds[2] = {
+        { .fd = socketDescriptor, .events = POLLIN, .revents = 0 },
+        { .fd = wakeupDescriptor, .events = POLLIN, .revents = 0 }
+    };
+
+    for (;;) {
+        // 1. Pack queued requests. Datagram which is not full waits until the oldest request has lingered
+
+        Clock::time_point wakeAt = Clock::time_point::max();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (isStopped) {
+                break;
+            }
+
+            packQueued(Clock::now() >= lingerDeadline);
+
+            if (!queued.empty()) {
+                wakeAt = lingerDeadline;
+            }
+        }
+
+        // 2. Send new datagrams together with retransmitted ones
+
+        const Clock::time_point now = Clock::now();
+
+        checkTimeouts(now, wakeAt);
+        sendOutgoing();
+
+        // 3. Wait for responses, new requests or the nearest deadline. Linger is usually shorter
+        // than a millisecond, so poll with nanosecond timeout is used
+
+        timespec waitTime{};
+        const timespec *waitTimePointer = nullptr;
+
+        if (wakeAt != Clock::time_point::max()) {
+            const long long left = std::max<long long>(
+                0, std::chrono::duration_cast<std::chrono::nanoseconds>(wakeAt - now).count());
+
+            waitTime.tv_sec = static_cast<time_t>(left / 1000000000);
+            waitTime.tv_nsec = static_cast<long>(left % 1000000000);
+            waitTimePointer = &waitTime;
+        }
+
+        if (ppoll(fds, 2, waitTimePointer, nullptr) < 0) {
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            drainEventFd(wakeupDescriptor);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            receiveResponses();
+        }
+    }
+}
+
+void ClientUdpCoalescing::packQueued(bool flushAll) {
+    const Clock::time_point now = Clock::now();
+
+    while (!queued.empty()) {
+        // 1. Take as many requests as fit, the first one always does
+
+        size_t numCalls = 0;
+        size_t size = PACKED_HEADER_SIZE;
+
+        while (numCalls < queued.size() &&
+               (numCalls == 0 || size + PACKED_ENTRY_HEADER_SIZE + queued[numCalls]->request.size() <= maxDatagramBytes))
+        {
+            size += PACKED_ENTRY_HEADER_SIZE + queued[numCalls]->request.size();
+            ++numCalls;
+        }
+
+        if (numCalls == queued.size() && size < maxDatagramBytes && !flushAll) {
+            break;
+        }
+
+        // 2. Pack them under a new tag
+
+        const uint64_t tag = nextTag++;
+        Datagram& datagram = inFlight[tag];
+
+        beginPackedMessage(tag, datagram.message);
+
+        for (size_t i = 0; i < numCalls; ++i) {
+            std::shared_ptr<Call>& call = queued.front();
+
+            appendPackedEntry(call->request.data(), call->request.size(), datagram.message);
+            queuedBytes -= PACKED_ENTRY_HEADER_SIZE + call->request.size();
+
+            datagram.calls.push_back(std::move(call));
+            queued.pop_front();
+        }
+
+        datagram.numTries = 1;
+        datagram.sentAt = now;
+        datagram.retransmitAt = now + rttEstimator.nextTimeout();
+
+        outgoing.push_back(&datagram.message);
+    }
+}
+
+void ClientUdpCoalescing::sendOutgoing() {
+    if (outgoing.empty()) {
+        return;
+    }
+
+    sendingHeaders.assign(outgoing.size(), mmsghdr{});
+    sendingChunks.resize(outgoing.size());
+
+    for (size_t i = 0; i < outgoing.size(); ++i) {
+        sendingChunks[i].iov_base = const_cast<char*>(outgoing[i]->data());
+        sendingChunks[i].iov_len = outgoing[i]->size();
+        sendingHeaders[i].msg_hdr.msg_iov = &sendingChunks[i];
+        sendingHeaders[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // Datagrams which are not sent, e.g. because socket buffer is full, are lost and retransmitted on timeout
+
+    for (size_t numSent = 0; numSent < outgoing.size();) {
+        const int result = sendmmsg(socketDescriptor, sendingHeaders.data() + numSent,
+                                    static_cast<unsigned int>(outgoing.size() - numSent), MSG_DONTWAIT);
+
+        if (result <= 0) {
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        numSent += static_cast<size_t>(result);
+    }
+
+    outgoing.clear();
+}
+
+void ClientUdpCoalescing::checkTimeouts(Clock::time_point now, Clock::time_point& wakeAt) {
+    // Timeout is backed off once per wakeup, so that a burst of losses does not inflate it many times over
+
+    bool hasExpired = false;
+
+    for (const auto& item: inFlight) {
+        hasExpired = hasExpired || item.second.retransmitAt <= now;
+    }
+
+    if (hasExpired) {
+        rttEstimator.onTimeout();
+    }
+
+    for (auto it = inFlight.begin(); it != inFlight.end();) {
+        Datagram& datagram = it->second;
+
+        if (datagram.retransmitAt <= now) {
+            if (datagram.numTries >= retryOptions.maxTries) {
+                finish(datagram, nullptr);
+                it = inFlight.erase(it);
+                continue;
+            }
+
+            ++datagram.numTries;
+            datagram.retransmitAt = now + rttEstimator.nextTimeout();
+            outgoing.push_back(&datagram.message);
+        }
+
+        wakeAt = std::min(wakeAt, datagram.retransmitAt);
+        ++it;
+    }
+}
+
+void ClientUdpCoalescing::receiveResponses() {
+    mmsghdr headers[RECEIVE_BATCH_SIZE];
+    iovec chunks[RECEIVE_BATCH_SIZE];
+
+    for (;;) {
+        for (size_t i = 0; i < RECEIVE_BATCH_SIZE; ++i) {
+            chunks[i].iov_base = receiveBuffers.data() + i * MAX_MESSAGE_LENGTH_BYTES;
+            chunks[i].iov_len = MAX_MESSAGE_LENGTH_BYTES;
+            headers[i] = mmsghdr{};
+            headers[i].msg_hdr.msg_iov = &chunks[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int numReceived = recvmmsg(socketDescriptor, headers, RECEIVE_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+
+        if (numReceived <= 0) {
+            if (numReceived < 0 && errno == EINTR) {
+                continue;
+            }
+
+            return;
+        }
+
+        const Clock::time_point now = Clock::now();
+
+        for (int i = 0; i < numReceived; ++i) {
+            // Late duplicates of retransmitted datagrams and malformed responses are dropped
+
+            uint64_t tag;
+
+            if (!decodePackedMessage(static_cast<const char*>(chunks[i].iov_base), headers[i].msg_len, true, tag,
+                                     receivedEntries)) {
+                continue;
+            }
+
+            auto it = inFlight.find(tag);
+
+            if (it == inFlight.end() || it->second.calls.size() != receivedEntries.size()) {
+                continue;
+            }
+
+            // Only the first attempt gives a valid round trip sample
+
+            if (it->second.numTries == 1) {
+                rttEstimator.addSample(std::chrono::duration_cast<std::chrono::microseconds>(now - it->second.sentAt));
+            }
+
+            finish(it->second, &receivedEntries);
+            inFlight.erase(it);
+        }
+
+        if (static_cast<size_t>(numReceived) < RECEIVE_BATCH_SIZE) {
+            return;
+        }
+    }
+}
+
+void ClientUdpCoalescing::finish(Datagram& datagram, const std::vector<PackedEntry> *entries) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (size_t i = 0; i < datagram.calls.size(); ++i) {
+            Call& call = *datagram.calls[i];
+
+            if (entries && (*entries)[i].size != PACKED_DROPPED_ENTRY) {
+                call.response.assign((*entries)[i].data, (*entries)[i].size);
+                call.isAnswered = true;
+            }
+
+            call.isDone = true;
+        }
+    }
+
+    condition.notify_all();
+}
+
+ClientUdpCoalescing::~ClientUdpCoalescing() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        isStopped = true;
+    }
+
+    notifyEventFd(wakeupDescriptor);
+    thread.join();
+
+    close(wakeupDescriptor);
+    shutdown(socketDescriptor, SHUT_RDWR);
+    close(socketDescriptor);
+}
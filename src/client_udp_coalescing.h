@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <condition_variable>
+
+#include <sys/socket.h>
+
+#include <socket_demo/client.h>
+
+#include "client_options.h"
+#include "packed_protocol.h"
+#include "rtt_estimator.h"
+
+// UDP client coalescing requests of many callers. Requests are queued, packed into shared datagrams
+// (see `packed_protocol.h`) once a datagram is full or the oldest request has waited `lingerMicroseconds`,
+// and sent with a single `sendmmsg`. I/O thread receives responses with `recvmmsg` and hands them to callers
+// by the tag of their datagram; whole datagrams are retransmitted like `ClientUdp` retransmits requests.
+//
+// `request` is thread-safe and is meant to be called by many threads at once. `send`, `sendBatch` and `receive`
+// share a single queue of unclaimed responses, so they are meant for one thread
+class ClientUdpCoalescing : public Client {
+public:
+    ClientUdpCoalescing(const std::string& address, uint16_t port, std::ostream& logStream, long timeoutSeconds = 5,
+                        const UdpRetryOptions& retryOptions = UdpRetryOptions(),
+                        const UdpCoalescingOptions& coalescingOptions = UdpCoalescingOptions());
+
+    bool send(const std::string& data) override;
+
+    // Waits for the response to the oldest request sent with `send` or `sendBatch`
+    bool receive(std::string& data) override;
+
+    bool request(const std::string& data, std::string& response) override;
+
+    bool sendBatch(const std::vector<std::string>& requests) override;
+
+    ~ClientUdpCoalescing() override;
+
+    // Forbid copying
+
+    ClientUdpCoalescing(ClientUdpCoalescing&) = delete;
+    ClientUdpCoalescing operator=(ClientUdpCoalescing&) = delete;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t RECEIVE_BATCH_SIZE = 16;
+
+    struct Call {
+        std::string request;
+        std::string response;
+
+        // Guarded by `mutex`. Call is done once answered or given up
+        bool isDone = false;
+        bool isAnswered = false;
+    };
+
+    // Packed datagram waiting for its response. I/O thread only
+    struct Datagram {
+        std::vector<std::shared_ptr<Call>> calls;
+        std::string message;
+        size_t numTries;
+        Clock::time_point sentAt;
+        Clock::time_point retransmitAt;
+    };
+
+    // Queues calls and wakes I/O thread if it has to start lingering or a datagram is full
+    void enqueue(const std::shared_ptr<Call> *calls, size_t numCalls);
+
+    bool wait(Call& call, std::string& response);
+
+    // I/O thread
+
+    void run();
+
+    // Moves queued calls into datagrams. Calls which do not fill a datagram stay queued unless `flushAll` is set
+    void packQueued(bool flushAll);
+
+    void sendOutgoing();
+
+    // Retransmits datagrams whose timeout has expired, gives up on those which are out of tries,
+    // and moves `wakeAt` to the nearest timeout
+    void checkTimeouts(Clock::time_point now, Clock::time_point& wakeAt);
+
+    void receiveResponses();
+
+    // Hands responses to callers, `entries` is null if the datagram is given up
+    void finish(Datagram& datagram, const std::vector<PackedEntry> *entries);
+
+    std::chrono::microseconds linger;
+    size_t maxDatagramBytes;
+    std::chrono::seconds timeout;
+    UdpRetryOptions retryOptions;
+    RttEstimator rttEstimator;
+
+    int socketDescriptor;
+    int wakeupDescriptor;
+    std::ostream& logStream;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool isStopped = false;
+    std::deque<std::shared_ptr<Call>> queued;
+    size_t queuedBytes = 0;
+    Clock::time_point lingerDeadline;
+
+    // Calls of `send` waiting for `receive`
+    std::deque<std::shared_ptr<Call>> unclaimed;
+
+    // I/O thread only. References to map values stay valid while other datagrams are added
+    uint64_t nextTag = 1;
+    std::unordered_map<uint64_t, Datagram> inFlight;
+    std::vector<const std::string*> outgoing;
+    std::vector<mmsghdr> sendingHeaders;
+    std::vector<iovec> sendingChunks;
+    std::vector<char> receiveBuffers;
+    std::vector<PackedEntry> receivedEntries;
+
+    std::thread thread;
+};
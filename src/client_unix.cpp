@@ -0,0 +1,101 @@
+#include <ostream>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <socket_demo/defines.h>
+
+#include "utils.h"
+#include "client_unix.h"
+
+ClientUnix::ClientUnix(const std::string& socketPath, int socketType, std::ostream& logStream, long timeoutSeconds)
+    : logStream(logStream)
+{
+    sockaddr_un socketAddress{};
+    std::memset(&socketAddress, 0, sizeof(socketAddress));
+
+    if (socketType != SOCK_STREAM && socketType != SOCK_SEQPACKET) {
+        throw std::invalid_argument("Unix socket type should be SOCK_STREAM or SOCK_SEQPACKET");
+    }
+
+    if (socketPath.empty() || socketPath.size() >= sizeof(socketAddress.sun_path)) {
+        throw std::invalid_argument("Invalid unix socket path: " + socketPath);
+    }
+
+    // 1. Create unix socket
+
+    socketDescriptor = socket(AF_UNIX, socketType, 0);
+
+    if (socketDescriptor < 0) {
+        throw std::runtime_error("Cannot create unix socket: " + getError());
+    }
+
+    // 2. Set timeout on reading and writing
+
+    if (timeoutSeconds <= 0) {
+        close(socketDescriptor);
+        throw std::runtime_error("Timeout should be a positive value!");
+    }
+
+    timeval timeout{ timeoutSeconds, 0 };
+
+    if (setsockopt(socketDescriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        close(socketDescriptor);
+        throw std::runtime_error("Cannot set READ timeout: " + getError());
+    }
+
+    if (setsockopt(socketDescriptor, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+        close(socketDescriptor);
+        throw std::runtime_error("Cannot set SEND timeout: " + getError());
+    }
+
+    // 3. Establish connection. Unlike TCP it either succeeds or fails immediately
+
+    socketAddress.sun_family = AF_UNIX;
+    std::strncpy(socketAddress.sun_path, socketPath.c_str(), sizeof(socketAddress.sun_path) - 1);
+
+    if (connect(socketDescriptor, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) < 0) {
+        close(socketDescriptor);
+        throw std::invalid_argument("Connection failed: " + getError());
+    }
+}
+
+bool ClientUnix::send(const std::string& data) {
+    if (data.empty()) {
+        return false;
+    }
+
+    if (data.size() >= MAX_MESSAGE_LENGTH_BYTES) {
+        logStream << "Data is too long, it will be truncated to "
+                  << MAX_MESSAGE_LENGTH_BYTES << " bytes" << std::endl;
+    }
+
+    const int64_t actualDataSize = std::min(data.size(), static_cast<size_t>(MAX_MESSAGE_LENGTH_BYTES));
+
+    return ::send(socketDescriptor, data.data(), actualDataSize, MSG_NOSIGNAL) == actualDataSize;
+}
+
+bool ClientUnix::receive(std::string& message) {
+    char *buffer = new char[MAX_MESSAGE_LENGTH_BYTES];
+
+    int numBytesReceived = ::recv(socketDescriptor, buffer, MAX_MESSAGE_LENGTH_BYTES, 0);
+
+    if (numBytesReceived <= 0) {
+        logStream << "Cannot receive message: " + getError() << std::endl;
+        delete[] buffer;
+        return false;
+    }
+
+    message.assign(buffer, numBytesReceived);
+
+    delete[] buffer;
+
+    return true;
+}
+
+ClientUnix::~ClientUnix() {
+    shutdown(socketDescriptor, SHUT_RDWR);
+    close(socketDescriptor);
+}
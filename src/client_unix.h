@@ -0,0 +1,24 @@
+#pragma once
+
+#include <socket_demo/client.h>
+
+// Unix domain socket client implementation (SOCK_STREAM or SOCK_SEQPACKET)
+class ClientUnix : public Client {
+public:
+    ClientUnix(const std::string& socketPath, int socketType, std::ostream& logStream, long timeoutSeconds = 5);
+
+    bool send(const std::string& data) override;
+
+    bool receive(std::string& data) override;
+
+    ~ClientUnix() override;
+
+    // Forbid copying
+
+    ClientUnix(ClientUnix&) = delete;
+    ClientUnix operator=(ClientUnix&) = delete;
+
+private:
+    int socketDescriptor;
+    std::ostream& logStream;
+};
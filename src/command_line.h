@@ -0,0 +1,114 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <utility>
+#include <iostream>
+#include <type_traits>
+
+// Optional `--name=value` arguments (`--name` alone means `--name=1`). `getOption` removes what it reads,
+// so that `checkUnknownOptions` finds misspelled options, which would silently keep the defaults otherwise
+using CommandLineOptions = std::map<std::string, std::string>;
+
+// Moves optional arguments from `argv` to `options`, keeps positional ones in order and returns
+// their number, so the rest of `main` may keep indexing `argv` as if there were no options at all
+inline int extractOptions(int argc, char **argv, CommandLineOptions& options) {
+    int numPositional = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument(argv[i]);
+
+        if (argument.size() > 2 && argument.compare(0, 2, "--") == 0) {
+            const size_t separator = argument.find('=');
+            const std::string name = argument.substr(2, separator == std::string::npos ? separator : separator - 2);
+            std::string value = separator == std::string::npos ? std::string(1, '1') : argument.substr(separator + 1);
+
+            options[name] = std::move(value);
+        } else {
+            argv[numPositional++] = argv[i];
+        }
+    }
+
+    return numPositional;
+}
+
+// Reads option value if it is present. Returns false and reports the problem if value is malformed.
+// Streams wrap negative input of unsigned types around, so it is refused explicitly
+template<typename T>
+bool getOption(CommandLineOptions& options, const std::string& name, T& value) {
+    auto it = options.find(name);
+
+    if (it == options.end()) {
+        return true;
+    }
+
+    std::istringstream ss(it->second);
+    T parsed;
+
+    if ((std::is_unsigned<T>::value && it->second.find('-') != std::string::npos) ||
+        !(ss >> parsed) || !ss.eof())
+    {
+        std::cerr << "Invalid value of --" << name << ": " << it->second << std::endl;
+        return false;
+    }
+
+    value = parsed;
+    options.erase(it);
+
+    return true;
+}
+
+template<>
+inline bool getOption<std::string>(CommandLineOptions& options, const std::string& name, std::string& value) {
+    auto it = options.find(name);
+
+    if (it != options.end()) {
+        value = it->second;
+        options.erase(it);
+    }
+
+    return true;
+}
+
+// Comma separated list, e.g. `--cpus=0,2,4`
+template<>
+inline bool getOption<std::vector<int>>(CommandLineOptions& options, const std::string& name,
+                                        std::vector<int>& value) {
+    auto it = options.find(name);
+
+    if (it == options.end()) {
+        return true;
+    }
+
+    std::vector<int> parsed;
+    std::istringstream ss(it->second);
+    std::string item;
+
+    while (std::getline(ss, item, ',')) {
+        std::istringstream itemStream(item);
+        int number;
+
+        if (!(itemStream >> number) || !itemStream.eof()) {
+            std::cerr << "Invalid value of --" << name << ": " << it->second << std::endl;
+            return false;
+        }
+
+        parsed.push_back(number);
+    }
+
+    value = parsed;
+    options.erase(it);
+
+    return true;
+}
+
+// Reports options no `getOption` has read. Call it once all options are read
+inline bool checkUnknownOptions(const CommandLineOptions& options) {
+    for (const auto& option: options) {
+        std::cerr << "Unknown option --" << option.first << std::endl;
+    }
+
+    return options.empty();
+}
@@ -0,0 +1,197 @@
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <unistd.h>
+
+#include "datagram_backend.h"
+
+std::ostream& operator<<(std::ostream& stream, const UdpPeer& peer) {
+    char from[INET_ADDRSTRLEN + 1];
+
+    if (inet_ntop(AF_INET, &peer.address.sin_addr, from, INET_ADDRSTRLEN) == nullptr) {
+        return stream << "unknown address";
+    }
+
+    return stream << from << ":" << ntohs(peer.address.sin_port);
+}
+
+constexpr size_t DatagramBackend::MAX_GSO_SEGMENTS;
+
+DatagramBackend::DatagramBackend(FdGuard socket, const OverloadLimits& limits,
+                                 const BusyPollOptions& busyPollOptions, const UdpOffloadOptions& offloadOptions)
+    : socketDescriptor(socket.get()), wakeupFd(createEventFd()),
+      buffer(new char[BATCH_SIZE * MAX_MESSAGE_LENGTH_BYTES]), overloadGuard(limits),
+      busyPollOptions(busyPollOptions), busyPoller(busyPollOptions)
+{
+    // Offloads are optional, kernels without them (before 4.18 and 5.0) keep the plain path.
+    // Segment size is set per send, so GSO support is only probed here
+
+    if (offloadOptions.receiveOffload) {
+        int enable = 1;
+
+        if (setsockopt(socketDescriptor, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) < 0) {
+            offloadWarnings.push_back("Cannot set UDP_GRO, coalescing is disabled: " + getError());
+        } else {
+            isGroEnabled = true;
+        }
+    }
+
+    if (offloadOptions.segmentation) {
+        int segmentSize = 0;
+        socklen_t optionLength = sizeof(segmentSize);
+
+        if (getsockopt(socketDescriptor, SOL_UDP, UDP_SEGMENT, &segmentSize, &optionLength) < 0) {
+            offloadWarnings.push_back("UDP_SEGMENT is not supported, GSO is disabled: " + getError());
+        } else {
+            isGsoEnabled = true;
+        }
+    }
+
+    socket.release();
+}
+
+void DatagramBackend::resetMessages() {
+    for (size_t i = 0; i < BATCH_SIZE; ++i) {
+        vectors[i].iov_base = buffer.get() + i * MAX_MESSAGE_LENGTH_BYTES;
+        vectors[i].iov_len = MAX_MESSAGE_LENGTH_BYTES;
+
+        messages[i] = mmsghdr{};
+        messages[i].msg_hdr.msg_name = &peers[i].address;
+        messages[i].msg_hdr.msg_namelen = sizeof(peers[i].address);
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+
+        if (isGroEnabled) {
+            messages[i].msg_hdr.msg_control = receiveControls[i].data;
+            messages[i].msg_hdr.msg_controllen = sizeof(receiveControls[i].data);
+        }
+    }
+}
+
+size_t DatagramBackend::getGroSegmentSize(const msghdr& message) {
+    for (const cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr;
+         header = CMSG_NXTHDR(const_cast<msghdr*>(&message), const_cast<cmsghdr*>(header)))
+    {
+        if (header->cmsg_level == SOL_UDP && header->cmsg_type == UDP_GRO) {
+            int segmentSize = 0;
+            std::memcpy(&segmentSize, CMSG_DATA(header), sizeof(segmentSize));
+            return segmentSize > 0 ? static_cast<size_t>(segmentSize) : 0;
+        }
+    }
+
+    return 0;
+}
+
+void DatagramBackend::buildSendingMessages() {
+    // 1. Group runs of datagrams to the same peer: all of them but the last must have the same size,
+    // and the whole run has to fit into a single datagram
+
+    sendingGroups.clear();
+
+    for (size_t i = 0; i < pendingDatagrams.size(); ++i) {
+        const PendingDatagram& datagram = pendingDatagrams[i];
+        size_t size = 0;
+
+        for (size_t j = datagram.firstChunk; j < datagram.firstChunk + datagram.numChunks; ++j) {
+            size += pendingChunks[j].iov_len;
+        }
+
+        if (isGsoEnabled && !sendingGroups.empty()) {
+            SendingGroup& group = sendingGroups.back();
+            const UdpPeer& groupPeer = pendingDatagrams[group.firstDatagram].peer;
+
+            const bool isSamePeer = groupPeer.address.sin_addr.s_addr == datagram.peer.address.sin_addr.s_addr &&
+                                    groupPeer.address.sin_port == datagram.peer.address.sin_port;
+
+            if (isSamePeer && group.numDatagrams < MAX_GSO_SEGMENTS && group.lastSize == group.segmentSize &&
+                size <= group.segmentSize && group.segmentSize <= maxGsoSegmentSize &&
+                group.numBytes + size <= MAX_MESSAGE_LENGTH_BYTES)
+            {
+                ++group.numDatagrams;
+                group.numChunks += datagram.numChunks;
+                group.lastSize = size;
+                group.numBytes += size;
+                continue;
+            }
+        }
+
+        sendingGroups.push_back({ i, 1, datagram.numChunks, size, size, size });
+    }
+
+    // 2. Chunks of consecutive datagrams are adjacent, so a group is sent straight from them.
+    // Control buffers are sized first, since messages point into them
+
+    sendingMessages.resize(sendingGroups.size());
+    sendingControls.resize(sendingGroups.size());
+
+    for (size_t i = 0; i < sendingGroups.size(); ++i) {
+        const SendingGroup& group = sendingGroups[i];
+        PendingDatagram& first = pendingDatagrams[group.firstDatagram];
+
+        sendingMessages[i] = mmsghdr{};
+        sendingMessages[i].msg_hdr.msg_name = &first.peer.address;
+        sendingMessages[i].msg_hdr.msg_namelen = sizeof(first.peer.address);
+        sendingMessages[i].msg_hdr.msg_iov = &pendingChunks[first.firstChunk];
+        sendingMessages[i].msg_hdr.msg_iovlen = group.numChunks;
+
+        if (group.numDatagrams == 1) {
+            continue;
+        }
+
+        msghdr& header = sendingMessages[i].msg_hdr;
+        header.msg_control = sendingControls[i].data;
+        header.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+        cmsghdr *control = CMSG_FIRSTHDR(&header);
+        control->cmsg_level = SOL_UDP;
+        control->cmsg_type = UDP_SEGMENT;
+        control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+        const uint16_t segmentSize = static_cast<uint16_t>(group.segmentSize);
+        std::memcpy(CMSG_DATA(control), &segmentSize, sizeof(segmentSize));
+    }
+}
+
+DatagramBackend::~DatagramBackend() {
+    shutdown();
+    close(wakeupFd);
+}
+
+int DatagramBackend::receiveNow() {
+    TraceSpan span("recv");
+    countSyscalls();
+    const int result = recvmmsg(socketDescriptor, messages, BATCH_SIZE, MSG_DONTWAIT, nullptr);
+    span.end();
+
+    return result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : result;
+}
+
+Clock::duration DatagramBackend::getLastDatagramLag() {
+    timeval receivedAt{};
+
+    countSyscalls();
+
+    if (ioctl(socketDescriptor, SIOCGSTAMP, &receivedAt) < 0) {
+        return Clock::duration::zero();
+    }
+
+    const auto sinceEpoch = std::chrono::seconds(receivedAt.tv_sec) + std::chrono::microseconds(receivedAt.tv_usec);
+
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::system_clock::now().time_since_epoch() - sinceEpoch);
+}
+
+void DatagramBackend::queue(const Endpoint& peer, const iovec *chunks, size_t numChunks) {
+    pendingDatagrams.push_back({ peer, pendingChunks.size(), numChunks });
+    pendingChunks.insert(pendingChunks.end(), chunks, chunks + numChunks);
+}
+
+void DatagramBackend::shutdown() {
+    if (socketDescriptor >= 0) {
+        ::shutdown(socketDescriptor, SHUT_RDWR);
+        close(socketDescriptor);
+        socketDescriptor = -1;
+    }
+}
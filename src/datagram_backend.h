@@ -0,0 +1,373 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <socket_demo/defines.h>
+#include <socket_demo/server_stats.h>
+
+#include "busy_poll.h"
+#include "overload_guard.h"
+#include "server_options.h"
+#include "trace.h"
+#include "utils.h"
+
+// UDP peer address
+struct UdpPeer {
+    sockaddr_in address;
+};
+
+std::ostream& operator<<(std::ostream& stream, const UdpPeer& peer);
+
+// Peer identifier for traffic capture: IPv4 address and port in host byte order
+inline uint64_t capturePeer(const UdpPeer& peer) {
+    return static_cast<uint64_t>(ntohl(peer.address.sin_addr.s_addr)) << 16 | ntohs(peer.address.sin_port);
+}
+
+// `ServerCore` backend for UDP socket. Every datagram is reported as data of its sender.
+// All datagrams queued in the socket (up to `BATCH_SIZE`) are received with a single `recvmmsg`.
+// Socket is read without blocking, backend sleeps in `poll` together with wakeup eventfd once it is empty.
+// With segmentation offloads (see `UdpOffloadOptions`) a received datagram may carry several coalesced ones,
+// which are reported separately, and runs of same-size responses to one peer are sent as a single GSO datagram
+class DatagramBackend {
+public:
+    using Endpoint = UdpPeer;
+
+    static constexpr size_t BATCH_SIZE = 16;
+
+    // Kernel limit of segments per GSO send (`UDP_MAX_SEGMENTS` of older kernels)
+    static constexpr size_t MAX_GSO_SEGMENTS = 64;
+
+    // Answering a flood amplifies it, so rejected datagrams are dropped silently
+    static constexpr bool repliesToRejected = false;
+
+    // Takes ownership of bound socket, which is closed if construction fails
+    DatagramBackend(FdGuard socket, const OverloadLimits& limits,
+                    const BusyPollOptions& busyPollOptions = BusyPollOptions(),
+                    const UdpOffloadOptions& offloadOptions = UdpOffloadOptions());
+
+    ~DatagramBackend();
+
+    // Forbid copying
+
+    DatagramBackend(DatagramBackend&) = delete;
+    DatagramBackend operator=(DatagramBackend&) = delete;
+
+    template<typename Handler>
+    void start(Handler& handler) {
+        enterLatencyMode(socketDescriptor, busyPollOptions, handler.getLogger());
+
+        for (const auto& warning: offloadWarnings) {
+            handler.getLogger().log(warning);
+        }
+    }
+
+    template<typename Handler>
+    void wait(Handler& handler);
+
+    // Serves datagrams queued in the socket, at most `MAX_DRAIN_BATCHES` batches of them,
+    // since clients may keep sending
+    template<typename Handler>
+    void drain(Handler& handler);
+
+    void wakeUp() {
+        notifyEventFd(wakeupFd);
+    }
+
+    void queue(const Endpoint& peer, const iovec *chunks, size_t numChunks);
+
+    // Sends all queued datagrams with `sendmmsg`, runs of them to the same peer as GSO datagrams if enabled
+    template<typename Handler>
+    void flushSends(Handler& handler);
+
+    // Datagrams are copied by `sendmmsg`
+    void retainResponses(std::vector<std::string>&) {}
+
+    OverloadGuard::Verdict admit(const Endpoint& peer, size_t size, Clock::duration lag, size_t numRequests) {
+        return overloadGuard.admitRequest(ntohl(peer.address.sin_addr.s_addr), size, lag, numRequests);
+    }
+
+    const OverloadGuard& getOverloadGuard() const { return overloadGuard; }
+
+    uint64_t getCapturePeer(const Endpoint& peer) const {
+        return capturePeer(peer);
+    }
+
+    void fillStats(ServerStats& stats) const {
+        overloadGuard.fillStats(stats);
+        busyPoller.fillStats(stats);
+        stats.udpGsoSegments += gsoSegments.load(std::memory_order_relaxed);
+        stats.udpGroSegments += groSegments.load(std::memory_order_relaxed);
+        stats.loopSyscalls = syscalls.load(std::memory_order_relaxed);
+    }
+
+    void shutdown();
+
+private:
+    static constexpr size_t MAX_DRAIN_BATCHES = 64;
+
+    // Receives whatever is queued without blocking. Returns number of datagrams, 0 if there are none
+    int receiveNow();
+
+    // Reports received datagrams and flushes them
+    template<typename Handler>
+    void dispatch(Handler& handler, int numReceived);
+
+    // UDP has no wakeup to measure from, so lag is the time since kernel received the last datagram
+    Clock::duration getLastDatagramLag();
+
+    // Event loop thread is the only writer
+    void countSyscalls(uint64_t count = 1) {
+        syscalls.store(syscalls.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    }
+
+    // Points `messages` back to `buffer` slots and `peers`, `recvmmsg` overwrites lengths
+    void resetMessages();
+
+    // Segment size of GRO-coalesced datagram, 0 if it was received as is
+    static size_t getGroSegmentSize(const msghdr& message);
+
+    // Groups queued datagrams which may go out as one GSO datagram and builds `sendingMessages` for them
+    void buildSendingMessages();
+
+    // Sends datagrams of a group the kernel refused to segment one by one and stops making such groups
+    template<typename Handler>
+    void sendUnsegmented(Handler& handler, size_t groupIndex);
+
+    // Holds a single `int` or `uint16_t` control message
+    union ControlBuffer {
+        char data[CMSG_SPACE(sizeof(int))];
+        cmsghdr alignment;
+    };
+
+    int socketDescriptor;
+    int wakeupFd;
+    std::unique_ptr<char[]> buffer;
+    UdpPeer peers[BATCH_SIZE];
+    iovec vectors[BATCH_SIZE];
+    mmsghdr messages[BATCH_SIZE];
+    ControlBuffer receiveControls[BATCH_SIZE];
+    OverloadGuard overloadGuard;
+    BusyPollOptions busyPollOptions;
+    BusyPoller busyPoller;
+
+    // Responses queued during the current wakeup, headers are built when they are sent
+    struct PendingDatagram {
+        UdpPeer peer;
+        size_t firstChunk;
+        size_t numChunks;
+    };
+
+    std::vector<PendingDatagram> pendingDatagrams;
+    std::vector<iovec> pendingChunks;
+    std::vector<mmsghdr> sendingMessages;
+
+    // Consecutive queued datagrams sent with a single message header, the last one may be shorter
+    struct SendingGroup {
+        size_t firstDatagram;
+        size_t numDatagrams;
+        size_t numChunks;
+        size_t segmentSize;
+        size_t lastSize;
+        size_t numBytes;
+    };
+
+    std::vector<SendingGroup> sendingGroups;
+    std::vector<ControlBuffer> sendingControls;
+
+    // Offloads the kernel accepted. Segments larger than `maxGsoSegmentSize` were refused
+    // (exceed path MTU), so runs of them are sent as separate datagrams
+    bool isGsoEnabled = false;
+    bool isGroEnabled = false;
+    size_t maxGsoSegmentSize = MAX_MESSAGE_LENGTH_BYTES;
+    std::vector<std::string> offloadWarnings;
+
+    std::atomic<uint64_t> gsoSegments{ 0 };
+    std::atomic<uint64_t> groSegments{ 0 };
+    std::atomic<uint64_t> syscalls{ 0 };
+};
+
+template<typename Handler>
+void DatagramBackend::wait(Handler& handler) {
+    // 1. Take whatever is already queued. In latency mode spin over non-blocking reads for a while
+
+    resetMessages();
+
+    int numReceived = busyPoller.isEnabled() ? busyPoller.spin([this] { return receiveNow(); }) : receiveNow();
+
+    // 2. Otherwise sleep until a datagram or a wakeup arrives
+
+    if (numReceived == 0) {
+        pollfd descriptors[2] = {
+            { .fd = socketDescriptor, .events = POLLIN, .revents = 0 },
+            { .fd = wakeupFd, .events = POLLIN, .revents = 0 }
+        };
+
+        {
+            TraceSpan span("poll");
+
+            countSyscalls();
+
+            if (poll(descriptors, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    return;
+                }
+
+                throw std::runtime_error("Socket polling failed!");
+            }
+        }
+
+        if (descriptors[1].revents & POLLIN) {
+            countSyscalls();
+            drainEventFd(wakeupFd);
+        }
+
+        if (!(descriptors[0].revents & POLLIN)) {
+            return;
+        }
+
+        numReceived = receiveNow();
+    }
+
+    if (numReceived < 0) {
+        if (Handler::Logger::enabled) {
+            handler.getLogger().log("Cannot read message: ", getError());
+        }
+
+        return;
+    }
+
+    handler.onWakeup();
+
+    dispatch(handler, numReceived);
+}
+
+template<typename Handler>
+void DatagramBackend::drain(Handler& handler) {
+    for (size_t i = 0; i < MAX_DRAIN_BATCHES; ++i) {
+        resetMessages();
+
+        const int numReceived = receiveNow();
+
+        if (numReceived <= 0) {
+            break;
+        }
+
+        dispatch(handler, numReceived);
+    }
+}
+
+template<typename Handler>
+void DatagramBackend::dispatch(Handler& handler, int numReceived) {
+    // Kernel keeps timestamp of the last datagram only, so the whole batch shares its lag
+
+    const Clock::duration lag = overloadGuard.isLagTracked() ? getLastDatagramLag() : Clock::duration::zero();
+
+    for (int i = 0; i < numReceived; ++i) {
+        if (messages[i].msg_len == 0) {
+            handler.getLogger().log("Message is empty");
+            continue;
+        }
+
+        const char *data = static_cast<const char*>(vectors[i].iov_base);
+        const size_t size = messages[i].msg_len;
+        const size_t segmentSize = isGroEnabled ? getGroSegmentSize(messages[i].msg_hdr) : 0;
+
+        if (segmentSize == 0 || segmentSize >= size) {
+            handler.onData(peers[i], data, size, lag);
+            continue;
+        }
+
+        // Coalesced datagrams are all `segmentSize` long, except for the last one
+
+        size_t numSegments = 0;
+
+        for (size_t offset = 0; offset < size; offset += segmentSize, ++numSegments) {
+            handler.onData(peers[i], data + offset, std::min(segmentSize, size - offset), lag);
+        }
+
+        groSegments.fetch_add(numSegments, std::memory_order_relaxed);
+    }
+
+    handler.flush();
+}
+
+template<typename Handler>
+void DatagramBackend::flushSends(Handler& handler) {
+    TraceSpan span("send");
+
+    buildSendingMessages();
+
+    // `sendmmsg` stops at the first failed message. A refused GSO datagram is resent as separate ones,
+    // other failures are reported and skipped
+
+    const size_t numMessages = sendingMessages.size();
+
+    for (size_t i = 0; i < numMessages;) {
+        countSyscalls();
+        const int numSent = sendmmsg(socketDescriptor, &sendingMessages[i], numMessages - i, MSG_DONTWAIT);
+
+        if (numSent > 0) {
+            for (size_t j = i; j < i + numSent; ++j) {
+                if (sendingGroups[j].numDatagrams > 1) {
+                    gsoSegments.fetch_add(sendingGroups[j].numDatagrams, std::memory_order_relaxed);
+                }
+            }
+
+            i += numSent;
+            continue;
+        }
+
+        if (sendingGroups[i].numDatagrams > 1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            sendUnsegmented(handler, i);
+        } else {
+            handler.getLogger().log("Cannot send message to ", pendingDatagrams[sendingGroups[i].firstDatagram].peer);
+        }
+
+        ++i;
+    }
+
+    pendingDatagrams.clear();
+    pendingChunks.clear();
+}
+
+template<typename Handler>
+void DatagramBackend::sendUnsegmented(Handler& handler, size_t groupIndex) {
+    const SendingGroup& group = sendingGroups[groupIndex];
+
+    // Devices without checksum offload refuse GSO entirely, too large segments exceed MTU
+
+    if (errno == EIO) {
+        handler.getLogger().log("UDP GSO is not supported by the device, falling back to separate datagrams");
+        isGsoEnabled = false;
+    } else {
+        handler.getLogger().log("UDP GSO refused ", group.segmentSize, " byte segments: ", getError());
+        maxGsoSegmentSize = std::min(maxGsoSegmentSize, group.segmentSize - 1);
+    }
+
+    for (size_t i = group.firstDatagram; i < group.firstDatagram + group.numDatagrams; ++i) {
+        PendingDatagram& datagram = pendingDatagrams[i];
+
+        msghdr message{};
+        message.msg_name = &datagram.peer.address;
+        message.msg_namelen = sizeof(datagram.peer.address);
+        message.msg_iov = &pendingChunks[datagram.firstChunk];
+        message.msg_iovlen = datagram.numChunks;
+
+        countSyscalls();
+
+        if (sendmsg(socketDescriptor, &message, MSG_DONTWAIT) < 0) {
+            handler.getLogger().log("Cannot send message to ", datagram.peer);
+        }
+    }
+}
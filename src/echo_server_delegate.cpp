@@ -1,54 +1,462 @@
+#include <algorithm>
+#include <utility>
+
 #include "echo_server_delegate.h"
+#include "trace.h"
+
+namespace {
 
-void EchoResult::accumulate(Number number) {
-    numbers.push_back(number);
-    sum += number;
+bool isSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
 }
 
-bool EchoResult::empty() const {
-    return numbers.empty();
+bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Parses leading integer of a token the same way `std::istream >> Number` does: optional sign, at least
+// one digit, trailing garbage is ignored, out of range values are rejected. Never reads past `end`
+bool parseNumber(const char *begin, const char *end, Number& number) {
+    const bool isNegative = *begin == '-';
+
+    if (*begin == '-' || *begin == '+') {
+        ++begin;
+    }
+
+    if (begin == end || !isDigit(*begin)) {
+        return false;
+    }
+
+    const uint64_t limit = isNegative ? uint64_t(1) << 63 : (uint64_t(1) << 63) - 1;
+    uint64_t magnitude = 0;
+
+    for (; begin != end && isDigit(*begin); ++begin) {
+        const uint64_t digit = static_cast<uint64_t>(*begin - '0');
+
+        if (magnitude > (limit - digit) / 10) {
+            return false;
+        }
+
+        magnitude = magnitude * 10 + digit;
+    }
+
+    number = static_cast<Number>(isNegative ? 0 - magnitude : magnitude);
+
+    return true;
 }
 
-std::string EchoResult::toMessage() {
-    if (empty()) {
-        return "";
+void appendNumber(Number number, std::string& message) {
+    char digits[20];
+    size_t numDigits = 0;
+
+    uint64_t magnitude = number < 0 ? 0 - static_cast<uint64_t>(number) : static_cast<uint64_t>(number);
+
+    do {
+        digits[numDigits++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    if (number < 0) {
+        message.push_back('-');
     }
 
-    std::sort(numbers.begin(), numbers.end());
+    while (numDigits > 0) {
+        message.push_back(digits[--numDigits]);
+    }
+}
 
-    std::stringstream ss;
+// Calls `onNumber` for numbers of whitespace separated tokens in `[begin, end)`
+template<typename OnNumber>
+void forEachNumber(const char *begin, const char *end, OnNumber&& onNumber) {
+    for (const char *token = begin; token != end;) {
+        if (isSpace(*token)) {
+            ++token;
+            continue;
+        }
 
-    const size_t numNumbers = numbers.size();
+        const char *tokenEnd = std::find_if(token, end, isSpace);
+        Number number;
 
-    ss << numbers[0];
+        if (parseNumber(token, tokenEnd, number)) {
+            onNumber(number);
+        }
 
-    for (size_t i = 1; i < numNumbers; ++i) {
-        ss << " " << numbers[i];
+        token = tokenEnd;
     }
+}
+
+// Appends numbers of whitespace separated tokens in `[begin, end)` and returns their sum,
+// which wraps on overflow just as the binary protocol does
+uint64_t parseTokens(const char *begin, const char *end, std::vector<Number>& numbers) {
+    uint64_t sum = 0;
+
+    forEachNumber(begin, end, [&](Number number) {
+        numbers.push_back(number);
+        sum += static_cast<uint64_t>(number);
+    });
+
+    return sum;
+}
+
+// Sorted range of numbers
+using Run = std::pair<const Number*, const Number*>;
+
+// Merges sorted `runs` into `out` with a min-heap of their heads
+void mergeRuns(std::vector<Run>& runs, Number *out) {
+    auto isGreater = [](const Run& left, const Run& right) { return *left.first > *right.first; };
 
-    ss << '\n';
+    runs.erase(std::remove_if(runs.begin(), runs.end(), [](const Run& run) { return run.first == run.second; }),
+               runs.end());
+    std::make_heap(runs.begin(), runs.end(), isGreater);
 
-    ss << sum;
+    while (!runs.empty()) {
+        std::pop_heap(runs.begin(), runs.end(), isGreater);
+        Run& run = runs.back();
 
-    return ss.str();
+        *out++ = *run.first++;
+
+        if (run.first == run.second) {
+            runs.pop_back();
+        } else {
+            std::push_heap(runs.begin(), runs.end(), isGreater);
+        }
+    }
+}
+
+} // namespace
+
+EchoServerDelegate::EchoServerDelegate(const EchoParallelOptions& parallelOptions)
+    : minParallelRequestBytes(parallelOptions.minRequestBytes)
+{
+    if (parallelOptions.numThreads > 1) {
+        pool.reset(new ForkJoinPool(parallelOptions.numThreads));
+    }
 }
 
 std::string EchoServerDelegate::process(const std::string &message) noexcept {
-    std::stringstream ss(message);
+    std::vector<Number> numbers;
+    std::string response;
+
+    processRequest({ message.data(), message.size() }, numbers, response);
+
+    return response;
+}
+
+void EchoServerDelegate::processBatch(const RequestView *requests, std::string *responses,
+                                      size_t numRequests) noexcept {
+    std::vector<Number> numbers;
+
+    for (size_t i = 0; i < numRequests; ++i) {
+        processRequest(requests[i], numbers, responses[i]);
+    }
+}
+
+void EchoServerDelegate::processRequest(const RequestView& request, std::vector<Number>& numbers,
+                                        std::string& response) {
+    if (isBinaryMessage(request.data, request.size)) {
+        processBinary(request, numbers, response);
+    } else if (isBinaryProjectionMessage(request.data, request.size)) {
+        processBinaryProjection(request, numbers, response);
+    } else {
+        processText(request, numbers, response);
+    }
+}
+
+void EchoServerDelegate::processText(const RequestView& request, std::vector<Number>& numbers,
+                                     std::string& response) {
+    // 0. Directive may only be the first token
+
+    const char *end = request.data + request.size;
+    const char *directive = std::find_if_not(request.data, end, isSpace);
+    const char *directiveEnd = std::find_if(directive, end, isSpace);
+    Projection projection;
+
+    if (directive != end && *directive == '@' && parseProjection(directive, directiveEnd, projection)) {
+        processTextProjection(request, directiveEnd, projection, numbers, response);
+        return;
+    }
+
+    // 1. Collect numbers from whitespace separated tokens
+
+    uint64_t sum = 0;
+
+    if (!parseAndSortTextInParallel(request, numbers, sum)) {
+        TraceSpan parseSpan("parse");
+
+        numbers.clear();
+        sum = parseTokens(request.data, request.data + request.size, numbers);
+
+        parseSpan.end();
+
+        TraceSpan span("sort");
+        std::sort(numbers.begin(), numbers.end());
+    }
+
+    // 2. Echo requests without numbers, otherwise respond with sorted numbers and their sum
+
+    if (numbers.empty()) {
+        response.assign(request.data, request.size);
+        return;
+    }
+
+    TraceSpan formatSpan("format");
+
+    response.clear();
+
+    for (size_t i = 0; i < numbers.size(); ++i) {
+        if (i > 0) {
+            response.push_back(' ');
+        }
+
+        appendNumber(numbers[i], response);
+    }
+
+    response.push_back('\n');
+    appendNumber(static_cast<Number>(sum), response);
+}
+
+void EchoServerDelegate::processBinary(const RequestView& request, std::vector<Number>& numbers,
+                                       std::string& response) {
+    response.assign(BINARY_MAGIC, BINARY_MAGIC_SIZE);
+
+    const size_t payloadSize = request.size - BINARY_MAGIC_SIZE;
+    const char *payload = request.data + BINARY_MAGIC_SIZE;
+
+    if (payloadSize % sizeof(Number) != 0 || payloadSize / sizeof(Number) > BINARY_MAX_NUMBERS) {
+        // Magic alone reports malformed request
+        return;
+    }
+
+    // Sum is taken straight from the request buffer, numbers are copied once to be sorted
+
+    const size_t numNumbers = payloadSize / sizeof(Number);
+
+    Number sum;
+
+    if (!loadAndSortBinaryInParallel(payload, numNumbers, numbers, sum)) {
+        TraceSpan parseSpan("parse");
+
+        sum = sumNumbers(payload, numNumbers);
+
+        numbers.resize(numNumbers);
+        loadNumbers(payload, numNumbers, numbers.data());
 
-    Number tmp;
+        parseSpan.end();
 
-    EchoResult echoResult;
+        TraceSpan span("sort");
+        std::sort(numbers.begin(), numbers.end());
+    }
+
+    TraceSpan formatSpan("format");
+
+    response.reserve(BINARY_MAGIC_SIZE + (numNumbers + 1) * sizeof(Number));
+    storeNumbers(numbers.data(), numNumbers, response);
+    storeNumbers(&sum, 1, response);
+}
+
+void EchoServerDelegate::processTextProjection(const RequestView& request, const char *numbersBegin,
+                                               const Projection& projection, std::vector<Number>& numbers,
+                                               std::string& response) {
+    // 1. Fold numbers into the projection as they are parsed, only the ones it needs are kept
+
+    TraceSpan parseSpan("parse and project");
+
+    ProjectionAccumulator accumulator(projection, numbers);
+    forEachNumber(numbersBegin, request.data + request.size, [&](Number number) { accumulator.add(number); });
+    accumulator.finish();
+
+    parseSpan.end();
+
+    // 2. Echo requests without results, otherwise respond with them
+
+    if (numbers.empty()) {
+        response.assign(request.data, request.size);
+        return;
+    }
+
+    TraceSpan formatSpan("format");
+
+    response.clear();
+
+    for (size_t i = 0; i < numbers.size(); ++i) {
+        if (i > 0) {
+            response.push_back(' ');
+        }
+
+        appendNumber(numbers[i], response);
+    }
+}
+
+void EchoServerDelegate::processBinaryProjection(const RequestView& request, std::vector<Number>& numbers,
+                                                 std::string& response) {
+    response.assign(BINARY_PROJECTION_MAGIC, BINARY_PROJECTION_MAGIC_SIZE);
+
+    // 1. Validate header and payload, magic alone reports malformed request
 
-    while (!ss.eof()) {
-        std::string tmpString;
+    if (request.size < BINARY_PROJECTION_HEADER_SIZE) {
+        return;
+    }
+
+    const size_t payloadSize = request.size - BINARY_PROJECTION_HEADER_SIZE;
+    const char *payload = request.data + BINARY_PROJECTION_HEADER_SIZE;
+
+    Number header[2];
+    loadNumbers(request.data + BINARY_PROJECTION_MAGIC_SIZE, 2, header);
+
+    const ProjectionKind kind = static_cast<ProjectionKind>(header[0]);
+    const bool hasK = kind == ProjectionKind::Smallest || kind == ProjectionKind::Largest;
+
+    if (header[0] < static_cast<Number>(ProjectionKind::Sum) || header[0] > static_cast<Number>(ProjectionKind::Largest) ||
+        (hasK && (header[1] <= 0 || static_cast<uint64_t>(header[1]) > BINARY_PROJECTION_MAX_RESULTS)) ||
+        payloadSize % sizeof(Number) != 0 || payloadSize / sizeof(Number) > BINARY_PROJECTION_MAX_NUMBERS)
+    {
+        return;
+    }
+
+    const Projection projection{ kind, hasK ? static_cast<size_t>(header[1]) : 0 };
+    const size_t numNumbers = payloadSize / sizeof(Number);
+
+    // 2. Sum and count are read straight from the request, the rest is loaded in small blocks
+
+    TraceSpan parseSpan("parse and project");
+
+    if (kind == ProjectionKind::Sum) {
+        numbers.assign(1, sumNumbers(payload, numNumbers));
+    } else if (kind == ProjectionKind::Count) {
+        numbers.assign(1, static_cast<Number>(numNumbers));
+    } else {
+        static constexpr size_t BLOCK_SIZE = 256;
+        Number block[BLOCK_SIZE];
 
-        ss >> tmpString;
+        ProjectionAccumulator accumulator(projection, numbers);
 
-        if (std::stringstream(tmpString) >> tmp) {
-            echoResult.accumulate(tmp);
+        for (size_t offset = 0; offset < numNumbers; offset += BLOCK_SIZE) {
+            const size_t count = std::min(BLOCK_SIZE, numNumbers - offset);
+            loadNumbers(payload + offset * sizeof(Number), count, block);
+
+            for (size_t i = 0; i < count; ++i) {
+                accumulator.add(block[i]);
+            }
         }
+
+        accumulator.finish();
+    }
+
+    parseSpan.end();
+
+    TraceSpan formatSpan("format");
+
+    const Number numResults = static_cast<Number>(numbers.size());
+
+    response.reserve(BINARY_PROJECTION_MAGIC_SIZE + (numbers.size() + 1) * sizeof(Number));
+    storeNumbers(&numResults, 1, response);
+    storeNumbers(numbers.data(), numbers.size(), response);
+}
+
+bool EchoServerDelegate::parseAndSortTextInParallel(const RequestView& request, std::vector<Number>& numbers,
+                                                    uint64_t& sum) {
+    if (!pool || request.size < minParallelRequestBytes) {
+        return false;
     }
 
-    return echoResult.empty() ? message : echoResult.toMessage();
-}
\ No newline at end of file
+    // 1. Split request at whitespace, so that every token is parsed by exactly one chunk
+
+    const size_t numChunks = pool->getNumThreads();
+    const char *end = request.data + request.size;
+
+    std::vector<const char*> bounds(numChunks + 1, end);
+    bounds[0] = request.data;
+
+    for (size_t i = 1; i < numChunks; ++i) {
+        bounds[i] = std::find_if(std::max(request.data + i * request.size / numChunks, bounds[i - 1]), end, isSpace);
+    }
+
+    // 2. Parse, sum and sort chunks in parallel
+
+    std::vector<std::vector<Number>> chunkNumbers(numChunks);
+    std::vector<uint64_t> chunkSums(numChunks);
+
+    TraceSpan parseSpan("parallel parse and sort");
+
+    const bool isRun = pool->tryRun(numChunks, [&](size_t i) {
+        chunkSums[i] = parseTokens(bounds[i], bounds[i + 1], chunkNumbers[i]);
+        std::sort(chunkNumbers[i].begin(), chunkNumbers[i].end());
+    });
+
+    if (!isRun) {
+        return false;
+    }
+
+    parseSpan.end();
+
+    // 3. Merge sorted chunks
+
+    TraceSpan mergeSpan("merge");
+
+    std::vector<Run> runs;
+    size_t numNumbers = 0;
+    sum = 0;
+
+    for (size_t i = 0; i < numChunks; ++i) {
+        runs.emplace_back(chunkNumbers[i].data(), chunkNumbers[i].data() + chunkNumbers[i].size());
+        numNumbers += chunkNumbers[i].size();
+        sum += chunkSums[i];
+    }
+
+    numbers.resize(numNumbers);
+    mergeRuns(runs, numbers.data());
+
+    return true;
+}
+
+bool EchoServerDelegate::loadAndSortBinaryInParallel(const char *payload, size_t numNumbers,
+                                                     std::vector<Number>& numbers, Number& sum) {
+    if (!pool || numNumbers * sizeof(Number) < minParallelRequestBytes) {
+        return false;
+    }
+
+    // 1. Load, sum and sort equal parts of the payload in parallel
+
+    const size_t numChunks = pool->getNumThreads();
+
+    std::vector<Number> loaded(numNumbers);
+    std::vector<uint64_t> chunkSums(numChunks);
+
+    auto chunkBegin = [&](size_t i) { return i * numNumbers / numChunks; };
+
+    TraceSpan parseSpan("parallel parse and sort");
+
+    const bool isRun = pool->tryRun(numChunks, [&](size_t i) {
+        const size_t begin = chunkBegin(i);
+        const size_t count = chunkBegin(i + 1) - begin;
+
+        chunkSums[i] = static_cast<uint64_t>(sumNumbers(payload + begin * sizeof(Number), count));
+        loadNumbers(payload + begin * sizeof(Number), count, loaded.data() + begin);
+        std::sort(loaded.begin() + begin, loaded.begin() + begin + count);
+    });
+
+    if (!isRun) {
+        return false;
+    }
+
+    parseSpan.end();
+
+    // 2. Merge sorted parts
+
+    TraceSpan mergeSpan("merge");
+
+    std::vector<Run> runs;
+    uint64_t totalSum = 0;
+
+    for (size_t i = 0; i < numChunks; ++i) {
+        runs.emplace_back(loaded.data() + chunkBegin(i), loaded.data() + chunkBegin(i + 1));
+        totalSum += chunkSums[i];
+    }
+
+    numbers.resize(numNumbers);
+    mergeRuns(runs, numbers.data());
+
+    sum = static_cast<Number>(totalSum);
+
+    return true;
+}
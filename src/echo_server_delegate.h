@@ -1,29 +1,62 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 #include <cstdint>
 #include <string>
-#include <algorithm>
-#include <sstream>
 
 #include <socket_demo/server_delegate.h>
 
-using Number = int64_t;
+#include "binary_protocol.h"
+#include "fork_join_pool.h"
+#include "projection.h"
 
-// Auxiliary class for constructing echo messages
-struct EchoResult {
-    void accumulate(Number number);
+// Opt-in parallel processing of large requests: input is split into chunks which are parsed, summed and sorted
+// on `numThreads` threads (including the calling one), then sorted chunks are merged. Responses are identical
+// to the sequential ones
+struct EchoParallelOptions {
+    // Values below 2 disable parallel processing
+    size_t numThreads = 0;
 
-    bool empty() const;
-
-    std::string toMessage();
-
-private:
-    Number sum = 0;
-    std::vector<Number> numbers;
+    // Smaller requests are not worth waking threads up
+    size_t minRequestBytes = 16384;
 };
 
-class EchoServerDelegate: public ServerDelegate {
+// `final` lets statically specialized servers call `process` without virtual dispatch
+class EchoServerDelegate final: public ServerDelegate {
 public:
+    explicit EchoServerDelegate(const EchoParallelOptions& parallelOptions = EchoParallelOptions());
+
+    // Serves both text and binary (see `binary_protocol.h`) requests, full or projected (see `projection.h`)
     std::string process(const std::string& message) noexcept override;
-};
\ No newline at end of file
+
+    // Same as `process`, but the whole batch shares number buffer and writes into response slots in place
+    void processBatch(const RequestView *requests, std::string *responses, size_t numRequests) noexcept override;
+
+private:
+    // `numbers` is scratch space reused between requests
+    void processRequest(const RequestView& request, std::vector<Number>& numbers, std::string& response);
+
+    void processText(const RequestView& request, std::vector<Number>& numbers, std::string& response);
+
+    void processBinary(const RequestView& request, std::vector<Number>& numbers, std::string& response);
+
+    // Projections are computed in a single pass without sorting, so they never take the parallel path.
+    // `numbersBegin` points past the directive token
+    void processTextProjection(const RequestView& request, const char *numbersBegin, const Projection& projection,
+                               std::vector<Number>& numbers, std::string& response);
+
+    void processBinaryProjection(const RequestView& request, std::vector<Number>& numbers, std::string& response);
+
+    // Fill `numbers` with sorted numbers of the request and return their sum. Return false if the request is
+    // too small or the pool is busy with another request, then the caller takes the sequential path
+    bool parseAndSortTextInParallel(const RequestView& request, std::vector<Number>& numbers, uint64_t& sum);
+
+    bool loadAndSortBinaryInParallel(const char *payload, size_t numNumbers, std::vector<Number>& numbers,
+                                     Number& sum);
+
+    size_t minParallelRequestBytes;
+
+    // Exists only if parallel processing is enabled. Thread-safe, so the delegate stays shareable between threads
+    std::unique_ptr<ForkJoinPool> pool;
+};
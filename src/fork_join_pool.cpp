@@ -0,0 +1,86 @@
+#include "fork_join_pool.h"
+
+ForkJoinPool::ForkJoinPool(size_t numThreads) {
+    for (size_t i = 1; i < numThreads; ++i) {
+        workers.emplace_back(&ForkJoinPool::workerLoop, this);
+    }
+}
+
+ForkJoinPool::~ForkJoinPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        isShuttingDown = true;
+    }
+
+    startCondition.notify_all();
+
+    for (auto& worker: workers) {
+        worker.join();
+    }
+}
+
+bool ForkJoinPool::tryRun(size_t jobNumTasks, const std::function<void(size_t)>& jobTask) {
+    std::unique_lock<std::mutex> jobLock(jobMutex, std::try_to_lock);
+
+    if (!jobLock.owns_lock()) {
+        return false;
+    }
+
+    // 1. Publish the job and wake workers up
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        task = &jobTask;
+        numTasks = jobNumTasks;
+        nextTask.store(0, std::memory_order_relaxed);
+        numBusyWorkers = workers.size();
+        ++generation;
+    }
+
+    startCondition.notify_all();
+
+    // 2. Take part in it, then wait for workers to finish their tasks
+
+    runTasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this] { return numBusyWorkers == 0; });
+
+    task = nullptr;
+
+    return true;
+}
+
+void ForkJoinPool::workerLoop() {
+    uint64_t lastGeneration = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            startCondition.wait(lock, [&] { return isShuttingDown || generation != lastGeneration; });
+
+            if (isShuttingDown) {
+                return;
+            }
+
+            lastGeneration = generation;
+        }
+
+        runTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --numBusyWorkers;
+        }
+
+        doneCondition.notify_one();
+    }
+}
+
+void ForkJoinPool::runTasks() {
+    for (size_t i = nextTask.fetch_add(1, std::memory_order_relaxed); i < numTasks;
+         i = nextTask.fetch_add(1, std::memory_order_relaxed)) {
+        (*task)(i);
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+// Fixed set of threads splitting a single job with the calling thread, e.g. one large request.
+// Jobs are never queued: while one thread runs a job, `tryRun` of other threads returns false right away,
+// so callers do the work themselves instead of waiting
+class ForkJoinPool {
+public:
+    // `numThreads` includes the calling thread, i.e. `numThreads - 1` threads are started
+    explicit ForkJoinPool(size_t numThreads);
+
+    ~ForkJoinPool();
+
+    // Forbid copying
+
+    ForkJoinPool(ForkJoinPool&) = delete;
+    ForkJoinPool operator=(ForkJoinPool&) = delete;
+
+    size_t getNumThreads() const { return workers.size() + 1; }
+
+    // Calls `task(i)` for each `i < numTasks` on pool threads and the calling one, returns once all are done.
+    // Thread-safe. Returns false without calling anything if the pool is busy with another job
+    bool tryRun(size_t numTasks, const std::function<void(size_t)>& task);
+
+private:
+    void workerLoop();
+
+    // Takes tasks of the current job until there are none left
+    void runTasks();
+
+    // Held by the thread whose job is running
+    std::mutex jobMutex;
+
+    std::mutex mutex;
+    std::condition_variable startCondition;
+    std::condition_variable doneCondition;
+    uint64_t generation = 0;
+    size_t numBusyWorkers = 0;
+    bool isShuttingDown = false;
+
+    const std::function<void(size_t)> *task = nullptr;
+    size_t numTasks = 0;
+    std::atomic<size_t> nextTask{ 0 };
+
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,139 @@
+#include <algorithm>
+
+#include "loop_monitor.h"
+#include "server_policies.h"
+
+const char *getLoopPhaseName(LoopPhase phase) {
+    switch (phase) {
+        case LoopPhase::Idle:
+            return "idle";
+        case LoopPhase::Receive:
+            return "receive";
+        case LoopPhase::Process:
+            return "process";
+        case LoopPhase::Send:
+            return "send";
+    }
+
+    return "unknown";
+}
+
+void LoopMonitor::endBusy() {
+    if (!isBusy) {
+        return;
+    }
+
+    isBusy = false;
+    setPhase(LoopPhase::Idle);
+    store(busySinceNs, 0);
+
+    const Clock::duration duration = Clock::now() - busyStart;
+    const uint64_t microseconds = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+
+    store(busyMicroseconds, busyMicroseconds.load(std::memory_order_relaxed) + microseconds);
+    store(maxIterationMicroseconds, std::max(maxIterationMicroseconds.load(std::memory_order_relaxed), microseconds));
+    addToHistogram(iterationHistogram, duration);
+}
+
+void LoopMonitor::addProcessTime(Clock::duration duration) {
+    const uint64_t microseconds = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+
+    store(processMicroseconds, processMicroseconds.load(std::memory_order_relaxed) + microseconds);
+    addToHistogram(processHistogram, duration);
+}
+
+void LoopMonitor::addToHistogram(std::atomic<uint64_t> (&histogram)[LOOP_HISTOGRAM_BUCKETS],
+                                 Clock::duration duration) {
+    uint64_t microseconds = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    size_t bucket = 0;
+
+    while (microseconds > 0 && bucket + 1 < LOOP_HISTOGRAM_BUCKETS) {
+        microseconds >>= 1;
+        ++bucket;
+    }
+
+    store(histogram[bucket], histogram[bucket].load(std::memory_order_relaxed) + 1);
+}
+
+void LoopMonitor::fillStats(ServerStats& stats) const {
+    stats.loopWakeups = wakeups.load(std::memory_order_relaxed);
+    stats.loopRequests = requests.load(std::memory_order_relaxed);
+    stats.loopBusyMicroseconds = busyMicroseconds.load(std::memory_order_relaxed);
+    stats.loopProcessMicroseconds = processMicroseconds.load(std::memory_order_relaxed);
+    stats.loopMaxIterationMicroseconds = maxIterationMicroseconds.load(std::memory_order_relaxed);
+    stats.loopStalls = stalls.load(std::memory_order_relaxed);
+
+    for (size_t i = 0; i < LOOP_HISTOGRAM_BUCKETS; ++i) {
+        stats.loopIterationHistogram[i] = iterationHistogram[i].load(std::memory_order_relaxed);
+        stats.loopProcessHistogram[i] = processHistogram[i].load(std::memory_order_relaxed);
+    }
+}
+
+bool LoopMonitor::checkStall(Clock::duration threshold, Clock::duration& busyFor, LoopPhase& stallPhase,
+                             uint64_t& peer) {
+    // Iteration is read before and after the rest, so that fields of two different iterations are not mixed
+
+    const uint64_t currentIteration = iteration.load(std::memory_order_relaxed);
+    const uint64_t since = busySinceNs.load(std::memory_order_relaxed);
+
+    stallPhase = static_cast<LoopPhase>(phase.load(std::memory_order_relaxed));
+    peer = activePeer.load(std::memory_order_relaxed);
+
+    if (since == 0 || currentIteration == lastStalledIteration ||
+        currentIteration != iteration.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    const uint64_t now = toNanoseconds(Clock::now());
+    busyFor = std::chrono::nanoseconds(now > since ? now - since : 0);
+
+    if (busyFor <= threshold) {
+        return false;
+    }
+
+    lastStalledIteration = currentIteration;
+    store(stalls, stalls.load(std::memory_order_relaxed) + 1);
+
+    return true;
+}
+
+LoopWatchdog::LoopWatchdog(LoopMonitor& monitor, std::chrono::milliseconds threshold, std::ostream& logStream)
+    : monitor(monitor), threshold(threshold), logStream(logStream), thread(&LoopWatchdog::watch, this)
+{}
+
+LoopWatchdog::~LoopWatchdog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        isStopped = true;
+    }
+
+    condition.notify_all();
+    thread.join();
+}
+
+void LoopWatchdog::watch() {
+    // Checking twice per threshold notices a stall at most 1.5 thresholds after it started
+
+    const std::chrono::milliseconds period = std::max(threshold / 2, std::chrono::milliseconds(1));
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!condition.wait_for(lock, period, [this] { return isStopped; })) {
+        LoopMonitor::Clock::duration busyFor;
+        LoopPhase phase;
+        uint64_t peer;
+
+        if (!monitor.checkStall(threshold, busyFor, phase, peer)) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> streamLock(getStreamMutex(logStream));
+
+        logStream << "Event loop stalled: busy for "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(busyFor).count() << " ms in "
+                  << getLoopPhaseName(phase) << " phase, last peer " << peer << std::endl;
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <ostream>
+#include <condition_variable>
+
+#include <socket_demo/server_stats.h>
+
+// Event loop accounting. Busy part of an iteration starts once the loop wakes up with work and ends when the loop
+// goes back to waiting; it goes through receive (accept, reads, admission), process (delegate) and send phases.
+// Loop thread writes everything with relaxed atomics, so that `fillStats` and the watchdog may read it any time
+enum class LoopPhase: uint8_t {
+    Idle,
+    Receive,
+    Process,
+    Send
+};
+
+const char *getLoopPhaseName(LoopPhase phase);
+
+class LoopMonitor {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Loop thread
+
+    // No-op if the iteration is busy already
+    void beginBusy() {
+        if (isBusy) {
+            return;
+        }
+
+        isBusy = true;
+        busyStart = Clock::now();
+        store(iteration, iteration.load(std::memory_order_relaxed) + 1);
+        store(busySinceNs, toNanoseconds(busyStart));
+        store(wakeups, wakeups.load(std::memory_order_relaxed) + 1);
+        setPhase(LoopPhase::Receive);
+    }
+
+    void endBusy();
+
+    void setPhase(LoopPhase value) {
+        phase.store(static_cast<uint8_t>(value), std::memory_order_relaxed);
+    }
+
+    // Peer of the message being received, as backend's `getCapturePeer` identifies it (number of stream connections).
+    // During process and send phases it is the last peer of the batch
+    void setActivePeer(uint64_t peer) {
+        activePeer.store(peer, std::memory_order_relaxed);
+    }
+
+    void addRequests(uint64_t count) {
+        store(requests, requests.load(std::memory_order_relaxed) + count);
+    }
+
+    void addProcessTime(Clock::duration duration);
+
+    // Any thread
+
+    void fillStats(ServerStats& stats) const;
+
+    // Watchdog
+
+    // Returns true if the loop has been busy with the same iteration for longer than `threshold`
+    // and this iteration has not been reported yet
+    bool checkStall(Clock::duration threshold, Clock::duration& busyFor, LoopPhase& stallPhase, uint64_t& peer);
+
+private:
+    static uint64_t toNanoseconds(Clock::time_point time) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+    }
+
+    // Single writer, so read-modify-write is not needed
+    static void store(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(value, std::memory_order_relaxed);
+    }
+
+    static void addToHistogram(std::atomic<uint64_t> (&histogram)[LOOP_HISTOGRAM_BUCKETS], Clock::duration duration);
+
+    // Loop thread only
+    bool isBusy = false;
+    Clock::time_point busyStart;
+
+    std::atomic<uint64_t> iteration{ 0 };
+    std::atomic<uint64_t> busySinceNs{ 0 };
+    std::atomic<uint8_t> phase{ static_cast<uint8_t>(LoopPhase::Idle) };
+    std::atomic<uint64_t> activePeer{ 0 };
+
+    std::atomic<uint64_t> wakeups{ 0 };
+    std::atomic<uint64_t> requests{ 0 };
+    std::atomic<uint64_t> busyMicroseconds{ 0 };
+    std::atomic<uint64_t> processMicroseconds{ 0 };
+    std::atomic<uint64_t> maxIterationMicroseconds{ 0 };
+    std::atomic<uint64_t> iterationHistogram[LOOP_HISTOGRAM_BUCKETS] = {};
+    std::atomic<uint64_t> processHistogram[LOOP_HISTOGRAM_BUCKETS] = {};
+
+    // Watchdog only
+    uint64_t lastStalledIteration = 0;
+    std::atomic<uint64_t> stalls{ 0 };
+};
+
+// Thread checking that the loop does not stay busy longer than `threshold`. Every stalled iteration is logged
+// once, with the phase and the peer active when it was noticed, and counted in `ServerStats::loopStalls`.
+// The loop keeps running, so a stall is reported while it still lasts. Records are written under
+// `getStreamMutex` of `logStream`, just as `StreamLogger` writes them
+class LoopWatchdog {
+public:
+    LoopWatchdog(LoopMonitor& monitor, std::chrono::milliseconds threshold, std::ostream& logStream);
+
+    ~LoopWatchdog();
+
+    // Forbid copying
+
+    LoopWatchdog(LoopWatchdog&) = delete;
+    LoopWatchdog operator=(LoopWatchdog&) = delete;
+
+private:
+    void watch();
+
+    LoopMonitor& monitor;
+    std::chrono::milliseconds threshold;
+    std::ostream& logStream;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool isStopped = false;
+    std::thread thread;
+};
@@ -0,0 +1,240 @@
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "loopback_backend.h"
+
+namespace {
+
+// Listeners by name. Entries are removed by listener destructors, so pointers are always valid
+std::mutex listenersMutex;
+std::unordered_map<std::string, std::weak_ptr<LoopbackListener>> listeners;
+
+} // namespace
+
+LoopbackConnection::LoopbackConnection(uint32_t numSlots) {
+    // Ring headers keep positions on separate cache lines, so memory is cache line aligned
+
+    if (posix_memalign(&memory, 64, shmSegmentSize(numSlots)) != 0) {
+        throw std::runtime_error("Cannot allocate loopback rings");
+    }
+
+    requests = shmRequestRing(memory, numSlots);
+    responses = shmResponseRing(memory, numSlots);
+    requests.init();
+    responses.init();
+
+    requestEventFd = createEventFd();
+
+    try {
+        responseEventFd = createEventFd();
+    } catch (...) {
+        close(requestEventFd);
+        std::free(memory);
+        throw;
+    }
+}
+
+LoopbackConnection::~LoopbackConnection() {
+    close(requestEventFd);
+    close(responseEventFd);
+    std::free(memory);
+}
+
+LoopbackListener::LoopbackListener(const std::string& name, uint32_t numSlotsPerRing)
+    : name(name), numSlotsPerRing(numSlotsPerRing), eventFd(createEventFd())
+{}
+
+std::shared_ptr<LoopbackListener> LoopbackListener::create(const std::string& name, uint32_t numSlotsPerRing) {
+    if (numSlotsPerRing == 0) {
+        throw std::invalid_argument("Number of ring slots should be a positive value");
+    }
+
+    std::shared_ptr<LoopbackListener> listener(new LoopbackListener(name, numSlotsPerRing));
+
+    std::lock_guard<std::mutex> lock(listenersMutex);
+
+    if (!listeners[name].expired()) {
+        throw std::invalid_argument("Loopback name is already in use: " + name);
+    }
+
+    listeners[name] = listener;
+
+    return listener;
+}
+
+std::shared_ptr<LoopbackConnection> LoopbackListener::connect(const std::string& name) {
+    std::shared_ptr<LoopbackListener> listener;
+
+    {
+        std::lock_guard<std::mutex> lock(listenersMutex);
+        auto it = listeners.find(name);
+
+        if (it != listeners.end()) {
+            listener = it->second.lock();
+        }
+    }
+
+    if (!listener) {
+        throw std::invalid_argument("Connection failed: no loopback server " + name);
+    }
+
+    std::shared_ptr<LoopbackConnection> connection = std::make_shared<LoopbackConnection>(listener->numSlotsPerRing);
+
+    {
+        std::lock_guard<std::mutex> lock(listener->mutex);
+
+        if (listener->isClosed) {
+            throw std::invalid_argument("Connection failed: loopback server " + name + " is closed");
+        }
+
+        listener->pending.push_back(connection);
+        listener->numPending.store(listener->pending.size(), std::memory_order_release);
+    }
+
+    notifyEventFd(listener->eventFd);
+
+    return connection;
+}
+
+void LoopbackListener::takePending(std::vector<std::shared_ptr<LoopbackConnection>>& connections) {
+    drainEventFd(eventFd);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    connections.insert(connections.end(), pending.begin(), pending.end());
+    pending.clear();
+    numPending.store(0, std::memory_order_release);
+}
+
+void LoopbackListener::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    isClosed = true;
+
+    for (const auto& connection: pending) {
+        connection->isServerClosed.store(true, std::memory_order_release);
+        notifyEventFd(connection->responseEventFd);
+    }
+
+    pending.clear();
+    numPending.store(0, std::memory_order_release);
+}
+
+LoopbackListener::~LoopbackListener() {
+    close();
+
+    {
+        std::lock_guard<std::mutex> lock(listenersMutex);
+        auto it = listeners.find(name);
+
+        if (it != listeners.end() && it->second.expired()) {
+            listeners.erase(it);
+        }
+    }
+
+    ::close(eventFd);
+}
+
+LoopbackBackend::LoopbackBackend(std::shared_ptr<LoopbackListener> listener, const OverloadLimits& limits,
+                                 const BusyPollOptions& busyPollOptions)
+    : listener(std::move(listener)), wakeupFd(createEventFd()), overloadGuard(limits),
+      busyPollOptions(busyPollOptions), busyPoller(busyPollOptions)
+{}
+
+LoopbackBackend::~LoopbackBackend() {
+    shutdown();
+    close(wakeupFd);
+}
+
+void LoopbackBackend::queue(Endpoint id, const iovec *chunks, size_t numChunks) {
+    auto it = connections.find(id);
+
+    if (it == connections.end()) {
+        return;
+    }
+
+    // `receive` takes no more requests than there are free response slots, so only a corrupted ring is full
+
+    ShmSlot *slot = it->second.shared->responses.reserve();
+
+    if (!slot) {
+        throw std::logic_error("Loopback response ring is full");
+    }
+
+    // `ServerCore` has truncated response already
+
+    slot->length = 0;
+
+    for (size_t i = 0; i < numChunks; ++i) {
+        std::memcpy(slot->data + slot->length, chunks[i].iov_base, chunks[i].iov_len);
+        slot->length += static_cast<uint32_t>(chunks[i].iov_len);
+    }
+
+    if (it->second.shared->responses.publish() && !it->second.needsWakeup) {
+        it->second.needsWakeup = true;
+        pendingWakeups.push_back(id);
+    }
+}
+
+void LoopbackBackend::sleep() {
+    // 1. Raise waiting flags, so that clients kick request eventfds. Messages published meanwhile cancel sleeping
+
+    bool canSleep = !listener->hasPending();
+    bool hasBlocked = false;
+
+    for (auto& entry: connections) {
+        if (entry.second.isBlocked) {
+            hasBlocked = true;
+        } else {
+            canSleep = canSleep && entry.second.shared->requests.prepareToSleep();
+        }
+    }
+
+    // 2. Wait for a kick, a new connection or a wakeup
+
+    if (canSleep) {
+        descriptors.clear();
+        descriptors.push_back({ .fd = listener->getEventFd(), .events = POLLIN, .revents = 0 });
+        descriptors.push_back({ .fd = wakeupFd, .events = POLLIN, .revents = 0 });
+
+        for (const auto& entry: connections) {
+            descriptors.push_back({ .fd = entry.second.shared->requestEventFd, .events = POLLIN, .revents = 0 });
+        }
+
+        syscalls.store(syscalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        if (poll(descriptors.data(), descriptors.size(), hasBlocked ? 1 : -1) < 0 && errno != EINTR) {
+            throw std::runtime_error("Loopback polling failed: " + getError());
+        }
+
+        // Listener eventfd is drained when pending connections are taken
+
+        for (size_t i = 1; i < descriptors.size(); ++i) {
+            if (descriptors[i].revents & POLLIN) {
+                drainEventFd(descriptors[i].fd);
+            }
+        }
+    }
+
+    for (auto& entry: connections) {
+        entry.second.shared->requests.wakeUp();
+    }
+}
+
+void LoopbackBackend::closeConnection(Endpoint id, Connection& connection) {
+    overloadGuard.releaseConnection(id);
+
+    connection.shared->isServerClosed.store(true, std::memory_order_release);
+    notifyEventFd(connection.shared->responseEventFd);
+}
+
+void LoopbackBackend::shutdown() {
+    listener->close();
+
+    for (auto& entry: connections) {
+        closeConnection(entry.first, entry.second);
+    }
+
+    connections.clear();
+}
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <poll.h>
+#include <sys/uio.h>
+
+#include <socket_demo/defines.h>
+#include <socket_demo/server_stats.h>
+
+#include "busy_poll.h"
+#include "overload_guard.h"
+#include "shm_ring.h"
+#include "trace.h"
+#include "utils.h"
+
+// In-process transport: client and server exchange messages through a pair of lock-free rings
+// (the same single-producer single-consumer rings shared memory transport uses, placed on the heap).
+// There are no sockets at all, eventfds are kicked only when the other side sleeps. It exists to measure
+// what the request path costs without the kernel network stack
+
+// Rings and wakeups of a single client, shared by the client and the server
+struct LoopbackConnection {
+    explicit LoopbackConnection(uint32_t numSlots);
+
+    ~LoopbackConnection();
+
+    // Forbid copying
+
+    LoopbackConnection(LoopbackConnection&) = delete;
+    LoopbackConnection operator=(LoopbackConnection&) = delete;
+
+    void *memory = nullptr;
+    ShmRing requests;
+    ShmRing responses;
+    int requestEventFd;
+    int responseEventFd;
+
+    // Set by the side going away, which kicks eventfd of the other one after that
+    std::atomic<bool> isClientClosed{ false };
+    std::atomic<bool> isServerClosed{ false };
+};
+
+// Named in-process endpoint clients connect to, counterpart of a listening socket.
+// Listeners are registered process-wide by name while they exist
+class LoopbackListener {
+public:
+    // Throws if the name is taken
+    static std::shared_ptr<LoopbackListener> create(const std::string& name, uint32_t numSlotsPerRing);
+
+    // Creates connection and hands it over to the listener. Throws if there is no listener with this name
+    static std::shared_ptr<LoopbackConnection> connect(const std::string& name);
+
+    ~LoopbackListener();
+
+    // Forbid copying
+
+    LoopbackListener(LoopbackListener&) = delete;
+    LoopbackListener operator=(LoopbackListener&) = delete;
+
+    bool hasPending() const { return numPending.load(std::memory_order_acquire) != 0; }
+
+    // Takes connections established since the last call
+    void takePending(std::vector<std::shared_ptr<LoopbackConnection>>& connections);
+
+    // Stops taking new connections, pending ones are closed
+    void close();
+
+    // Readable while there are pending connections
+    int getEventFd() const { return eventFd; }
+
+    const std::string& getName() const { return name; }
+
+private:
+    LoopbackListener(const std::string& name, uint32_t numSlotsPerRing);
+
+    std::string name;
+    uint32_t numSlotsPerRing;
+    int eventFd;
+
+    std::mutex mutex;
+    bool isClosed = false;
+    std::vector<std::shared_ptr<LoopbackConnection>> pending;
+    std::atomic<size_t> numPending{ 0 };
+};
+
+// `ServerCore` backend serving connections of a loopback listener. Rings are drained without syscalls,
+// backend spins over them in latency mode and then sleeps on eventfds just as the shared memory server does
+class LoopbackBackend {
+public:
+    // Connection number, counted from 1
+    using Endpoint = int;
+
+    static constexpr bool repliesToRejected = true;
+
+    LoopbackBackend(std::shared_ptr<LoopbackListener> listener, const OverloadLimits& limits,
+                    const BusyPollOptions& busyPollOptions = BusyPollOptions());
+
+    ~LoopbackBackend();
+
+    // Forbid copying
+
+    LoopbackBackend(LoopbackBackend&) = delete;
+    LoopbackBackend operator=(LoopbackBackend&) = delete;
+
+    template<typename Handler>
+    void start(Handler& handler) {
+        const std::string pinError = pinCurrentThread(busyPollOptions);
+
+        if (!pinError.empty()) {
+            handler.getLogger().log("Event loop thread is not pinned: ", pinError);
+        }
+    }
+
+    template<typename Handler>
+    void wait(Handler& handler);
+
+    template<typename Handler>
+    void drain(Handler& handler);
+
+    void wakeUp() {
+        notifyEventFd(wakeupFd);
+    }
+
+    // Writes response into the response ring right away, the client is woken up by `flushSends`
+    void queue(Endpoint id, const iovec *chunks, size_t numChunks);
+
+    template<typename Handler>
+    void flushSends(Handler& handler);
+
+    // Responses are copied into rings by `queue`
+    void retainResponses(std::vector<std::string>&) {}
+
+    OverloadGuard::Verdict admit(Endpoint id, size_t size, Clock::duration lag, size_t numRequests) {
+        return overloadGuard.admitConnectionRequest(id, size, lag, numRequests);
+    }
+
+    const OverloadGuard& getOverloadGuard() const { return overloadGuard; }
+
+    // Connection numbers are not reused
+    uint64_t getCapturePeer(Endpoint id) const {
+        return static_cast<uint64_t>(id);
+    }
+
+    void fillStats(ServerStats& stats) const {
+        overloadGuard.fillStats(stats);
+        busyPoller.fillStats(stats);
+        stats.loopSyscalls = syscalls.load(std::memory_order_relaxed);
+    }
+
+    // Closes listener and all connections
+    void shutdown();
+
+private:
+    struct Connection {
+        std::shared_ptr<LoopbackConnection> shared;
+
+        // Client sleeps and has to be kicked once responses are flushed
+        bool needsWakeup;
+
+        // Requests wait for the client to free response slots
+        bool isBlocked;
+    };
+
+    // Takes new connections and reports whatever rings hold. Returns number of received messages
+    template<typename Handler>
+    int receive(Handler& handler);
+
+    // Sleeps on eventfds unless some ring got a message after the last check. Clients free response slots
+    // without kicking anything, so blocked connections are checked again after a millisecond
+    void sleep();
+
+    void closeConnection(Endpoint id, Connection& connection);
+
+    std::shared_ptr<LoopbackListener> listener;
+    std::unordered_map<Endpoint, Connection> connections;
+    Endpoint lastId = 0;
+    int wakeupFd;
+
+    OverloadGuard overloadGuard;
+    BusyPollOptions busyPollOptions;
+    BusyPoller busyPoller;
+
+    std::vector<std::shared_ptr<LoopbackConnection>> accepted;
+    std::vector<pollfd> descriptors;
+    std::vector<Endpoint> closedIds;
+    std::vector<Endpoint> pendingWakeups;
+
+    // Rings need no syscalls, only sleeping and waking clients up take them. Event loop thread is the only writer
+    std::atomic<uint64_t> syscalls{ 0 };
+};
+
+template<typename Handler>
+void LoopbackBackend::wait(Handler& handler) {
+    // 1. Serve rings, in latency mode keep checking them for a while
+
+    int numReceived = receive(handler);
+
+    if (numReceived == 0 && busyPoller.isEnabled()) {
+        numReceived = busyPoller.spin([&] { return receive(handler); });
+    }
+
+    // 2. Sleep only if there was nothing to do
+
+    if (numReceived == 0) {
+        TraceSpan span("poll");
+        sleep();
+        return;
+    }
+
+    handler.flush();
+}
+
+template<typename Handler>
+void LoopbackBackend::drain(Handler& handler) {
+    listener->close();
+
+    if (receive(handler) > 0) {
+        handler.flush();
+    }
+
+    for (auto& entry: connections) {
+        handler.getLogger().log("Closed connection: ", entry.first);
+        handler.onClose(entry.first);
+        closeConnection(entry.first, entry.second);
+    }
+
+    connections.clear();
+}
+
+template<typename Handler>
+int LoopbackBackend::receive(Handler& handler) {
+    // 1. Take new connections
+
+    if (listener->hasPending()) {
+        accepted.clear();
+        listener->takePending(accepted);
+
+        for (auto& shared: accepted) {
+            const Endpoint id = ++lastId;
+
+            if (!overloadGuard.admitConnection(id, 0)) {
+                handler.getLogger().log("Rejected connection because of connection caps");
+                shared->isServerClosed.store(true, std::memory_order_release);
+                notifyEventFd(shared->responseEventFd);
+                continue;
+            }
+
+            handler.getLogger().log("Accepted connection: ", id);
+            connections.emplace(id, Connection{ std::move(shared), false, false });
+        }
+    }
+
+    // 2. Report messages, at most a ring worth per connection so that a busy client does not starve others.
+    // Every message gets a response queued by the next flush, so no more of them are taken than there are free
+    // response slots. The rest stay in the ring, and the client waits for free request slots. `ServerCore` copies
+    // taken messages, so their slots are released right away
+
+    // Messages wait while connections before them are reported, so lag is counted from the start
+    // of the pass, just as stream backend counts it from the wakeup
+
+    const Clock::time_point passStart = overloadGuard.isLagTracked() ? Clock::now() : Clock::time_point();
+
+    int numReceived = 0;
+    closedIds.clear();
+
+    for (auto& entry: connections) {
+        ShmRing& requests = entry.second.shared->requests;
+        const uint64_t maxTaken = entry.second.shared->responses.getNumFree();
+        uint64_t numTaken = 0;
+
+        entry.second.isBlocked = maxTaken == 0 && requests.peek() != nullptr;
+
+        for (; numTaken < maxTaken; ++numTaken) {
+            const ShmSlot *request = requests.peek(numTaken);
+
+            if (!request) {
+                break;
+            }
+
+            const size_t length = std::min<size_t>(request->length, MAX_MESSAGE_LENGTH_BYTES);
+
+            const Clock::duration lag =
+                overloadGuard.isLagTracked() ? Clock::now() - passStart : Clock::duration::zero();
+
+            handler.onData(entry.first, request->data, length, lag);
+        }
+
+        if (numTaken > 0) {
+            requests.release(numTaken);
+            numReceived += static_cast<int>(numTaken);
+        } else if (entry.second.shared->isClientClosed.load(std::memory_order_acquire)) {
+            closedIds.push_back(entry.first);
+        }
+    }
+
+    // 3. Forget connections which clients have closed
+
+    for (const Endpoint id: closedIds) {
+        handler.getLogger().log("Disconnected ", id);
+        handler.onClose(id);
+
+        auto it = connections.find(id);
+        closeConnection(id, it->second);
+        connections.erase(it);
+    }
+
+    return numReceived;
+}
+
+template<typename Handler>
+void LoopbackBackend::flushSends(Handler&) {
+    for (const Endpoint id: pendingWakeups) {
+        auto it = connections.find(id);
+
+        if (it != connections.end() && it->second.needsWakeup) {
+            it->second.needsWakeup = false;
+            syscalls.store(syscalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            notifyEventFd(it->second.shared->responseEventFd);
+        }
+    }
+
+    pendingWakeups.clear();
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "overload_guard.h"
+
+// Peer table size after which idle peers are evicted
+static constexpr size_t MAX_TRACKED_PEERS = 65536;
+
+TokenBucket::TokenBucket(double rate, double capacity, Clock::time_point now)
+    : rate(rate), capacity(capacity > 0 ? capacity : rate), tokens(this->capacity), lastRefill(now)
+{}
+
+void TokenBucket::refill(Clock::time_point now) {
+    const double elapsedSeconds = std::chrono::duration<double>(now - lastRefill).count();
+
+    if (elapsedSeconds > 0) {
+        tokens = std::min(capacity, tokens + elapsedSeconds * rate);
+        lastRefill = now;
+    }
+}
+
+bool TokenBucket::consume(double amount, Clock::time_point now) {
+    if (rate <= 0) {
+        // Disabled bucket
+        return true;
+    }
+
+    refill(now);
+
+    if (tokens < amount) {
+        return false;
+    }
+
+    tokens -= amount;
+
+    return true;
+}
+
+bool TokenBucket::isFull(Clock::time_point now) const {
+    if (rate <= 0) {
+        return true;
+    }
+
+    const double elapsedSeconds = std::chrono::duration<double>(now - lastRefill).count();
+
+    return tokens + elapsedSeconds * rate >= capacity;
+}
+
+OverloadGuard::PeerState::PeerState(const OverloadLimits& limits, Clock::time_point now)
+    : requests(limits.requestsPerSecond, limits.requestsBurst, now),
+      bytes(limits.bytesPerSecond, limits.bytesBurst, now)
+{}
+
+OverloadGuard::OverloadGuard(const OverloadLimits& limits)
+    : limits(limits), rateLimited(limits.requestsPerSecond > 0 || limits.bytesPerSecond > 0)
+{
+    if (limits.requestsPerSecond < 0 || limits.bytesPerSecond < 0 ||
+        limits.requestsBurst < 0 || limits.bytesBurst < 0 || limits.maxLoopLagMs < 0)
+    {
+        throw std::invalid_argument("Overload limits should be non-negative values");
+    }
+}
+
+OverloadGuard::PeerState& OverloadGuard::getPeer(uint32_t peerKey, Clock::time_point now) {
+    auto it = peers.find(peerKey);
+
+    if (it != peers.end()) {
+        return it->second;
+    }
+
+    if (peers.size() >= MAX_TRACKED_PEERS) {
+        evictIdlePeers(now);
+    }
+
+    return peers.emplace(peerKey, PeerState(limits, now)).first->second;
+}
+
+void OverloadGuard::evictIdlePeers(Clock::time_point now) {
+    for (auto it = peers.begin(); it != peers.end();) {
+        const PeerState& peer = it->second;
+
+        if (peer.numConnections == 0 && peer.requests.isFull(now) && peer.bytes.isFull(now)) {
+            it = peers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool OverloadGuard::admitConnection(int fd, uint32_t peerKey) {
+    if (limits.maxConnections > 0 && connectionPeers.size() >= limits.maxConnections) {
+        rejectedConnections.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    PeerState& peer = getPeer(peerKey, Clock::now());
+
+    if (limits.maxConnectionsPerIp > 0 && peer.numConnections >= limits.maxConnectionsPerIp) {
+        rejectedConnections.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    ++peer.numConnections;
+    connectionPeers[fd] = peerKey;
+
+    return true;
+}
+
+void OverloadGuard::releaseConnection(int fd) {
+    auto it = connectionPeers.find(fd);
+
+    if (it == connectionPeers.end()) {
+        return;
+    }
+
+    auto peerIt = peers.find(it->second);
+
+    if (peerIt != peers.end() && peerIt->second.numConnections > 0) {
+        --peerIt->second.numConnections;
+    }
+
+    connectionPeers.erase(it);
+}
+
+OverloadGuard::Verdict OverloadGuard::admitRequest(uint32_t peerKey, size_t numBytes, Clock::duration lag,
+                                                   size_t numRequests) {
+    // 1. Shedding is checked first, since it is the cheapest one
+
+    if (limits.maxLoopLagMs > 0 && lag > std::chrono::milliseconds(limits.maxLoopLagMs)) {
+        shedRequests.fetch_add(numRequests, std::memory_order_relaxed);
+        return Verdict::Shed;
+    }
+
+    if (!rateLimited) {
+        return Verdict::Accept;
+    }
+
+    // 2. Check peer rates. Byte tokens are not taken if request is already rejected
+
+    const Clock::time_point now = Clock::now();
+    PeerState& peer = getPeer(peerKey, now);
+
+    if (!peer.requests.consume(static_cast<double>(numRequests), now) ||
+        !peer.bytes.consume(static_cast<double>(numBytes), now)) {
+        rejectedRequests.fetch_add(numRequests, std::memory_order_relaxed);
+        rejectedBytes.fetch_add(numBytes, std::memory_order_relaxed);
+        return Verdict::RateLimited;
+    }
+
+    return Verdict::Accept;
+}
+
+OverloadGuard::Verdict OverloadGuard::admitConnectionRequest(int fd, size_t numBytes, Clock::duration lag,
+                                                             size_t numRequests) {
+    auto it = connectionPeers.find(fd);
+
+    return admitRequest(it == connectionPeers.end() ? 0 : it->second, numBytes, lag, numRequests);
+}
+
+void OverloadGuard::fillStats(ServerStats& stats) const {
+    stats.rejectedConnections = rejectedConnections.load(std::memory_order_relaxed);
+    stats.rejectedRequests = rejectedRequests.load(std::memory_order_relaxed);
+    stats.rejectedBytes = rejectedBytes.load(std::memory_order_relaxed);
+    stats.shedRequests = shedRequests.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include <socket_demo/server_stats.h>
+
+using Clock = std::chrono::steady_clock;
+
+// Admission control limits. Zero value disables the corresponding limit.
+// Peer is identified by IPv4 address, or by user id for unix sockets
+struct OverloadLimits {
+    // Maximum number of simultaneously opened connections (connection-oriented servers only)
+    size_t maxConnections = 0;
+
+    // Same, but for connections from a single peer
+    size_t maxConnectionsPerIp = 0;
+
+    // Sustained requests rate allowed per peer and the size of the burst above it
+    double requestsPerSecond = 0;
+    double requestsBurst = 0;
+
+    // Sustained payload bytes rate allowed per peer and the size of the burst above it
+    double bytesPerSecond = 0;
+    double bytesBurst = 0;
+
+    // Event loop lag after which requests are shed before reaching the delegate
+    long maxLoopLagMs = 0;
+
+    // Response sent to connection-oriented clients whose request was rejected; empty means silent drop.
+    // UDP requests are always dropped silently, since answering a flood amplifies it
+    std::string rejectMessage = "Server is busy, try again later";
+};
+
+// Classic token bucket: `rate` tokens per second are added up to `capacity`
+class TokenBucket {
+public:
+    TokenBucket(double rate, double capacity, Clock::time_point now);
+
+    // Takes `amount` tokens if available
+    bool consume(double amount, Clock::time_point now);
+
+    // True if the bucket has been refilled completely, i.e. carries no state worth keeping
+    bool isFull(Clock::time_point now) const;
+
+private:
+    void refill(Clock::time_point now);
+
+    double rate;
+    double capacity;
+    double tokens;
+    Clock::time_point lastRefill;
+};
+
+// Tracks per-peer state and decides whether a connection or a request should be admitted.
+// Not thread safe, except `stats()` which may be called from any thread
+class OverloadGuard {
+public:
+    enum class Verdict {
+        Accept,
+        RateLimited,
+        Shed
+    };
+
+    explicit OverloadGuard(const OverloadLimits& limits);
+
+    const OverloadLimits& getLimits() const { return limits; }
+
+    // Must be called for every accepted connection. Returns false if the connection
+    // exceeds caps and has to be closed; in this case it is not registered
+    bool admitConnection(int fd, uint32_t peerKey);
+
+    void releaseConnection(int fd);
+
+    // `lag` is the time request has waited in the server before processing. A message carrying
+    // `numRequests` requests (packed one) takes as many request tokens and is admitted or rejected as a whole
+    Verdict admitRequest(uint32_t peerKey, size_t numBytes, Clock::duration lag, size_t numRequests = 1);
+
+    // Shortcut for connection requests, whose peer is known from the connection
+    Verdict admitConnectionRequest(int fd, size_t numBytes, Clock::duration lag, size_t numRequests = 1);
+
+    bool isLagTracked() const { return limits.maxLoopLagMs > 0; }
+
+    // Fills overload related counters
+    void fillStats(ServerStats& stats) const;
+
+private:
+    struct PeerState {
+        PeerState(const OverloadLimits& limits, Clock::time_point now);
+
+        TokenBucket requests;
+        TokenBucket bytes;
+        size_t numConnections = 0;
+    };
+
+    PeerState& getPeer(uint32_t peerKey, Clock::time_point now);
+
+    // Forgets peers that have neither connections nor rate limiting debt
+    void evictIdlePeers(Clock::time_point now);
+
+    OverloadLimits limits;
+    bool rateLimited;
+
+    std::unordered_map<uint32_t, PeerState> peers;
+    std::unordered_map<int, uint32_t> connectionPeers;
+
+    std::atomic<uint64_t> rejectedConnections{ 0 };
+    std::atomic<uint64_t> rejectedRequests{ 0 };
+    std::atomic<uint64_t> rejectedBytes{ 0 };
+    std::atomic<uint64_t> shedRequests{ 0 };
+};
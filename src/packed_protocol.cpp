@@ -0,0 +1,87 @@
+#include <cstring>
+
+#include "packed_protocol.h"
+
+namespace {
+
+uint64_t loadLittleEndian(const char *data, size_t numBytes) {
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < numBytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+    }
+
+    return value;
+}
+
+void appendLittleEndian(uint64_t value, size_t numBytes, std::string& message) {
+    for (size_t i = 0; i < numBytes; ++i) {
+        message.push_back(static_cast<char>(value >> (8 * i)));
+    }
+}
+
+} // namespace
+
+bool isPackedMessage(const char *data, size_t size) {
+    return size >= PACKED_MAGIC_SIZE && std::memcmp(data, PACKED_MAGIC, PACKED_MAGIC_SIZE) == 0;
+}
+
+bool decodePackedMessage(const char *data, size_t size, bool allowDropped, uint64_t& tag,
+                         std::vector<PackedEntry>& entries) {
+    entries.clear();
+
+    if (!isPackedMessage(data, size) || size < PACKED_HEADER_SIZE) {
+        return false;
+    }
+
+    tag = loadLittleEndian(data + PACKED_MAGIC_SIZE, sizeof(uint64_t));
+
+    const char *end = data + size;
+
+    for (const char *cursor = data + PACKED_HEADER_SIZE; cursor != end;) {
+        if (static_cast<size_t>(end - cursor) < PACKED_ENTRY_HEADER_SIZE) {
+            return false;
+        }
+
+        const uint32_t length = static_cast<uint32_t>(loadLittleEndian(cursor, PACKED_ENTRY_HEADER_SIZE));
+        cursor += PACKED_ENTRY_HEADER_SIZE;
+
+        if (length == PACKED_DROPPED_ENTRY) {
+            if (!allowDropped) {
+                return false;
+            }
+
+            entries.push_back({ nullptr, length });
+            continue;
+        }
+
+        if (static_cast<size_t>(end - cursor) < length) {
+            return false;
+        }
+
+        entries.push_back({ cursor, length });
+        cursor += length;
+    }
+
+    return !entries.empty();
+}
+
+void beginPackedMessage(uint64_t tag, std::string& message) {
+    message.assign(PACKED_MAGIC, PACKED_MAGIC_SIZE);
+    appendLittleEndian(tag, sizeof(uint64_t), message);
+}
+
+bool appendPackedEntry(const char *data, size_t size, std::string& message, size_t maxSize) {
+    if (message.size() + PACKED_ENTRY_HEADER_SIZE + size > maxSize || size >= PACKED_DROPPED_ENTRY) {
+        if (message.size() + PACKED_ENTRY_HEADER_SIZE <= maxSize) {
+            appendLittleEndian(PACKED_DROPPED_ENTRY, PACKED_ENTRY_HEADER_SIZE, message);
+        }
+
+        return false;
+    }
+
+    appendLittleEndian(size, PACKED_ENTRY_HEADER_SIZE, message);
+    message.append(data, size);
+
+    return true;
+}
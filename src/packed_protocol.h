@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <socket_demo/defines.h>
+
+// Packed datagrams carry several independent requests (or their responses) at once, so that clients sending
+// many small requests pay for one datagram instead of one per request. Every request is processed on its own,
+// as if it came in a separate datagram; responses go back in one packed datagram in request order.
+//
+// Message: `PACKED_MAGIC`, little-endian uint64 tag, then entries: little-endian uint32 length, payload.
+// Server echoes the tag, so that client matches responses to requests even if datagrams are reordered.
+// Response entry of `PACKED_DROPPED_ENTRY` length has no payload: the response did not fit into the datagram.
+// Malformed packed message is processed as a plain one
+
+static constexpr char PACKED_MAGIC[] = { '\0', 'S', 'D', 'M' };
+static constexpr size_t PACKED_MAGIC_SIZE = sizeof(PACKED_MAGIC);
+static constexpr size_t PACKED_HEADER_SIZE = PACKED_MAGIC_SIZE + sizeof(uint64_t);
+static constexpr size_t PACKED_ENTRY_HEADER_SIZE = sizeof(uint32_t);
+static constexpr uint32_t PACKED_DROPPED_ENTRY = UINT32_MAX;
+
+struct PackedEntry {
+    const char *data;
+
+    // `PACKED_DROPPED_ENTRY` for dropped response
+    uint32_t size;
+};
+
+bool isPackedMessage(const char *data, size_t size);
+
+// Fills `entries` pointing into `data`. Returns false if the message is not a well-formed packed one
+// with at least one entry. Dropped entries are accepted only if `allowDropped` is set (in responses)
+bool decodePackedMessage(const char *data, size_t size, bool allowDropped, uint64_t& tag,
+                         std::vector<PackedEntry>& entries);
+
+// Starts a packed message in `message`
+void beginPackedMessage(uint64_t tag, std::string& message);
+
+// Appends entry if the message stays within `maxSize` bytes, otherwise appends dropped entry (if even that fits)
+// and returns false
+bool appendPackedEntry(const char *data, size_t size, std::string& message,
+                       size_t maxSize = MAX_MESSAGE_LENGTH_BYTES);
+
+// Size of the packed message holding entries of `totalPayloadSize` bytes in `numEntries` entries
+inline size_t getPackedMessageSize(size_t numEntries, size_t totalPayloadSize) {
+    return PACKED_HEADER_SIZE + numEntries * PACKED_ENTRY_HEADER_SIZE + totalPayloadSize;
+}
@@ -0,0 +1,151 @@
+#include <cstring>
+#include <sstream>
+
+#include "projection.h"
+
+namespace {
+
+bool matchesDirective(const char *begin, const char *end, const char *directive) {
+    const size_t length = std::strlen(directive);
+    return static_cast<size_t>(end - begin) >= length && std::memcmp(begin, directive, length) == 0;
+}
+
+// Parses positive decimal k, the whole rest of the token has to be digits
+bool parseK(const char *begin, const char *end, size_t& k) {
+    if (begin == end || end - begin > 9) {
+        return false;
+    }
+
+    k = 0;
+
+    for (; begin != end; ++begin) {
+        if (*begin < '0' || *begin > '9') {
+            return false;
+        }
+
+        k = k * 10 + static_cast<size_t>(*begin - '0');
+    }
+
+    return k > 0;
+}
+
+} // namespace
+
+bool parseProjection(const char *begin, const char *end, Projection& projection) {
+    const size_t length = static_cast<size_t>(end - begin);
+
+    if (length == 4 && matchesDirective(begin, end, "@sum")) {
+        projection = Projection{ ProjectionKind::Sum, 0 };
+    } else if (length == 6 && matchesDirective(begin, end, "@count")) {
+        projection = Projection{ ProjectionKind::Count, 0 };
+    } else if (length == 7 && matchesDirective(begin, end, "@minmax")) {
+        projection = Projection{ ProjectionKind::MinMax, 0 };
+    } else if (matchesDirective(begin, end, "@smallest=")) {
+        projection.kind = ProjectionKind::Smallest;
+        return parseK(begin + 10, end, projection.k);
+    } else if (matchesDirective(begin, end, "@largest=")) {
+        projection.kind = ProjectionKind::Largest;
+        return parseK(begin + 9, end, projection.k);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool isBinaryProjectionMessage(const char *data, size_t size) {
+    return size >= BINARY_PROJECTION_MAGIC_SIZE &&
+           std::memcmp(data, BINARY_PROJECTION_MAGIC, BINARY_PROJECTION_MAGIC_SIZE) == 0;
+}
+
+bool isBinaryProjectionMessage(const std::string& message) {
+    return isBinaryProjectionMessage(message.data(), message.size());
+}
+
+bool encodeBinaryProjectionRequest(const Projection& projection, const std::vector<Number>& numbers,
+                                   std::string& message) {
+    const bool hasK = projection.kind == ProjectionKind::Smallest || projection.kind == ProjectionKind::Largest;
+
+    if (numbers.size() > BINARY_PROJECTION_MAX_NUMBERS ||
+        (hasK && (projection.k == 0 || projection.k > BINARY_PROJECTION_MAX_RESULTS)))
+    {
+        return false;
+    }
+
+    const Number header[2] = { static_cast<Number>(projection.kind), static_cast<Number>(hasK ? projection.k : 0) };
+
+    message.assign(BINARY_PROJECTION_MAGIC, BINARY_PROJECTION_MAGIC_SIZE);
+    storeNumbers(header, 2, message);
+    storeNumbers(numbers.data(), numbers.size(), message);
+
+    return true;
+}
+
+bool decodeBinaryProjectionResponse(const std::string& message, std::vector<Number>& results) {
+    if (!isBinaryProjectionMessage(message) || message.size() < BINARY_PROJECTION_MAGIC_SIZE + sizeof(Number)) {
+        return false;
+    }
+
+    const char *payload = message.data() + BINARY_PROJECTION_MAGIC_SIZE;
+    const size_t payloadSize = message.size() - BINARY_PROJECTION_MAGIC_SIZE;
+
+    Number numResults;
+    loadNumbers(payload, 1, &numResults);
+
+    if (numResults < 0 || payloadSize != (static_cast<size_t>(numResults) + 1) * sizeof(Number)) {
+        return false;
+    }
+
+    results.resize(static_cast<size_t>(numResults));
+    loadNumbers(payload + sizeof(Number), results.size(), results.data());
+
+    return true;
+}
+
+std::string formatProjectionResponse(const std::vector<Number>& results) {
+    std::stringstream ss;
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        ss << (i ? " " : "") << results[i];
+    }
+
+    return ss.str();
+}
+
+ProjectionAccumulator::ProjectionAccumulator(const Projection& projection, std::vector<Number>& storage)
+    : projection(projection), heap(storage)
+{
+    heap.clear();
+}
+
+void ProjectionAccumulator::finish() {
+    switch (projection.kind) {
+        case ProjectionKind::Sum:
+            heap.assign(1, static_cast<Number>(sum));
+            break;
+
+        case ProjectionKind::Count:
+            heap.assign(1, static_cast<Number>(count));
+            break;
+
+        case ProjectionKind::MinMax:
+            heap.clear();
+
+            if (count > 0) {
+                heap.push_back(min);
+                heap.push_back(max);
+            }
+
+            break;
+
+        case ProjectionKind::Smallest:
+            std::sort_heap(heap.begin(), heap.end(), std::less<Number>());
+            break;
+
+        case ProjectionKind::Largest:
+            // Sorting min-heap yields descending order
+            std::sort_heap(heap.begin(), heap.end(), std::greater<Number>());
+            std::reverse(heap.begin(), heap.end());
+            break;
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+
+#include "binary_protocol.h"
+
+// Response projections let a request ask for a part of the full response (all numbers sorted plus their sum),
+// so that the server does only the work needed for it and sends less back:
+//   * sum - sum of numbers (wraps on overflow)
+//   * count - number of numbers
+//   * min/max - the smallest and the largest number, nothing if there are no numbers
+//   * k smallest, k largest - up to k numbers sorted ascending
+//
+// Text request selects projection with the first token: `@sum`, `@count`, `@minmax`, `@smallest=K` or `@largest=K`.
+// Other tokens starting with `@` are ignored as any other non-numeric ones, so old servers answer in full.
+// Response consists of space separated result numbers; request without numbers is echoed back unless
+// the projection is sum or count.
+//
+// Binary request: `BINARY_PROJECTION_MAGIC`, little-endian int64 projection kind, int64 k (ignored unless
+// k smallest or largest), N numbers. Response: magic, int64 number of results, results.
+// Response consisting of magic only means malformed request
+
+enum class ProjectionKind: int64_t {
+    Sum = 1,
+    Count = 2,
+    MinMax = 3,
+    Smallest = 4,
+    Largest = 5
+};
+
+struct Projection {
+    ProjectionKind kind;
+
+    // Number of results of `Smallest` and `Largest`, positive
+    size_t k;
+};
+
+static constexpr char BINARY_PROJECTION_MAGIC[] = { '\0', 'S', 'D', 'P' };
+static constexpr size_t BINARY_PROJECTION_MAGIC_SIZE = sizeof(BINARY_PROJECTION_MAGIC);
+
+// Request header: magic, kind and k
+static constexpr size_t BINARY_PROJECTION_HEADER_SIZE = BINARY_PROJECTION_MAGIC_SIZE + 2 * sizeof(Number);
+
+static constexpr size_t BINARY_PROJECTION_MAX_NUMBERS =
+    (MAX_MESSAGE_LENGTH_BYTES - BINARY_PROJECTION_HEADER_SIZE) / sizeof(Number);
+
+// Largest k a binary response can carry next to the number of results
+static constexpr size_t BINARY_PROJECTION_MAX_RESULTS = BINARY_MAX_NUMBERS;
+
+// Parses text directive token `[begin, end)`. Returns false if it is not a valid one
+bool parseProjection(const char *begin, const char *end, Projection& projection);
+
+bool isBinaryProjectionMessage(const char *data, size_t size);
+
+bool isBinaryProjectionMessage(const std::string& message);
+
+// Fails if there are more than `BINARY_PROJECTION_MAX_NUMBERS` numbers or k is not valid
+bool encodeBinaryProjectionRequest(const Projection& projection, const std::vector<Number>& numbers,
+                                   std::string& message);
+
+// Returns false for malformed or text responses
+bool decodeBinaryProjectionResponse(const std::string& message, std::vector<Number>& results);
+
+// Renders decoded response the same way as the text protocol does
+std::string formatProjectionResponse(const std::vector<Number>& results);
+
+// Folds numbers into the projection one at a time. Min/max, sum and count take O(1) per number,
+// k smallest or largest are kept in a bounded heap, so the whole request takes O(n log k) and O(k) memory.
+// Heap lives in caller's scratch vector, which also receives results
+class ProjectionAccumulator {
+public:
+    ProjectionAccumulator(const Projection& projection, std::vector<Number>& storage);
+
+    void add(Number number) {
+        ++count;
+
+        switch (projection.kind) {
+            case ProjectionKind::Sum:
+                sum += static_cast<uint64_t>(number);
+                break;
+
+            case ProjectionKind::Count:
+                break;
+
+            case ProjectionKind::MinMax:
+                min = count == 1 ? number : std::min(min, number);
+                max = count == 1 ? number : std::max(max, number);
+                break;
+
+            case ProjectionKind::Smallest:
+                // Max-heap of the k smallest numbers seen so far, its top is the first one to drop
+                pushBounded(number, std::less<Number>());
+                break;
+
+            case ProjectionKind::Largest:
+                pushBounded(number, std::greater<Number>());
+                break;
+        }
+    }
+
+    // Replaces the contents of `storage` with results in response order
+    void finish();
+
+    uint64_t getCount() const { return count; }
+
+private:
+    template<typename Compare>
+    void pushBounded(Number number, Compare compare) {
+        if (heap.size() < projection.k) {
+            heap.push_back(number);
+            std::push_heap(heap.begin(), heap.end(), compare);
+        } else if (compare(number, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), compare);
+            heap.back() = number;
+            std::push_heap(heap.begin(), heap.end(), compare);
+        }
+    }
+
+    Projection projection;
+    std::vector<Number>& heap;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    Number min = 0;
+    Number max = 0;
+};
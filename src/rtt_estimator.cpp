@@ -0,0 +1,46 @@
+#include <algorithm>
+
+#include "rtt_estimator.h"
+
+namespace {
+
+// Clock granularity term of RFC 6298, keeps the timeout above the RTT once its variation settles
+const RttEstimator::Duration CLOCK_GRANULARITY(1000);
+
+} // namespace
+
+RttEstimator::RttEstimator(const UdpRetryOptions& options)
+    : minTimeout(std::chrono::milliseconds(options.minTimeoutMs)),
+      maxTimeout(std::chrono::milliseconds(std::max(options.maxTimeoutMs, options.minTimeoutMs))),
+      random(std::random_device()())
+{
+    timeout = clamp(std::chrono::milliseconds(options.initialTimeoutMs));
+}
+
+void RttEstimator::addSample(Duration rtt) {
+    if (!isMeasured) {
+        smoothedRtt = rtt;
+        rttVariation = rtt / 2;
+        isMeasured = true;
+    } else {
+        const Duration deviation = smoothedRtt > rtt ? smoothedRtt - rtt : rtt - smoothedRtt;
+
+        rttVariation = (3 * rttVariation + deviation) / 4;
+        smoothedRtt = (7 * smoothedRtt + rtt) / 8;
+    }
+
+    timeout = clamp(smoothedRtt + std::max(CLOCK_GRANULARITY, 4 * rttVariation));
+}
+
+void RttEstimator::onTimeout() {
+    timeout = clamp(2 * timeout);
+}
+
+RttEstimator::Duration RttEstimator::nextTimeout() {
+    std::uniform_int_distribution<Duration::rep> jitter(0, timeout.count() / 4);
+    return timeout + Duration(jitter(random));
+}
+
+RttEstimator::Duration RttEstimator::clamp(Duration value) const {
+    return std::min(std::max(value, minTimeout), maxTimeout);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <random>
+
+#include "client_options.h"
+
+// Round trip time estimator and retransmission timer of RFC 6298: smoothed RTT and its variation give
+// the timeout, which is doubled on every expiration and restored from the estimate by the next valid sample.
+// Following Karn's algorithm, round trips of retransmitted requests are not sampled, since it is unknown
+// which copy the response belongs to. Not thread safe
+class RttEstimator {
+public:
+    using Duration = std::chrono::microseconds;
+
+    explicit RttEstimator(const UdpRetryOptions& options);
+
+    // Feeds round trip of a request answered on the first attempt
+    void addSample(Duration rtt);
+
+    // Backs off after the timeout has expired
+    void onTimeout();
+
+    // Current timeout with random jitter of up to a quarter of it on top
+    Duration nextTimeout();
+
+    Duration getTimeout() const { return timeout; }
+
+    bool hasSamples() const { return isMeasured; }
+
+    Duration getSmoothedRtt() const { return smoothedRtt; }
+
+private:
+    Duration clamp(Duration value) const;
+
+    Duration minTimeout;
+    Duration maxTimeout;
+
+    bool isMeasured = false;
+    Duration smoothedRtt{ 0 };
+    Duration rttVariation{ 0 };
+    Duration timeout;
+
+    std::minstd_rand random;
+};
@@ -0,0 +1,95 @@
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "server_async.h"
+#include "server_tcp.h"
+#include "utils.h"
+
+ServerAsync::ServerAsync(uint16_t port, std::ostream& logStream, int maxNumConnections, int timeoutSeconds,
+                         size_t numWorkers, const ServerOptions& options)
+    : logStream(logStream),
+      listeningSocket(ServerTcp::createListeningSocket(port, maxNumConnections, timeoutSeconds, options.tcp)),
+      reactor(numWorkers),
+      overloadGuard(options.overload)
+{
+    logStream << "Listening on " << port << " (coroutines, " << numWorkers << " workers)" << std::endl;
+}
+
+void ServerAsync::eventLoop(ServerDelegate *serverDelegate) {
+    DelegateHandler handler(serverDelegate, logStream, reactor.getNumWorkers() > 0);
+    run(handler);
+}
+
+void ServerAsync::run(AsyncHandler& handler) {
+    reactor.spawn(acceptConnections(handler));
+    reactor.run();
+
+    // Suspended coroutines are never resumed, so their connections are closed here
+
+    for (const int fd: connections) {
+        overloadGuard.releaseConnection(fd);
+        shutdown(fd, SHUT_RDWR);
+        close(fd);
+    }
+
+    connections.clear();
+}
+
+void ServerAsync::stop() {
+    reactor.stop();
+}
+
+Task<void> ServerAsync::acceptConnections(AsyncHandler& handler) {
+    for (;;) {
+        co_await reactor.readable(listeningSocket);
+
+        sockaddr_in peerAddress{};
+        socklen_t peerAddressLength = sizeof(peerAddress);
+
+        const int acceptedFd = accept4(listeningSocket, reinterpret_cast<sockaddr*>(&peerAddress),
+                                       &peerAddressLength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (acceptedFd < 0) {
+            logStream << "Cannot accept connection: " << getError() << std::endl;
+            continue;
+        }
+
+        if (!overloadGuard.admitConnection(acceptedFd, ntohl(peerAddress.sin_addr.s_addr))) {
+            logStream << "Rejected connection because of connection caps" << std::endl;
+            close(acceptedFd);
+            continue;
+        }
+
+        logStream << "Accepted connection: " << acceptedFd << std::endl;
+
+        connections.insert(acceptedFd);
+
+        reactor.spawn(serveConnection(handler, acceptedFd));
+    }
+}
+
+Task<void> ServerAsync::serveConnection(AsyncHandler& handler, int fd) {
+    AsyncConnection connection(reactor, fd);
+
+    try {
+        co_await handler.serve(connection);
+    } catch (const std::exception& e) {
+        logStream << "Handler failed on " << fd << ": " << e.what() << std::endl;
+    }
+
+    connections.erase(fd);
+    overloadGuard.releaseConnection(fd);
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+}
+
+ServerStats ServerAsync::stats() const {
+    ServerStats result;
+    overloadGuard.fillStats(result);
+    return result;
+}
+
+ServerAsync::~ServerAsync() {
+    close(listeningSocket);
+}
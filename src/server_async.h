@@ -0,0 +1,51 @@
+#pragma once
+
+// Requires C++20, see `SOCKET_DEMO_COROUTINES` CMake option
+
+#include <set>
+#include <ostream>
+
+#include <socket_demo/server.h>
+
+#include "async_handler.h"
+#include "server_options.h"
+
+// Coroutine-based TCP server implementation. Every connection is served by its own coroutine
+// resumed by a single-threaded reactor, so handlers may wait for anything without blocking the loop
+class ServerAsync: public Server {
+public:
+    // `numWorkers` - number of threads for offloaded work, 0 runs it in place
+    ServerAsync(uint16_t port, std::ostream& logStream, int maxNumConnections = 10, int timeoutSeconds = 5,
+                size_t numWorkers = 0, const ServerOptions& options = ServerOptions());
+
+    // Runs synchronous delegate through `DelegateHandler`, offloading it if there are workers
+    void eventLoop(ServerDelegate *serverDelegate = nullptr) override;
+
+    // Runs coroutine handler until `stop` is called
+    void run(AsyncHandler& handler);
+
+    // Connections are closed once the reactor returns, requests they are in the middle of are dropped
+    void stop() override;
+
+    ServerStats stats() const override;
+
+    ~ServerAsync() override;
+
+    // Forbid copying
+
+    ServerAsync(ServerAsync&) = delete;
+    ServerAsync operator=(ServerAsync&) = delete;
+
+private:
+    Task<void> acceptConnections(AsyncHandler& handler);
+
+    Task<void> serveConnection(AsyncHandler& handler, int fd);
+
+    std::ostream& logStream;
+    int listeningSocket;
+    Reactor reactor;
+    OverloadGuard overloadGuard;
+
+    // Connections of running coroutines, closed by `run` once it is stopped
+    std::set<int> connections;
+};
@@ -0,0 +1,347 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <socket_demo/defines.h>
+#include <socket_demo/server_stats.h>
+#include <socket_demo/server_delegate.h>
+
+#include "capture.h"
+#include "loop_monitor.h"
+#include "overload_guard.h"
+#include "packed_protocol.h"
+#include "server_policies.h"
+#include "trace.h"
+
+// Compile-time specialized server event loop. All transports share the same request path:
+// backend delivers received data, framing cuts it into messages, overload guard admits them,
+// delegate processes them and framing writes responses back through the backend.
+//
+// `Delegate` - any type with `std::string process(const std::string&)` and `processBatch` (see
+// `ServerDelegate`). Passing a concrete `final` delegate instead of `ServerDelegate` makes the calls static
+// and lets the compiler inline them.
+//
+// `IoBackend` - owns sockets and has to provide:
+//   * `Endpoint` type identifying the peer responses go to (printable for logs)
+//   * `template<typename Handler> void start(Handler&)` - called on event loop thread before the first `wait`
+//   * `template<typename Handler> void wait(Handler&)` - blocks until something happens and reports
+//     received data with `handler.onData(endpoint, data, size, lag)` and closed connections with
+//     `handler.onClose(endpoint)`; `lag` is the time data has been waiting in the server.
+//     Once everything a single wakeup brought is reported, backend calls `handler.flush()`: messages
+//     are queued until then, so that several of them are processed by one `processBatch` call.
+//     Backend logs through `handler.getLogger()`, so it does not depend on logger policy itself.
+//     Backend calls `handler.onWakeup()` once it has found work, so that the loop accounts for the time spent
+//     before the first callback (accepting connections, reading); without it busy time starts at the first callback
+//   * `void queue(const Endpoint&, const iovec *chunks, size_t numChunks)` - remembers a message made of `chunks`
+//     without copying them, and `template<typename Handler> void flushSends(Handler&)` - sends everything queued,
+//     gathering messages of the same peer into as few syscalls as possible, and reports failures
+//   * `void retainResponses(std::vector<std::string>&)` - called right after `flushSends` with response buffers
+//     chunks pointed into. Backend which lets the kernel read them later (zero copy) swaps such buffers out.
+//     Other chunks must not be referenced after `flushSends`
+//   * `void wakeUp()` - thread-safe, makes blocked `wait` return
+//   * `template<typename Handler> void drain(Handler&)` - called once the loop is stopped: stops taking new
+//     connections, reports data which has already arrived without blocking, flushes and closes connections
+//   * `OverloadGuard::Verdict admit(const Endpoint&, size_t size, Clock::duration lag, size_t numRequests)`
+//     and `const OverloadGuard& getOverloadGuard() const`
+//   * `static constexpr bool repliesToRejected` - whether rejected requests get reject message
+//   * `void fillStats(ServerStats&) const`, which also reports syscalls the loop made in `loopSyscalls`
+//   * `uint64_t getCapturePeer(const Endpoint&) const` - peer identifier for captured traffic (see `setCapture`)
+//     and stall reports. Identifiers of closed connections are not reused, so that `replay` does not merge them
+//
+// Packed messages (see `packed_protocol.h`) are admitted as a whole, taking a request token per packed request.
+// Then they are unpacked into separate requests, and their responses are packed back into one message in the same order.
+//
+// `Framing` and `LoggerPolicy` - see `server_policies.h`
+template<typename Delegate, typename IoBackend, typename Framing = RawFraming, typename LoggerPolicy = StreamLogger>
+class ServerCore {
+public:
+    using Logger = LoggerPolicy;
+    using Endpoint = typename IoBackend::Endpoint;
+
+    template<typename... BackendArgs>
+    explicit ServerCore(Logger logger, BackendArgs&&... backendArgs)
+        : backend(std::forward<BackendArgs>(backendArgs)...), logger(logger)
+    {}
+
+    // Runs until `stop` is called, then serves requests which have already arrived and returns
+    void run(Delegate *serverDelegate) {
+        delegate = serverDelegate;
+
+        backend.start(*this);
+
+        std::unique_ptr<LoopWatchdog> watchdog;
+
+        if (stallThreshold > std::chrono::milliseconds::zero()) {
+            watchdog.reset(new LoopWatchdog(monitor, stallThreshold, *watchdogStream));
+        }
+
+        while (!isStopped.load(std::memory_order_acquire)) {
+            beginTraceIteration();
+
+            TraceSpan span("event loop iteration");
+            backend.wait(*this);
+
+            monitor.endBusy();
+        }
+
+        backend.drain(*this);
+    }
+
+    // Thread-safe. Makes `run` return (or return right away if it has not been started yet)
+    void stop() {
+        isStopped.store(true, std::memory_order_release);
+        backend.wakeUp();
+    }
+
+    IoBackend& getBackend() { return backend; }
+    const IoBackend& getBackend() const { return backend; }
+
+    Logger& getLogger() { return logger; }
+
+    // Records every received request into `writer` before admission, so that rejected traffic can be
+    // replayed too. Writer has to outlive the event loop
+    void setCapture(CaptureWriter *writer, CaptureProtocol protocol) {
+        capture = writer;
+        captureProtocol = protocol;
+    }
+
+    // Starts a watchdog thread with `run`, which logs iterations busy for longer than `threshold` into
+    // `logStream` regardless of logger policy (see `LoopWatchdog`). Stream has to outlive the event loop
+    void setStallWatchdog(std::chrono::milliseconds threshold, std::ostream& logStream) {
+        stallThreshold = threshold;
+        watchdogStream = &logStream;
+    }
+
+    ServerStats stats() const {
+        ServerStats result;
+        backend.fillStats(result);
+        monitor.fillStats(result);
+        return result;
+    }
+
+    // Backend callbacks
+
+    void onWakeup() {
+        monitor.beginBusy();
+    }
+
+    void onData(const Endpoint& endpoint, const char *data, size_t size, Clock::duration lag) {
+        monitor.beginBusy();
+        monitor.setActivePeer(backend.getCapturePeer(endpoint));
+
+        framing.onData(endpoint, data, size, [&](const char *message, size_t messageSize) {
+            onMessage(endpoint, message, messageSize, lag);
+        });
+    }
+
+    void onClose(const Endpoint& endpoint) {
+        monitor.beginBusy();
+        framing.onClose(endpoint);
+    }
+
+    // Processes messages queued since the last flush and sends responses
+    void flush() {
+        if (pending.empty()) {
+            return;
+        }
+
+        // 1. Admitted message data is copied into a single reused buffer, so views are built only now
+
+        monitor.setPhase(LoopPhase::Process);
+
+        batchRequests.clear();
+
+        size_t numPackedResponses = 0;
+
+        for (const auto& request: pending) {
+            if (request.numPacked > 0) {
+                ++numPackedResponses;
+            } else if (request.isAdmitted) {
+                batchRequests.push_back(RequestView{ batchData.data() + request.offset, request.size });
+            }
+        }
+
+        // Packed responses go after responses of the delegate, so that backend retains them all at once.
+        // Sizing the vector up front keeps response buffers in place while they are queued
+
+        const size_t numRequests = batchRequests.size();
+        batchResponses.resize(numRequests + numPackedResponses);
+
+        monitor.addRequests(pending.size() - numPackedResponses);
+
+        // 2. Process them, a single message takes the usual path
+
+        TraceSpan processSpan("process");
+        const LoopMonitor::Clock::time_point processStart = LoopMonitor::Clock::now();
+
+        if (!delegate) {
+            for (size_t i = 0; i < numRequests; ++i) {
+                batchResponses[i].clear();
+            }
+        } else if (numRequests == 1) {
+            batchResponses[0] = delegate->process(batchData);
+        } else if (numRequests > 1) {
+            delegate->processBatch(batchRequests.data(), batchResponses.data(), numRequests);
+        }
+
+        monitor.addProcessTime(LoopMonitor::Clock::now() - processStart);
+        processSpan.end();
+
+        // 3. Queue responses in order of requests straight from their buffers, then let backend
+        // write everything queued for the same peer at once
+
+        const std::string& rejectMessage = backend.getOverloadGuard().getLimits().rejectMessage;
+        size_t responseIndex = 0;
+        size_t packedIndex = numRequests;
+
+        for (size_t i = 0; i < pending.size(); ++i) {
+            const PendingRequest& request = pending[i];
+
+            if (request.numPacked > 0) {
+                std::string& packed = batchResponses[packedIndex++];
+                packResponses(request, responseIndex, packed);
+
+                responseIndex += request.numPacked;
+                i += request.numPacked;
+
+                reply(request.endpoint, packed);
+                continue;
+            }
+
+            reply(request.endpoint, request.isAdmitted ? batchResponses[responseIndex++] : rejectMessage);
+        }
+
+        monitor.setPhase(LoopPhase::Send);
+
+        backend.flushSends(*this);
+        backend.retainResponses(batchResponses);
+
+        pending.clear();
+        batchData.clear();
+
+        monitor.setPhase(LoopPhase::Receive);
+    }
+
+private:
+    struct PendingRequest {
+        Endpoint endpoint;
+        size_t offset;
+        size_t size;
+
+        // Rejected requests are kept only to answer them in order
+        bool isAdmitted;
+
+        // Header of a packed message, which is followed by its `numPacked` requests. It has no data itself
+        uint32_t numPacked;
+        uint64_t tag;
+    };
+
+    void onMessage(const Endpoint& endpoint, const char *message, size_t size, Clock::duration lag) {
+        if (capture) {
+            capture->appendRequest(captureProtocol, backend.getCapturePeer(endpoint), message, size);
+        }
+
+        // 1. Reject request cheaply if the peer or the whole server is overloaded. Packed message counts
+        // as all of its requests, so that packing does not get around request rate limits
+
+        uint64_t tag;
+        const bool isPacked = decodePackedMessage(message, size, false, tag, packedEntries);
+
+        const OverloadGuard::Verdict verdict = backend.admit(endpoint, size, lag, isPacked ? packedEntries.size() : 1);
+
+        if (verdict != OverloadGuard::Verdict::Accept) {
+            logger.log(verdict == OverloadGuard::Verdict::Shed ? "Shed" : "Rate limited", " request from ", endpoint);
+
+            if (IoBackend::repliesToRejected) {
+                pending.push_back(PendingRequest{ endpoint, 0, 0, false, 0, 0 });
+            }
+
+            return;
+        }
+
+        // 2. Queue received message until backend flushes
+
+        logger.log("Received message from ", endpoint, " [", size, "]: ", LoggedMessage{ message, size });
+
+        if (isPacked) {
+            pending.push_back(PendingRequest{ endpoint, 0, 0, true, static_cast<uint32_t>(packedEntries.size()), tag });
+
+            for (const PackedEntry& entry: packedEntries) {
+                pending.push_back(PendingRequest{ endpoint, batchData.size(), entry.size, true, 0, 0 });
+                batchData.append(entry.data, entry.size);
+            }
+
+            return;
+        }
+
+        pending.push_back(PendingRequest{ endpoint, batchData.size(), size, true, 0, 0 });
+        batchData.append(message, size);
+    }
+
+    // Packs responses of `header` requests, which start at `firstResponse`. Responses which do not fit
+    // are dropped one by one, the rest still go back. Every response leaves room for dropped entries
+    // of those after it, so that the client gets an entry per request (the request had a header per entry too)
+    void packResponses(const PendingRequest& header, size_t firstResponse, std::string& packed) {
+        beginPackedMessage(header.tag, packed);
+
+        const size_t end = firstResponse + header.numPacked;
+        size_t numDropped = 0;
+
+        for (size_t i = firstResponse; i < end; ++i) {
+            const std::string& response = batchResponses[i];
+            const size_t maxSize = MAX_MESSAGE_LENGTH_BYTES - (end - i - 1) * PACKED_ENTRY_HEADER_SIZE;
+
+            if (!appendPackedEntry(response.data(), response.size(), packed, maxSize)) {
+                ++numDropped;
+            }
+        }
+
+        if (numDropped > 0) {
+            logger.log("Dropped ", numDropped, " responses which do not fit into packed response to ", header.endpoint);
+        }
+    }
+
+    // Response has to stay intact until `flushSends`
+    void reply(const Endpoint& endpoint, const std::string& response) {
+        if (response.empty()) {
+            return;
+        }
+
+        if (response.size() >= MAX_MESSAGE_LENGTH_BYTES) {
+            logger.log("Response is too long, it will be truncated to ", MAX_MESSAGE_LENGTH_BYTES, " bytes");
+        }
+
+        const size_t actualResponseSize = std::min(response.size(), static_cast<size_t>(MAX_MESSAGE_LENGTH_BYTES));
+
+        framing.write(endpoint, response.data(), actualResponseSize, [&](const iovec *chunks, size_t numChunks) {
+            backend.queue(endpoint, chunks, numChunks);
+        });
+    }
+
+    IoBackend backend;
+    Framing framing;
+    Logger logger;
+    Delegate *delegate = nullptr;
+    std::atomic<bool> isStopped{ false };
+
+    CaptureWriter *capture = nullptr;
+    CaptureProtocol captureProtocol = CaptureProtocol::TCP;
+
+    LoopMonitor monitor;
+    std::chrono::milliseconds stallThreshold{ 0 };
+    std::ostream *watchdogStream = nullptr;
+
+    // Messages waiting for `flush`. Buffers keep their capacity, so steady state does not allocate
+    std::vector<PendingRequest> pending;
+    std::string batchData;
+    std::vector<RequestView> batchRequests;
+    std::vector<std::string> batchResponses;
+    std::vector<PackedEntry> packedEntries;
+};
@@ -0,0 +1,26 @@
+#include "server_loopback.h"
+
+ServerLoopback::ServerLoopback(const std::string& name, std::ostream& logStream, uint32_t numSlotsPerRing,
+                               const ServerOptions& options)
+    : core(StreamLogger(logStream), LoopbackListener::create(name, numSlotsPerRing), options.overload,
+           options.busyPoll)
+{
+    core.setStallWatchdog(std::chrono::milliseconds(options.watchdog.stallThresholdMs), logStream);
+    core.getLogger().log("Listening on loopback ", name);
+}
+
+void ServerLoopback::eventLoop(ServerDelegate *serverDelegate) {
+    core.run(serverDelegate);
+}
+
+void ServerLoopback::stop() {
+    core.stop();
+}
+
+ServerStats ServerLoopback::stats() const {
+    return core.stats();
+}
+
+ServerLoopback::~ServerLoopback() {
+    core.getBackend().shutdown();
+}
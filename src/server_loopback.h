@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include <socket_demo/server.h>
+#include <socket_demo/server_delegate.h>
+
+#include "loopback_backend.h"
+#include "server_core.h"
+#include "server_options.h"
+
+// In-process server, clients connect to it by name with `ClientLoopback` from the same process.
+// Requests go through the same event loop as with sockets, so it shows the framework overhead
+// without the kernel: put both sides of a benchmark on it to see what transports cost on top
+class ServerLoopback: public Server {
+public:
+    // Request path specialization behind this server, see `ServerTcp::Core`
+    template<typename Delegate, typename Logger = StreamLogger>
+    using Core = ServerCore<Delegate, LoopbackBackend, RawFraming, Logger>;
+
+    ServerLoopback(const std::string& name, std::ostream& logStream, uint32_t numSlotsPerRing = 8,
+                   const ServerOptions& options = ServerOptions());
+
+    void eventLoop(ServerDelegate *serverDelegate = nullptr) override;
+
+    void stop() override;
+
+    ServerStats stats() const override;
+
+    ~ServerLoopback() override;
+
+    // Forbid copying
+
+    ServerLoopback(ServerLoopback&) = delete;
+    ServerLoopback operator=(ServerLoopback&) = delete;
+
+private:
+    Core<ServerDelegate> core;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+#include "busy_poll.h"
+#include "overload_guard.h"
+
+// TCP listening socket tuning. Zero values keep kernel defaults
+struct TcpListenerOptions {
+    // `TCP_DEFER_ACCEPT`: connection is reported to accept only once its first data arrives,
+    // or after this timeout. Saves a wakeup per connection for clients that talk first
+    int deferAcceptSeconds = 0;
+
+    // `TCP_FASTOPEN` queue length: number of pending Fast Open connections, 0 disables Fast Open.
+    // Kernel also has to allow it for servers in `net.ipv4.tcp_fastopen`
+    int fastOpenQueueLength = 0;
+
+    // `TCP_NODELAY`: send responses right away instead of waiting for outstanding ACKs (Nagle)
+    bool noDelay = false;
+
+    // `TCP_CORK`: send only full segments; server uncorks connections after each event loop
+    // iteration, so that responses gathered during the iteration leave in as few packets as possible
+    bool cork = false;
+
+    // `SO_ZEROCOPY`: responses of at least this many bytes are sent with `MSG_ZEROCOPY`, 0 disables it.
+    // Values below `StreamBackend::MIN_ZERO_COPY_BYTES` are raised to it, since pinning pages costs more than copying
+    size_t zeroCopyMinBytes = 0;
+};
+
+// How datagrams are spread over sharded UDP sockets
+enum class UdpSteering {
+    // Kernel default: hash of addresses and ports
+    Kernel,
+
+    // Datagram goes to shard `cpu % numShards` of the CPU that received it, so with shards pinned
+    // to CPUs in order a datagram is processed on the core which took it from the network
+    Cpu,
+
+    // Shard is chosen by source address and port with a classic BPF program
+    FlowHash
+};
+
+// UDP server sharding: `numShards` sockets bound to the same port with `SO_REUSEPORT`,
+// each one served by its own event loop thread
+struct UdpShardingOptions {
+    size_t numShards = 1;
+    UdpSteering steering = UdpSteering::Kernel;
+};
+
+// UDP segmentation offloads. Both are negotiated with the kernel at startup; if it refuses them
+// (or rejects a segmented send later), server falls back to a datagram per syscall slot
+struct UdpOffloadOptions {
+    // `UDP_SEGMENT` (GSO): same-size responses to one peer produced in one wakeup go out as a single
+    // large datagram which the stack splits into segments
+    bool segmentation = false;
+
+    // `UDP_GRO`: kernel coalesces bursts of same-size datagrams of a flow, server splits them back
+    bool receiveOffload = false;
+};
+
+// Event loops of `ServerCore` servers always account their wakeups, syscalls and busy time (see `ServerStats`).
+// With a positive threshold a watchdog thread also reports iterations busy for longer than it
+struct LoopWatchdogOptions {
+    long stallThresholdMs = 0;
+};
+
+// Optional server tuning knobs. Defaults reproduce plain behaviour without any extras
+struct ServerOptions {
+    OverloadLimits overload;
+    BusyPollOptions busyPoll;
+    TcpListenerOptions tcp;
+    UdpShardingOptions udp;
+    UdpOffloadOptions udpOffload;
+    LoopWatchdogOptions watchdog;
+
+    // Requests are recorded into this file for `replay` if it is not empty (TCP, UDP and unix sockets only)
+    std::string capturePath;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+
+#include <sys/uio.h>
+
+// Policies `ServerCore` is parameterized with. Everything here is inline on purpose,
+// so that the compiler sees the whole request path and drops disabled parts completely.
+
+// Mutex guarding records written into `stream`. Loggers of server shards and stall watchdogs write from
+// their own threads, so each record is written under the mutex of its stream. Others writing into the same
+// stream while servers run have to take it too
+inline std::mutex& getStreamMutex(const std::ostream& stream) {
+    static std::mutex registryMutex;
+    static std::unordered_map<const std::ostream*, std::unique_ptr<std::mutex>> mutexes;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::unique_ptr<std::mutex>& mutex = mutexes[&stream];
+
+    if (!mutex) {
+        mutex.reset(new std::mutex());
+    }
+
+    return *mutex;
+}
+
+// Writes log records into a stream, see `getStreamMutex`
+class StreamLogger {
+public:
+    static constexpr bool enabled = true;
+
+    explicit StreamLogger(std::ostream& stream) : stream(stream), mutex(&getStreamMutex(stream)) {}
+
+    template<typename... Args>
+    void log(const Args&... args) {
+        std::lock_guard<std::mutex> lock(*mutex);
+
+        using Expand = int[];
+        (void)Expand{ 0, ((stream << args), 0)... };
+        stream << std::endl;
+    }
+
+private:
+    std::ostream& stream;
+    std::mutex *mutex;
+};
+
+// Discards log records. Callers wrap expensive arguments with `if (Logger::enabled)`,
+// the rest is optimized away together with empty `log` calls
+class NullLogger {
+public:
+    static constexpr bool enabled = false;
+
+    explicit NullLogger(std::ostream&) {}
+
+    template<typename... Args>
+    void log(const Args&...) {}
+};
+
+// Treats every received chunk as a message and sends responses as is. This is what
+// datagram-like transports need, and what stream ones historically did.
+// Framings pass responses to `write` as chunks, so that headers are prepended without copying payload
+struct RawFraming {
+    template<typename Endpoint, typename OnMessage>
+    void onData(const Endpoint&, const char *data, size_t size, OnMessage&& onMessage) {
+        onMessage(data, size);
+    }
+
+    template<typename Endpoint, typename Write>
+    void write(const Endpoint&, const char *data, size_t size, Write&& write) {
+        const iovec chunk{ const_cast<char*>(data), size };
+        write(&chunk, 1);
+    }
+
+    template<typename Endpoint>
+    void onClose(const Endpoint&) {}
+};
+
+// Logs message payload without copying it. Binary protocol messages are not printed
+struct LoggedMessage {
+    const char *data;
+    size_t size;
+};
+
+inline std::ostream& operator<<(std::ostream& stream, const LoggedMessage& message) {
+    if (message.size > 0 && message.data[0] == '\0') {
+        return stream << "<binary>";
+    }
+
+    return stream.write(message.data, message.size);
+}
@@ -0,0 +1,436 @@
+#include <vector>
+#include <cstring>
+#include <cassert>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <socket_demo/defines.h>
+#include <socket_demo/server_delegate.h>
+
+#include "server_shm.h"
+#include "utils.h"
+
+void ServerShm::releaseConnection(const Connection& connection) {
+    shutdown(connection.controlFd, SHUT_RDWR);
+    close(connection.controlFd);
+    close(connection.requestEventFd);
+    close(connection.responseEventFd);
+    munmap(connection.segment, connection.segmentSize);
+}
+
+ServerShm::ServerShm(const std::string& socketPath, std::ostream& logStream, int maxNumConnections,
+                     uint32_t numSlotsPerRing, long spinMicroseconds, const ServerOptions& options,
+                     bool logRequests)
+    : logStream(logStream), socketPath(socketPath), numSlotsPerRing(numSlotsPerRing), spinMicroseconds(spinMicroseconds),
+      logRequests(logRequests), overloadGuard(options.overload)
+{
+    // 0. Init socket address
+
+    sockaddr_un socketAddress{};
+    std::memset(&socketAddress, 0, sizeof(socketAddress));
+
+    if (socketPath.empty() || socketPath.size() >= sizeof(socketAddress.sun_path)) {
+        throw std::invalid_argument("Invalid unix socket path: " + socketPath);
+    }
+
+    if (numSlotsPerRing == 0) {
+        throw std::invalid_argument("Number of ring slots should be a positive value");
+    }
+
+    if (spinMicroseconds < 0) {
+        throw std::invalid_argument("Spin duration should be a non-negative value");
+    }
+
+    // 1. Create control socket. It is used for handshake and to detect disconnected clients
+
+    FdGuard listeningSocket(socket(AF_UNIX, SOCK_STREAM, 0));
+
+    if (listeningSocket.get() < 0) {
+        throw std::runtime_error("Cannot create unix socket: " + getError());
+    }
+
+    // 2. Remove stale socket file, then bind and listen
+
+    socketAddress.sun_family = AF_UNIX;
+    std::strncpy(socketAddress.sun_path, socketPath.c_str(), sizeof(socketAddress.sun_path) - 1);
+
+    unlink(socketPath.c_str());
+
+    if (bind(listeningSocket.get(), reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) < 0) {
+        throw std::runtime_error("Cannot bind unix socket: " + getError());
+    }
+
+    if (listen(listeningSocket.get(), maxNumConnections) < 0) {
+        unlink(socketPath.c_str());
+        throw std::runtime_error("Cannot listen unix socket: " + getError());
+    }
+
+    // 3. Save listening socket and wakeup eventfd for polling
+
+    // Socket file is bound already, so it is removed if eventfd cannot be created
+
+    try {
+        wakeupFd = createEventFd();
+    } catch (...) {
+        unlink(socketPath.c_str());
+        throw;
+    }
+
+    descriptors.push_back({ .fd = listeningSocket.release(), .events = POLLIN, .revents = 0 });
+    descriptors.push_back({ .fd = wakeupFd, .events = POLLIN, .revents = 0 });
+
+    logStream << "Listening on " << socketPath << " (shared memory)" << std::endl;
+}
+
+void ServerShm::eventLoop(ServerDelegate *serverDelegate) {
+    const Clock::duration spinBudget = std::chrono::microseconds(spinMicroseconds);
+
+    // Control events are checked once per this number of iterations while rings are busy or spinning
+    static constexpr size_t NUM_ITERATIONS_PER_POLL = 64;
+
+    Clock::time_point lastActivity = Clock::now();
+    size_t numIterations = 0;
+
+    while (!isStopped.load(std::memory_order_acquire)) {
+        // 1. Serve rings without any syscalls while there is something to do
+
+        if (processRequests(serverDelegate) > 0) {
+            lastActivity = Clock::now();
+        }
+
+        // 2. Do not starve new connections and disconnections
+
+        if (++numIterations % NUM_ITERATIONS_PER_POLL == 0) {
+            handleEvents(0);
+            continue;
+        }
+
+        // 3. Spin for a while after the last activity, then go to sleep until eventfd or control
+        // socket wakes us up. Raised waiting flags make clients kick request eventfds
+
+        if (Clock::now() - lastActivity < spinBudget) {
+            continue;
+        }
+
+        // Clients do not signal freed response slots, so blocked connections are rechecked every millisecond
+
+        if (prepareToSleep()) {
+            handleEvents(hasBlockedConnections() ? 1 : -1);
+            lastActivity = Clock::now();
+        }
+
+        wakeUp();
+    }
+
+    // 4. Serve requests which are already in rings, connections are released on destruction
+
+    processRequests(serverDelegate);
+
+    logStream << "Exited the event loop" << std::endl;
+}
+
+void ServerShm::stop() {
+    isStopped.store(true, std::memory_order_release);
+    notifyEventFd(wakeupFd);
+}
+
+void ServerShm::handleEvents(int timeoutMs) {
+    if (poll(descriptors.data(), descriptors.size(), timeoutMs) < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+
+        throw std::runtime_error("Socket polling failed!");
+    }
+
+    assert(!descriptors.empty());
+
+    // 1. Handle new connections
+
+    if (descriptors[0].revents & POLLIN) {
+        acceptConnection();
+    }
+
+    // 2. Handle disconnections and reset fired eventfds. Requests are served by the event loop,
+    // wakeups only make it check whether it is stopped
+
+    if (descriptors[1].revents & POLLIN) {
+        drainEventFd(wakeupFd);
+    }
+
+    for (size_t i = 0; i < connections.size(); ++i) {
+        const pollfd& control = descriptors[FIRST_CONNECTION + 2 * i];
+        const pollfd& doorbell = descriptors[FIRST_CONNECTION + 1 + 2 * i];
+
+        if (doorbell.revents & POLLIN) {
+            drainEventFd(doorbell.fd);
+        }
+
+        if (control.revents & (POLLIN | POLLHUP | POLLERR)) {
+            // Clients never write to control socket, so readability means EOF
+            logStream << "Disconnected " << control.fd << std::endl;
+            closeConnection(i--);
+        }
+    }
+}
+
+size_t ServerShm::processRequests(ServerDelegate *serverDelegate) {
+    size_t numProcessed = 0;
+
+    // Requests wait in rings while connections before them are served, so lag is counted from the start
+    // of the pass, just as stream backend counts it from the wakeup
+    const Clock::time_point passStart = overloadGuard.isLagTracked() ? Clock::now() : Clock::time_point();
+
+    for (auto& connection: connections) {
+        // 1. Take no more than a ring worth of requests, so a busy client cannot starve the event loop, and no more
+        // than there are free response slots. The rest stay in the ring, so a pipelining client gets backpressure
+        // instead of losing responses. Admitted ones are processed right from shared memory, slots are released after that
+
+        batchRequests.clear();
+        batchAdmitted.clear();
+
+        const uint64_t maxTaken = std::min<uint64_t>(numSlotsPerRing, connection.responses.getNumFree());
+        connection.isBlocked = maxTaken == 0 && connection.requests.peek() != nullptr;
+
+        uint32_t numTaken = 0;
+
+        for (; numTaken < maxTaken; ++numTaken) {
+            const ShmSlot *request = connection.requests.peek(numTaken);
+
+            if (!request) {
+                break;
+            }
+
+            // Client is not trusted, so length is validated before use
+
+            const size_t length = std::min<size_t>(request->length, MAX_MESSAGE_LENGTH_BYTES);
+
+            const Clock::duration lag =
+                overloadGuard.isLagTracked() ? Clock::now() - passStart : Clock::duration::zero();
+            const OverloadGuard::Verdict verdict =
+                overloadGuard.admitConnectionRequest(connection.controlFd, length, lag);
+
+            batchAdmitted.push_back(verdict == OverloadGuard::Verdict::Accept);
+
+            // Flushing every record would cost a syscall per request, which this transport exists to avoid
+
+            if (batchAdmitted.back()) {
+                if (logRequests) {
+                    logStream << "Received message from " << connection.controlFd << " [" << length << "]\n";
+                }
+
+                batchRequests.push_back(RequestView{ request->data, length });
+            }
+        }
+
+        if (numTaken == 0) {
+            continue;
+        }
+
+        numProcessed += numTaken;
+
+        // 2. Process admitted requests, several of them at once if possible
+
+        const size_t numAdmitted = batchRequests.size();
+        batchResponses.resize(numAdmitted);
+
+        if (!serverDelegate) {
+            for (auto& response: batchResponses) {
+                response.clear();
+            }
+        } else if (numAdmitted == 1) {
+            batchResponses[0] = serverDelegate->process(std::string(batchRequests[0].data, batchRequests[0].size));
+        } else if (numAdmitted > 1) {
+            serverDelegate->processBatch(batchRequests.data(), batchResponses.data(), numAdmitted);
+        }
+
+        connection.requests.release(numTaken);
+
+        // 3. Copy responses into response slots. Empty responses are not sent, just as for sockets
+
+        size_t admittedIndex = 0;
+
+        for (uint32_t j = 0; j < numTaken; ++j) {
+            const std::string& response =
+                batchAdmitted[j] ? batchResponses[admittedIndex++] : overloadGuard.getLimits().rejectMessage;
+
+            if (response.empty()) {
+                continue;
+            }
+
+            // Free slots were counted before taking requests, only a client corrupting ring positions gets here
+
+            ShmSlot *slot = connection.responses.reserve();
+
+            if (!slot) {
+                logStream << "Response ring of " << connection.controlFd << " is corrupted" << std::endl;
+                break;
+            }
+
+            if (response.size() >= MAX_MESSAGE_LENGTH_BYTES) {
+                logStream << "Response is too long, it will be truncated to "
+                          << MAX_MESSAGE_LENGTH_BYTES << " bytes" << std::endl;
+            }
+
+            slot->length = std::min(response.size(), static_cast<size_t>(MAX_MESSAGE_LENGTH_BYTES));
+            std::memcpy(slot->data, response.data(), slot->length);
+
+            if (connection.responses.publish()) {
+                notifyEventFd(connection.responseEventFd);
+            }
+        }
+    }
+
+    return numProcessed;
+}
+
+bool ServerShm::prepareToSleep() {
+    for (auto& connection: connections) {
+        if (!connection.isBlocked && !connection.requests.prepareToSleep()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ServerShm::hasBlockedConnections() const {
+    for (const auto& connection: connections) {
+        if (connection.isBlocked) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ServerShm::wakeUp() {
+    for (auto& connection: connections) {
+        connection.requests.wakeUp();
+    }
+}
+
+void ServerShm::acceptConnection() {
+    int acceptedFd = accept(descriptors[0].fd, nullptr, nullptr);
+
+    if (acceptedFd < 0) {
+        logStream << "Cannot accept connection: " << getError() << std::endl;
+        return;
+    }
+
+    ucred credentials{};
+    socklen_t credentialsLength = sizeof(credentials);
+
+    if (getsockopt(acceptedFd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsLength) < 0) {
+        credentials.uid = 0;
+    }
+
+    if (!overloadGuard.admitConnection(acceptedFd, credentials.uid)) {
+        logStream << "Rejected connection: " << acceptedFd << std::endl;
+        close(acceptedFd);
+        return;
+    }
+
+    // 1. Create and map segment and eventfds
+
+    Connection connection{};
+    connection.controlFd = acceptedFd;
+    connection.segmentSize = shmSegmentSize(numSlotsPerRing);
+
+    int memoryFd = memfd_create("socket_demo_shm", MFD_CLOEXEC);
+    connection.requestEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    connection.responseEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    bool isCreated = memoryFd >= 0 && connection.requestEventFd >= 0 && connection.responseEventFd >= 0 &&
+                     ftruncate(memoryFd, connection.segmentSize) == 0;
+
+    if (isCreated) {
+        connection.segment = mmap(nullptr, connection.segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFd, 0);
+        isCreated = connection.segment != MAP_FAILED;
+    }
+
+    // 2. Hand segment and eventfds over to the client
+
+    if (isCreated) {
+        connection.requests = shmRequestRing(connection.segment, numSlotsPerRing);
+        connection.responses = shmResponseRing(connection.segment, numSlotsPerRing);
+        connection.requests.init();
+        connection.responses.init();
+
+        ShmHandshake handshake{ numSlotsPerRing };
+        const int fds[SHM_HANDSHAKE_NUM_FDS] = { memoryFd, connection.requestEventFd, connection.responseEventFd };
+
+        iovec iov{ &handshake, sizeof(handshake) };
+        char control[CMSG_SPACE(sizeof(fds))];
+        std::memset(control, 0, sizeof(control));
+
+        msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        isCreated = sendmsg(acceptedFd, &message, MSG_NOSIGNAL) == sizeof(handshake);
+    }
+
+    // Client holds its own reference to the segment now
+    if (memoryFd >= 0) {
+        close(memoryFd);
+    }
+
+    if (!isCreated) {
+        logStream << "Cannot set up shared memory for " << acceptedFd << ": " << getError() << std::endl;
+        overloadGuard.releaseConnection(acceptedFd);
+
+        if (connection.segment && connection.segment != MAP_FAILED) {
+            munmap(connection.segment, connection.segmentSize);
+        }
+
+        close(connection.requestEventFd);
+        close(connection.responseEventFd);
+        close(acceptedFd);
+        return;
+    }
+
+    logStream << "Accepted connection: " << acceptedFd << std::endl;
+
+    connections.push_back(connection);
+    descriptors.push_back({ .fd = acceptedFd, .events = POLLIN, .revents = 0 });
+    descriptors.push_back({ .fd = connection.requestEventFd, .events = POLLIN, .revents = 0 });
+}
+
+void ServerShm::closeConnection(size_t index) {
+    overloadGuard.releaseConnection(connections[index].controlFd);
+    releaseConnection(connections[index]);
+
+    connections.erase(connections.begin() + index);
+    descriptors.erase(descriptors.begin() + FIRST_CONNECTION + 2 * index,
+                      descriptors.begin() + FIRST_CONNECTION + 2 + 2 * index);
+}
+
+ServerStats ServerShm::stats() const {
+    ServerStats result;
+    overloadGuard.fillStats(result);
+    return result;
+}
+
+ServerShm::~ServerShm() {
+    for (const auto& connection: connections) {
+        releaseConnection(connection);
+    }
+
+    close(descriptors[0].fd);
+    close(wakeupFd);
+    unlink(socketPath.c_str());
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+
+#include <socket_demo/server.h>
+#include <socket_demo/server_delegate.h>
+
+#include "server_options.h"
+#include "shm_ring.h"
+
+// Shared memory server implementation for latency-critical co-located clients.
+// Clients connect to a unix control socket and receive a memfd segment with request/response rings
+// (see `shm_ring.h`). Requests are processed right from shared memory, responses are copied into response slots.
+// Event loop spins over rings for `spinMicroseconds` after the last activity and then sleeps on eventfds.
+// Requests are logged only if `logRequests` is set, connection events are logged always
+class ServerShm: public Server {
+public:
+    ServerShm(const std::string& socketPath, std::ostream& logStream, int maxNumConnections = 10,
+              uint32_t numSlotsPerRing = 8, long spinMicroseconds = 50,
+              const ServerOptions& options = ServerOptions(), bool logRequests = true);
+
+    void eventLoop(ServerDelegate *serverDelegate = nullptr) override;
+
+    void stop() override;
+
+    ServerStats stats() const override;
+
+    ~ServerShm() override;
+
+    // Forbid copying
+
+    ServerShm(ServerShm&) = delete;
+    ServerShm operator=(ServerShm&) = delete;
+
+private:
+    // Client state. Server consumes `requests` and produces `responses`
+    struct Connection {
+        int controlFd;
+        int requestEventFd;
+        int responseEventFd;
+        void *segment;
+        size_t segmentSize;
+        ShmRing requests;
+        ShmRing responses;
+
+        // Requests wait for the client to free response slots
+        bool isBlocked;
+    };
+
+    // Listening socket and wakeup eventfd go first in `descriptors`
+    static constexpr size_t FIRST_CONNECTION = 2;
+
+    static void releaseConnection(const Connection& connection);
+
+    // Creates segment for the new client and hands it over the control socket
+    void acceptConnection();
+
+    void closeConnection(size_t index);
+
+    // Polls control sockets and eventfds, accepts new clients and drops disconnected ones
+    void handleEvents(int timeoutMs);
+
+    // Processes requests available in rings, as many per connection as there are free response slots,
+    // so that every request gets its response slot and the rest stay in the ring. Returns number of processed requests
+    size_t processRequests(ServerDelegate *serverDelegate);
+
+    // Raises or clears waiting flags of all request rings. Returns false if any ring got a message,
+    // blocked connections are not taken into account
+    bool prepareToSleep();
+    bool hasBlockedConnections() const;
+    void wakeUp();
+
+    std::ostream& logStream;
+    std::string socketPath;
+    uint32_t numSlotsPerRing;
+    long spinMicroseconds;
+    bool logRequests;
+    OverloadGuard overloadGuard;
+    std::atomic<bool> isStopped{ false };
+    int wakeupFd;
+
+    // Listening socket and wakeup eventfd followed by control socket and request eventfd of each connection,
+    // i.e. connection `i` owns descriptors `FIRST_CONNECTION + 2 * i` and `FIRST_CONNECTION + 1 + 2 * i`
+    std::vector<pollfd> descriptors;
+    std::vector<Connection> connections;
+
+    // Requests taken from a single connection in one pass, buffers are reused between passes
+    std::vector<RequestView> batchRequests;
+    std::vector<bool> batchAdmitted;
+    std::vector<std::string> batchResponses;
+};
@@ -1,53 +1,19 @@
-#include <vector>
 #include <cstring>
-#include <csignal>
-#include <cassert>
 
-#include <poll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 
-#include <socket_demo/defines.h>
-#include <socket_demo/server_delegate.h>
-
 #include "server_tcp.h"
 #include "utils.h"
 
-// We store it globally since we are not able to make signal handler
-// stateful (i.e. class method).
-// This is definitely non-production solution, but let it be for this toy code.
-// Btw this automatically makes ServerUdp non thread safe.
-// Unlike UDP server case we store poll structures for alive connections.
-static std::vector<pollfd> descriptors;
-
-void ServerTcp::gracefulShutdown() {
-    for (const auto& descriptor: descriptors) {
-        shutdown(descriptor.fd, SHUT_RDWR);
-        close(descriptor.fd);
-    }
-
-    descriptors.erase(descriptors.begin(), descriptors.end());
-}
-
-void ServerTcp::signalHandler(int) {
-    gracefulShutdown();
-
-    std::exit(0);
-}
-
-ServerTcp::ServerTcp(uint16_t port, std::ostream& logStream, int maxNumConnections, long timeoutSeconds)
-    : logStream(logStream)
-{
+int ServerTcp::createListeningSocket(uint16_t port, int maxNumConnections, long timeoutSeconds,
+                                     const TcpListenerOptions& listenerOptions) {
     // 0. Init socket address
 
     sockaddr_in socketAddress{};
     std::memset(&socketAddress, 0, sizeof(socketAddress));
 
-    // 0.1. Set signal handlers
-
-    signal(SIGINT, signalHandler);
-    signal(SIGTERM, signalHandler);
-
     // 1. Create socket
 
     int listeningSocket = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -59,16 +25,19 @@ ServerTcp::ServerTcp(uint16_t port, std::ostream& logStream, int maxNumConnectio
     // 2. Set timeout on reading and writing
 
     if (timeoutSeconds <= 0) {
+        close(listeningSocket);
         throw std::runtime_error("Timeout should be a positive value");
     }
 
     timeval timeout{ timeoutSeconds, 0 };
 
     if (setsockopt(listeningSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        close(listeningSocket);
         throw std::runtime_error("Cannot set SO_RCVTIMEO: " + getError());
     }
 
     if (setsockopt(listeningSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+        close(listeningSocket);
         throw std::runtime_error("Cannot set SO_SNDTIMEO: " + getError());
     }
 
@@ -78,125 +47,111 @@ ServerTcp::ServerTcp(uint16_t port, std::ostream& logStream, int maxNumConnectio
         int enable = 1;
 
         if (setsockopt(listeningSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
+            close(listeningSocket);
             throw std::runtime_error("Cannot set SO_REUSEADDR: " + getError());
         }
 
         if (setsockopt(listeningSocket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
-            throw std::runtime_error("Cannot set SO_REUSEADDR: " + getError());
+            close(listeningSocket);
+            throw std::runtime_error("Cannot set SO_REUSEPORT: " + getError());
         }
     }
 
-    // 3. Bind and listen TCP socket
+    // 4. Set up optional accept tuning
 
-    socketAddress.sin_family = AF_INET;
-    socketAddress.sin_port = htons(port);
-    socketAddress.sin_addr.s_addr = htonl(INADDR_ANY);
-
-    if (bind(listeningSocket, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) < 0) {
-        close(listeningSocket);
-        throw std::runtime_error("Cannot bind TCP socket: " + getError());
+    if (listenerOptions.deferAcceptSeconds > 0) {
+        if (setsockopt(listeningSocket, IPPROTO_TCP, TCP_DEFER_ACCEPT, &listenerOptions.deferAcceptSeconds,
+                       sizeof(listenerOptions.deferAcceptSeconds)) < 0) {
+            close(listeningSocket);
+            throw std::runtime_error("Cannot set TCP_DEFER_ACCEPT: " + getError());
+        }
     }
 
-    if (listen(listeningSocket, maxNumConnections) < 0) {
-        close(listeningSocket);
-        throw std::runtime_error("Cannot listen TCP socket: " + getError());
+    if (listenerOptions.fastOpenQueueLength > 0) {
+        if (setsockopt(listeningSocket, IPPROTO_TCP, TCP_FASTOPEN, &listenerOptions.fastOpenQueueLength,
+                       sizeof(listenerOptions.fastOpenQueueLength)) < 0) {
+            close(listeningSocket);
+            throw std::runtime_error("Cannot set TCP_FASTOPEN: " + getError());
+        }
     }
 
-    // 4. Save listening socket for polling
-
-    descriptors.push_back({ .fd = listeningSocket, .events = POLLIN, .revents = 0 });
-
-    logStream << "Listening on " << port << std::endl;
-}
-
-void ServerTcp::eventLoop(ServerDelegate *serverDelegate) {
-    char *buffer = new char[MAX_MESSAGE_LENGTH_BYTES];
+    // Accepted connections inherit both
 
-    for (;;) {
-        // 1. Poll stored descriptors until new connection is requested or
-        // any connection socket is readable
+    if (listenerOptions.noDelay) {
+        const int enable = 1;
 
-        if (poll(descriptors.data(), descriptors.size(), -1) < 0) {
-            throw std::runtime_error("Socket polling failed!");
+        if (setsockopt(listeningSocket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) < 0) {
+            close(listeningSocket);
+            throw std::runtime_error("Cannot set TCP_NODELAY: " + getError());
         }
+    }
 
-        assert(!descriptors.empty());
-
-        // 2. Handle and try to accept new connection on listening socket
-
-        if (descriptors[0].revents & POLLIN) {
-            int acceptedFd;
-
-            acceptedFd = accept(descriptors[0].fd, nullptr, nullptr);
+    if (listenerOptions.cork) {
+        const int enable = 1;
 
-            if (acceptedFd < 0) {
-                logStream << "Cannot accept connection: " << getError() << std::endl;
-            } else {
-                logStream << "Accepted connection: " << acceptedFd << std::endl;
-                descriptors.push_back({ .fd = acceptedFd, .events = POLLIN, .revents = 0 });
-            }
+        if (setsockopt(listeningSocket, IPPROTO_TCP, TCP_CORK, &enable, sizeof(enable)) < 0) {
+            close(listeningSocket);
+            throw std::runtime_error("Cannot set TCP_CORK: " + getError());
         }
+    }
 
-        // 3. Poll other sockets
-
-        for (size_t i = 1; i < descriptors.size(); ++i) {
-            if (descriptors[i].revents & POLLIN) {
-                std::memset(buffer, 0, MAX_MESSAGE_LENGTH_BYTES);
-
-                // 3.1. Try to read from polled socket
+    // Kernel may lack zero copy support, which is worth knowing before serving
 
-                int numBytesReceived = recv(descriptors[i].fd, buffer, MAX_MESSAGE_LENGTH_BYTES, 0);
+    if (listenerOptions.zeroCopyMinBytes > 0) {
+        const int enable = 1;
 
-                if (numBytesReceived <= 0) {
-                    if (numBytesReceived == 0) {
-                        // 0 == client disconnected
-                        logStream << "Disconnected " << descriptors[i].fd << std::endl;
-                    } else {
-                        // -1 == reading error
-                        logStream << "Cannot read message from " << descriptors[i].fd
-                                  << ": " << getError() << std::endl;
-                    }
+        if (setsockopt(listeningSocket, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) < 0) {
+            close(listeningSocket);
+            throw std::runtime_error("Cannot set SO_ZEROCOPY: " + getError());
+        }
+    }
 
-                    // In both cases close this connection
+    // 5. Bind and listen TCP socket
 
-                    close(descriptors[i].fd);
-                    descriptors.erase(descriptors.begin() + i);
-                    continue;
-                }
+    socketAddress.sin_family = AF_INET;
+    socketAddress.sin_port = htons(port);
+    socketAddress.sin_addr.s_addr = htonl(INADDR_ANY);
 
-                // 3.2. If read was successful, process received message
+    if (bind(listeningSocket, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) < 0) {
+        close(listeningSocket);
+        throw std::runtime_error("Cannot bind TCP socket: " + getError());
+    }
 
-                logStream << "Received message from " << descriptors[i].fd << " [" << numBytesReceived
-                          << "]: " << buffer << std::endl;
+    if (listen(listeningSocket, maxNumConnections) < 0) {
+        close(listeningSocket);
+        throw std::runtime_error("Cannot listen TCP socket: " + getError());
+    }
 
-                std::string response;
+    return listeningSocket;
+}
 
-                if (serverDelegate) {
-                    response = serverDelegate->process(std::string(buffer, numBytesReceived));
-                }
+ServerTcp::ServerTcp(uint16_t port, std::ostream& logStream, int maxNumConnections, long timeoutSeconds,
+                     const ServerOptions& options)
+    : core(StreamLogger(logStream), FdGuard(createListeningSocket(port, maxNumConnections, timeoutSeconds, options.tcp)),
+           options.overload, options.busyPoll, options.tcp.zeroCopyMinBytes)
+{
+    core.setStallWatchdog(std::chrono::milliseconds(options.watchdog.stallThresholdMs), logStream);
 
-                // 3.3. Send response
+    if (!options.capturePath.empty()) {
+        capture.reset(new CaptureWriter(options.capturePath));
+        core.setCapture(capture.get(), CaptureProtocol::TCP);
+    }
 
-                if (!response.empty()) {
-                    if (response.size() >= MAX_MESSAGE_LENGTH_BYTES) {
-                        logStream << "Response is too long, it will be truncated to "
-                                  << MAX_MESSAGE_LENGTH_BYTES << " bytes" << std::endl;
-                    }
+    core.getLogger().log("Listening on ", port);
+}
 
-                    const int64_t actualResponseSize = std::min(response.size(), static_cast<size_t>(MAX_MESSAGE_LENGTH_BYTES));
+void ServerTcp::eventLoop(ServerDelegate *serverDelegate) {
+    core.run(serverDelegate);
+}
 
-                    if (send(descriptors[i].fd, response.data(), actualResponseSize, 0) != actualResponseSize) {
-                        logStream << "Cannot send message" << std::endl;
-                    }
-                }
-            }
-        }
-    }
+void ServerTcp::stop() {
+    core.stop();
+}
 
-    logStream << "Exited the event loop" << std::endl;
-    delete[] buffer;
+ServerStats ServerTcp::stats() const {
+    return core.stats();
 }
 
 ServerTcp::~ServerTcp() {
-    ServerTcp::gracefulShutdown();
-}
\ No newline at end of file
+    core.getBackend().shutdown();
+}
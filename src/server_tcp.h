@@ -1,32 +1,45 @@
 #pragma once
 
+#include <memory>
 #include <ostream>
 
 #include <socket_demo/server.h>
+#include <socket_demo/server_delegate.h>
 
-struct sockaddr_in;
+#include "capture.h"
+#include "server_core.h"
+#include "server_options.h"
+#include "stream_backend.h"
 
 // TCP server implementation
 class ServerTcp: public Server {
 public:
-    ServerTcp(uint16_t port, std::ostream& logStream, int maxNumConnections = 10, long timeoutSeconds = 5);
+    // Request path specialization behind this server. Use it directly with a concrete delegate
+    // and `NullLogger` to get the request path fully inlined
+    template<typename Delegate, typename Logger = StreamLogger>
+    using Core = ServerCore<Delegate, StreamBackend, RawFraming, Logger>;
+
+    ServerTcp(uint16_t port, std::ostream& logStream, int maxNumConnections = 10, long timeoutSeconds = 5,
+              const ServerOptions& options = ServerOptions());
 
     void eventLoop(ServerDelegate *serverDelegate = nullptr) override;
 
+    void stop() override;
+
+    ServerStats stats() const override;
+
     ~ServerTcp() override;
 
+    // Creates bound and listening TCP socket
+    static int createListeningSocket(uint16_t port, int maxNumConnections, long timeoutSeconds,
+                                     const TcpListenerOptions& listenerOptions = TcpListenerOptions());
+
     // Forbid copying
 
     ServerTcp(ServerTcp&) = delete;
     ServerTcp operator=(ServerTcp&) = delete;
 
 private:
-    // Shuts down and closes opened sockets. I am not sure if OS does not take care
-    // of it on process termination, so let it be
-    static void gracefulShutdown();
-
-    // Needed to invoke `gracefulShutdown` on SIGINT and SIGTERM
-    static void signalHandler(int);
-
-    std::ostream& logStream;
-};
\ No newline at end of file
+    Core<ServerDelegate> core;
+    std::unique_ptr<CaptureWriter> capture;
+};
@@ -1,48 +1,24 @@
-#include <vector>
+#include <thread>
+#include <utility>
 #include <cstring>
-#include <csignal>
+#include <stdexcept>
 
+#include <linux/filter.h>
 #include <netinet/in.h>
 #include <unistd.h>
-#include <arpa/inet.h>
-
-#include <socket_demo/defines.h>
-#include <socket_demo/server_delegate.h>
 
 #include "server_udp.h"
 #include "utils.h"
 
-// We store it globally since we are not able to make signal handler
-// stateful (i.e. class method).
-// This is definitely non-production solution, but let it be for this toy code.
-// Btw this automatically makes ServerUdp non thread safe.
-int udpSocketDescriptor;
-
-void ServerUdp::gracefulShutdown() {
-    shutdown(udpSocketDescriptor, SHUT_RDWR);
-    close(udpSocketDescriptor);
-}
-
-void ServerUdp::signalHandler(int) {
-    gracefulShutdown();
-    std::exit(0);
-}
-
-ServerUdp::ServerUdp(uint16_t port, std::ostream& logStream) : logStream(logStream)
-{
+int ServerUdp::createSocket(uint16_t port) {
     // 0. Init socket address
 
     sockaddr_in socketAddress{};
     std::memset(&socketAddress, 0, sizeof(socketAddress));
 
-    // 0.1. Set up signal handlers
-
-    signal(SIGINT, ServerUdp::signalHandler);
-    signal(SIGTERM, ServerUdp::signalHandler);
-
     // 1. Create UDP socket
 
-    udpSocketDescriptor = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int udpSocketDescriptor = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
 
     if (udpSocketDescriptor < 0) {
         throw std::runtime_error("Cannot create UDP socket: " + getError());
@@ -54,11 +30,13 @@ ServerUdp::ServerUdp(uint16_t port, std::ostream& logStream) : logStream(logStre
         int enable = 1;
 
         if (setsockopt(udpSocketDescriptor, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
+            close(udpSocketDescriptor);
             throw std::runtime_error("Cannot set SO_REUSEADDR: " + getError());
         }
 
         if (setsockopt(udpSocketDescriptor, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
-            throw std::runtime_error("Cannot set SO_REUSEADDR: " + getError());
+            close(udpSocketDescriptor);
+            throw std::runtime_error("Cannot set SO_REUSEPORT: " + getError());
         }
     }
 
@@ -73,76 +51,132 @@ ServerUdp::ServerUdp(uint16_t port, std::ostream& logStream) : logStream(logStre
         throw std::runtime_error("Cannot bind UDP socket: " + getError());
     }
 
-    logStream << "Listening on " << port << std::endl;
+    return udpSocketDescriptor;
 }
 
-void ServerUdp::eventLoop(ServerDelegate *serverDelegate) {
-    char *buffer = new char[MAX_MESSAGE_LENGTH_BYTES];
+std::vector<FdGuard> ServerUdp::createShardSockets(uint16_t port, const UdpShardingOptions& sharding) {
+    if (sharding.numShards == 0) {
+        throw std::invalid_argument("Number of UDP shards should be positive");
+    }
 
-    for (;;) {
-        // 0. Create client address
+    // 1. Create sockets. Kernel numbers sockets of the port group in order they are bound
 
-        socklen_t addressLength;
-        sockaddr_in clientAddress{};
+    std::vector<FdGuard> sockets;
+    sockets.reserve(sharding.numShards);
 
-        std::memset(&clientAddress, 0, sizeof(sockaddr_in));
-        addressLength = sizeof(clientAddress);
+    for (size_t i = 0; i < sharding.numShards; ++i) {
+        sockets.emplace_back(createSocket(port));
+    }
+
+    if (sharding.steering == UdpSteering::Kernel || sharding.numShards == 1) {
+        return sockets;
+    }
+
+    // 2. Attach steering program returning socket index. Reuseport programs see datagram payload,
+    // so addresses are loaded relative to the network header (IPv4 without options is assumed for port)
+
+    const uint32_t numShards = static_cast<uint32_t>(sharding.numShards);
+    std::vector<sock_filter> program;
+
+    if (sharding.steering == UdpSteering::Cpu) {
+        program = {
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, numShards),
+            BPF_STMT(BPF_RET | BPF_A, 0)
+        };
+    } else {
+        program = {
+            BPF_STMT(BPF_LD | BPF_H | BPF_ABS, static_cast<uint32_t>(SKF_NET_OFF + 20)),
+            BPF_STMT(BPF_MISC | BPF_TAX, 0),
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_NET_OFF + 12)),
+            BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+            BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, numShards),
+            BPF_STMT(BPF_RET | BPF_A, 0)
+        };
+    }
 
-        // 1. Read message
+    sock_fprog programDescription{ static_cast<unsigned short>(program.size()), program.data() };
 
-        std::memset(buffer, 0, MAX_MESSAGE_LENGTH_BYTES);
-        int numBytesReceived = recvfrom(udpSocketDescriptor, buffer, MAX_MESSAGE_LENGTH_BYTES,
-                                        0, reinterpret_cast<sockaddr*>(&clientAddress), &addressLength);
+    if (setsockopt(sockets[0].get(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &programDescription,
+                   sizeof(programDescription)) < 0) {
+        throw std::runtime_error("Cannot set SO_ATTACH_REUSEPORT_CBPF: " + getError());
+    }
 
-        if (numBytesReceived < 0) {
-            logStream << "Cannot read message: " << getError() << std::endl;
-        } else if (numBytesReceived == 0) {
-            logStream << "Message is empty" << std::endl;
-        } else {
-            // 2. Get client address
+    return sockets;
+}
 
-            char from[INET_ADDRSTRLEN + 1];
-            from[0] = '\0';
+BusyPollOptions ServerUdp::getShardBusyPollOptions(const BusyPollOptions& busyPoll, size_t index) {
+    BusyPollOptions shardBusyPoll = busyPoll;
 
-            if (inet_ntop(AF_INET, &clientAddress.sin_addr, from, INET_ADDRSTRLEN) != nullptr) {
-                logStream << "Received message from " << from << ":" << ntohs(clientAddress.sin_port)
-                          << " [" << numBytesReceived << "] : " << buffer << std::endl;
-            } else {
-                logStream << "Cannot convert address: " << getError() << std::endl;
-                logStream << "Received message from unknown address " << "[" << numBytesReceived
-                          << "] : " << buffer << std::endl;
-            }
+    if (!busyPoll.cpus.empty()) {
+        shardBusyPoll.cpus = { busyPoll.cpus[index % busyPoll.cpus.size()] };
+    }
 
-            // 3. Process message
+    return shardBusyPoll;
+}
 
-            std::string response;
+ServerUdp::ServerUdp(uint16_t port, std::ostream& logStream, const ServerOptions& options) {
+    // Sockets of shards which are not created yet are closed if a shard fails
 
-            if (serverDelegate) {
-                response = serverDelegate->process(std::string(buffer, numBytesReceived));
-            }
+    std::vector<FdGuard> sockets = createShardSockets(port, options.udp);
 
-            if (!response.empty()) {
-                if (response.size() >= MAX_MESSAGE_LENGTH_BYTES) {
-                    logStream << "Response is too long, it will be truncated to "
-                              << MAX_MESSAGE_LENGTH_BYTES << " bytes" << std::endl;
-                }
+    for (size_t i = 0; i < sockets.size(); ++i) {
+        shards.emplace_back(new Core<ServerDelegate>(StreamLogger(logStream), std::move(sockets[i]), options.overload,
+                                                     getShardBusyPollOptions(options.busyPoll, i), options.udpOffload));
+        shards.back()->setStallWatchdog(std::chrono::milliseconds(options.watchdog.stallThresholdMs), logStream);
+    }
 
-                const int64_t actualResponseSize = std::min(response.size(), static_cast<size_t>(MAX_MESSAGE_LENGTH_BYTES));
+    if (!options.capturePath.empty()) {
+        capture.reset(new CaptureWriter(options.capturePath));
 
-                if (sendto(udpSocketDescriptor, response.data(), actualResponseSize,
-                           MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&clientAddress),
-                           sizeof(clientAddress)) != actualResponseSize)
-                {
-                    logStream << "Cannot send message: " << getError() << std::endl;
-                }
-            }
+        for (const auto& shard: shards) {
+            shard->setCapture(capture.get(), CaptureProtocol::UDP);
         }
     }
 
-    logStream << "Exited the event loop" << std::endl;
-    delete[] buffer;
+    // Shards log through the same stream, so the record goes through a logger as well
+
+    if (shards.size() > 1) {
+        shards[0]->getLogger().log("Listening on ", port, " (", shards.size(), " shards)");
+    } else {
+        shards[0]->getLogger().log("Listening on ", port);
+    }
+}
+
+void ServerUdp::eventLoop(ServerDelegate *serverDelegate) {
+    std::vector<std::thread> threads;
+
+    for (size_t i = 1; i < shards.size(); ++i) {
+        Core<ServerDelegate> *shard = shards[i].get();
+
+        threads.emplace_back([shard, serverDelegate] { shard->run(serverDelegate); });
+    }
+
+    shards[0]->run(serverDelegate);
+
+    for (auto& thread: threads) {
+        thread.join();
+    }
+}
+
+void ServerUdp::stop() {
+    for (const auto& shard: shards) {
+        shard->stop();
+    }
+}
+
+ServerStats ServerUdp::stats() const {
+    ServerStats result;
+
+    for (const auto& shard: shards) {
+        result += shard->stats();
+    }
+
+    return result;
 }
 
 ServerUdp::~ServerUdp() {
-    ServerUdp::gracefulShutdown();
-}
\ No newline at end of file
+    for (const auto& shard: shards) {
+        shard->getBackend().shutdown();
+    }
+}
@@ -1,32 +1,53 @@
 #pragma once
 
+#include <memory>
+#include <vector>
 #include <ostream>
 
 #include <socket_demo/server.h>
+#include <socket_demo/server_delegate.h>
 
-struct sockaddr_in;
+#include "capture.h"
+#include "server_core.h"
+#include "server_options.h"
+#include "datagram_backend.h"
 
-// UDP server implementation
+// UDP server implementation. With several shards every shard has its own socket and event loop thread,
+// so the delegate has to be thread safe. Overload limits are tracked per shard
 class ServerUdp: public Server {
 public:
-    ServerUdp(uint16_t port, std::ostream& logStream);
+    // Request path specialization behind this server, see `ServerTcp::Core`
+    template<typename Delegate, typename Logger = StreamLogger>
+    using Core = ServerCore<Delegate, DatagramBackend, RawFraming, Logger>;
+
+    ServerUdp(uint16_t port, std::ostream& logStream, const ServerOptions& options = ServerOptions());
 
     void eventLoop(ServerDelegate *serverDelegate = nullptr) override;
 
+    void stop() override;
+
+    ServerStats stats() const override;
+
     ~ServerUdp() override;
 
+    // Creates bound UDP socket
+    static int createSocket(uint16_t port);
+
+    // Creates `numShards` sockets bound to the same port and attaches steering program to them
+    static std::vector<FdGuard> createShardSockets(uint16_t port, const UdpShardingOptions& sharding);
+
+    // Shard `index` is pinned to a single CPU of `busyPoll.cpus` (round robin)
+    static BusyPollOptions getShardBusyPollOptions(const BusyPollOptions& busyPoll, size_t index);
+
     // Forbid copying
 
     ServerUdp(ServerUdp&) = delete;
     ServerUdp operator=(ServerUdp&) = delete;
 
 private:
-    // Shuts down and closes opened sockets. I am not sure if OS does not take care
-    // of it on process termination, so let it be
-    static void gracefulShutdown();
-
-    // Needed to invoke `gracefulShutdown` on SIGINT and SIGTERM
-    static void signalHandler(int);
+    // Shard 0 runs on the thread calling `eventLoop`
+    std::vector<std::unique_ptr<Core<ServerDelegate>>> shards;
 
-    std::ostream& logStream;
-};
\ No newline at end of file
+    // Shared by all shards
+    std::unique_ptr<CaptureWriter> capture;
+};
@@ -0,0 +1,108 @@
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server_unix.h"
+#include "utils.h"
+
+int ServerUnix::createListeningSocket(const std::string& socketPath, int socketType, int maxNumConnections,
+                                      long timeoutSeconds)
+{
+    // 0. Init socket address
+
+    sockaddr_un socketAddress{};
+    std::memset(&socketAddress, 0, sizeof(socketAddress));
+
+    if (socketType != SOCK_STREAM && socketType != SOCK_SEQPACKET) {
+        throw std::invalid_argument("Unix socket type should be SOCK_STREAM or SOCK_SEQPACKET");
+    }
+
+    if (socketPath.empty() || socketPath.size() >= sizeof(socketAddress.sun_path)) {
+        throw std::invalid_argument("Invalid unix socket path: " + socketPath);
+    }
+
+    // 1. Create socket
+
+    int listeningSocket = socket(AF_UNIX, socketType, 0);
+
+    if (listeningSocket < 0) {
+        throw std::runtime_error("Cannot create unix socket: " + getError());
+    }
+
+    // 2. Set timeout on reading and writing
+
+    if (timeoutSeconds <= 0) {
+        close(listeningSocket);
+        throw std::runtime_error("Timeout should be a positive value");
+    }
+
+    timeval timeout{ timeoutSeconds, 0 };
+
+    if (setsockopt(listeningSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        close(listeningSocket);
+        throw std::runtime_error("Cannot set SO_RCVTIMEO: " + getError());
+    }
+
+    if (setsockopt(listeningSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+        close(listeningSocket);
+        throw std::runtime_error("Cannot set SO_SNDTIMEO: " + getError());
+    }
+
+    // 3. Remove stale socket file left by previous run (there is no SO_REUSEADDR for unix sockets),
+    // then bind and listen
+
+    socketAddress.sun_family = AF_UNIX;
+    std::strncpy(socketAddress.sun_path, socketPath.c_str(), sizeof(socketAddress.sun_path) - 1);
+
+    unlink(socketPath.c_str());
+
+    if (bind(listeningSocket, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) < 0) {
+        close(listeningSocket);
+        throw std::runtime_error("Cannot bind unix socket: " + getError());
+    }
+
+    if (listen(listeningSocket, maxNumConnections) < 0) {
+        close(listeningSocket);
+        unlink(socketPath.c_str());
+        throw std::runtime_error("Cannot listen unix socket: " + getError());
+    }
+
+    return listeningSocket;
+}
+
+ServerUnix::ServerUnix(const std::string& socketPath, int socketType, std::ostream& logStream,
+                       int maxNumConnections, long timeoutSeconds, const ServerOptions& options)
+    : socketPath(socketPath),
+      core(StreamLogger(logStream),
+           FdGuard(createListeningSocket(socketPath, socketType, maxNumConnections, timeoutSeconds)),
+           options.overload, options.busyPoll)
+{
+    core.setStallWatchdog(std::chrono::milliseconds(options.watchdog.stallThresholdMs), logStream);
+
+    if (!options.capturePath.empty()) {
+        capture.reset(new CaptureWriter(options.capturePath));
+        core.setCapture(capture.get(),
+                        socketType == SOCK_SEQPACKET ? CaptureProtocol::SEQPACKET : CaptureProtocol::UNIX);
+    }
+
+    core.getLogger().log("Listening on ", socketPath, socketType == SOCK_SEQPACKET ? " (SEQPACKET)" : "");
+}
+
+void ServerUnix::eventLoop(ServerDelegate *serverDelegate) {
+    core.run(serverDelegate);
+}
+
+void ServerUnix::stop() {
+    core.stop();
+}
+
+ServerStats ServerUnix::stats() const {
+    return core.stats();
+}
+
+ServerUnix::~ServerUnix() {
+    core.getBackend().shutdown();
+    unlink(socketPath.c_str());
+}
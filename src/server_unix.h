@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include <socket_demo/server.h>
+#include <socket_demo/server_delegate.h>
+
+#include "capture.h"
+#include "server_core.h"
+#include "server_options.h"
+#include "stream_backend.h"
+
+// Unix domain socket server implementation for co-located clients. Supports both SOCK_STREAM
+// (same semantics as TCP) and SOCK_SEQPACKET (reliable and preserves message boundaries)
+class ServerUnix: public Server {
+public:
+    // Request path specialization behind this server, see `ServerTcp::Core`
+    template<typename Delegate, typename Logger = StreamLogger>
+    using Core = ServerCore<Delegate, StreamBackend, RawFraming, Logger>;
+
+    ServerUnix(const std::string& socketPath, int socketType, std::ostream& logStream,
+               int maxNumConnections = 10, long timeoutSeconds = 5,
+               const ServerOptions& options = ServerOptions());
+
+    void eventLoop(ServerDelegate *serverDelegate = nullptr) override;
+
+    void stop() override;
+
+    ServerStats stats() const override;
+
+    ~ServerUnix() override;
+
+    // Creates bound and listening unix socket, removing stale socket file if any
+    static int createListeningSocket(const std::string& socketPath, int socketType, int maxNumConnections,
+                                     long timeoutSeconds);
+
+    // Forbid copying
+
+    ServerUnix(ServerUnix&) = delete;
+    ServerUnix operator=(ServerUnix&) = delete;
+
+private:
+    std::string socketPath;
+    Core<ServerDelegate> core;
+    std::unique_ptr<CaptureWriter> capture;
+};
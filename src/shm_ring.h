@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#include <unistd.h>
+
+#include <socket_demo/defines.h>
+
+#include "utils.h"
+
+// Shared memory transport building blocks. Each client owns a memfd segment holding two
+// single-producer single-consumer rings: requests (client -> server) and responses (server -> client).
+// Messages are stored in fixed-size slots, so both sides may access them in place.
+// Consumer announces it is going to sleep with `consumerWaiting` flag, and producer kicks eventfd
+// only in this case, so there are no syscalls on the hot path while consumer spins.
+
+struct ShmSlot {
+    uint32_t length;
+    char data[MAX_MESSAGE_LENGTH_BYTES];
+};
+
+struct ShmRingHeader {
+    // Consumer and producer positions live on separate cache lines to avoid false sharing
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic<uint32_t> consumerWaiting;
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared memory rings require address-free atomics");
+
+// Non-owning view over a ring placed in shared memory
+class ShmRing {
+public:
+    ShmRing() = default;
+
+    ShmRing(void *memory, uint32_t numSlots)
+        : header(static_cast<ShmRingHeader*>(memory)),
+          slots(reinterpret_cast<ShmSlot*>(static_cast<char*>(memory) + slotsOffset())),
+          numSlots(numSlots)
+    {}
+
+    // Number of bytes occupied by a ring with `numSlots` slots
+    static size_t mappingSize(uint32_t numSlots) {
+        return slotsOffset() + sizeof(ShmSlot) * numSlots;
+    }
+
+    // Must be called once by the side creating the segment
+    void init() {
+        header->head.store(0);
+        header->tail.store(0);
+        header->consumerWaiting.store(0);
+    }
+
+    // Producer side: returns free slot to fill or nullptr if ring is full
+    ShmSlot *reserve() {
+        const uint64_t tail = header->tail.load(std::memory_order_relaxed);
+
+        if (tail - header->head.load(std::memory_order_acquire) >= numSlots) {
+            return nullptr;
+        }
+
+        return &slots[tail % numSlots];
+    }
+
+    // Producer side: number of slots `reserve` may fill one after another. Consumer only frees more of them meanwhile
+    uint64_t getNumFree() const {
+        const uint64_t numUsed =
+            header->tail.load(std::memory_order_relaxed) - header->head.load(std::memory_order_acquire);
+        return numUsed >= numSlots ? 0 : numSlots - numUsed;
+    }
+
+    // Producer side: makes reserved slot visible. Returns true if consumer sleeps and has to be woken up.
+    // Sequential consistency pairs with `prepareToSleep` so that either producer sees the flag,
+    // or consumer sees the new message
+    bool publish() {
+        header->tail.fetch_add(1, std::memory_order_seq_cst);
+        return header->consumerWaiting.load(std::memory_order_seq_cst) != 0;
+    }
+
+    // Consumer side: returns `offset`-th oldest message or nullptr if ring holds fewer messages
+    const ShmSlot *peek(uint64_t offset = 0) const {
+        const uint64_t head = header->head.load(std::memory_order_relaxed) + offset;
+
+        if (offset >= numSlots || head >= header->tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        return &slots[head % numSlots];
+    }
+
+    // Consumer side: frees `count` oldest slots returned by `peek`
+    void release(uint64_t count = 1) {
+        header->head.fetch_add(count, std::memory_order_release);
+    }
+
+    // Consumer side: raises waiting flag. Returns false if ring got a message meanwhile,
+    // i.e. consumer should not sleep
+    bool prepareToSleep() {
+        header->consumerWaiting.store(1, std::memory_order_seq_cst);
+
+        return header->head.load(std::memory_order_relaxed) == header->tail.load(std::memory_order_seq_cst);
+    }
+
+    void wakeUp() {
+        header->consumerWaiting.store(0, std::memory_order_relaxed);
+    }
+
+    bool isValid() const { return header != nullptr; }
+
+private:
+    static size_t slotsOffset() {
+        return (sizeof(ShmRingHeader) + alignof(ShmSlot) - 1) / alignof(ShmSlot) * alignof(ShmSlot);
+    }
+
+    ShmRingHeader *header = nullptr;
+    ShmSlot *slots = nullptr;
+    uint32_t numSlots = 0;
+};
+
+// Layout of the per-client segment: requests ring followed by responses ring
+inline size_t shmSegmentSize(uint32_t numSlots) {
+    const size_t ringSize = (ShmRing::mappingSize(numSlots) + 63) / 64 * 64;
+    return 2 * ringSize;
+}
+
+inline ShmRing shmRequestRing(void *segment, uint32_t numSlots) {
+    return ShmRing(segment, numSlots);
+}
+
+inline ShmRing shmResponseRing(void *segment, uint32_t numSlots) {
+    const size_t ringSize = (ShmRing::mappingSize(numSlots) + 63) / 64 * 64;
+    return ShmRing(static_cast<char*>(segment) + ringSize, numSlots);
+}
+
+// Handshake sent by server over the unix control socket together with
+// memfd, request eventfd and response eventfd (in this order) as SCM_RIGHTS
+struct ShmHandshake {
+    uint32_t numSlots;
+};
+
+static constexpr int SHM_HANDSHAKE_NUM_FDS = 3;
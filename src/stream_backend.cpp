@@ -0,0 +1,472 @@
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <unistd.h>
+
+#include "stream_backend.h"
+
+constexpr size_t StreamBackend::MIN_ZERO_COPY_BYTES;
+constexpr int StreamBackend::CLOSING_POLL_PERIOD_MS;
+constexpr std::chrono::seconds StreamBackend::MAX_SHUTDOWN_WAIT;
+
+StreamBackend::StreamBackend(FdGuard listeningSocket, const OverloadLimits& limits,
+                             const BusyPollOptions& busyPollOptions, size_t zeroCopyMinBytes)
+    : buffer(new char[MAX_MESSAGE_LENGTH_BYTES]), overloadGuard(limits), busyPollOptions(busyPollOptions),
+      busyPoller(busyPollOptions), zeroCopyMinBytes(0)
+{
+    // Draining the backlog must not block once it is empty
+
+    const int flags = fcntl(listeningSocket.get(), F_GETFL, 0);
+
+    if (flags < 0 || fcntl(listeningSocket.get(), F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw std::runtime_error("Cannot make listening socket non-blocking: " + getError());
+    }
+
+    timeval sendTimeout{};
+    socklen_t sendTimeoutLength = sizeof(sendTimeout);
+
+    if (getsockopt(listeningSocket.get(), SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, &sendTimeoutLength) < 0 ||
+        (sendTimeout.tv_sec == 0 && sendTimeout.tv_usec == 0)) {
+        sendTimeoutMs = -1;
+    } else {
+        sendTimeoutMs = static_cast<int>(sendTimeout.tv_sec * 1000 + sendTimeout.tv_usec / 1000);
+    }
+
+    int socketType = 0;
+    socklen_t socketTypeLength = sizeof(socketType);
+    isPacketOriented = getsockopt(listeningSocket.get(), SOL_SOCKET, SO_TYPE, &socketType, &socketTypeLength) == 0 &&
+                       socketType == SOCK_SEQPACKET;
+
+    // Fails for unix sockets, which means no cork
+
+    int cork = 0;
+    socklen_t corkLength = sizeof(cork);
+    isCorked = getsockopt(listeningSocket.get(), IPPROTO_TCP, TCP_CORK, &cork, &corkLength) == 0 && cork != 0;
+
+    // Zero copy has to be allowed on the listening socket, which is possible for TCP only
+
+    int zeroCopy = 0;
+    socklen_t zeroCopyLength = sizeof(zeroCopy);
+
+    if (zeroCopyMinBytes > 0 && !isPacketOriented &&
+        getsockopt(listeningSocket.get(), SOL_SOCKET, SO_ZEROCOPY, &zeroCopy, &zeroCopyLength) == 0 && zeroCopy != 0) {
+        this->zeroCopyMinBytes = std::max(zeroCopyMinBytes, MIN_ZERO_COPY_BYTES);
+    }
+
+    wakeupFd = createEventFd();
+
+    descriptors.push_back({ .fd = listeningSocket.get(), .events = POLLIN, .revents = 0 });
+    descriptors.push_back({ .fd = wakeupFd, .events = POLLIN, .revents = 0 });
+    listeningSocket.release();
+}
+
+StreamBackend::~StreamBackend() {
+    shutdown();
+    close(wakeupFd);
+}
+
+int StreamBackend::acceptConnection() {
+    sockaddr_storage peerAddress{};
+    socklen_t peerAddressLength = sizeof(peerAddress);
+
+    countSyscalls();
+
+    int acceptedFd = accept4(descriptors[0].fd, reinterpret_cast<sockaddr*>(&peerAddress), &peerAddressLength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (acceptedFd < 0) {
+        return -1;
+    }
+
+    acceptedConnections.fetch_add(1, std::memory_order_relaxed);
+
+    // Peers are told apart by IPv4 address, unix peers have no address so user id is used instead
+
+    uint32_t peerKey = 0;
+
+    if (peerAddress.ss_family == AF_INET) {
+        peerKey = ntohl(reinterpret_cast<sockaddr_in*>(&peerAddress)->sin_addr.s_addr);
+    } else if (peerAddress.ss_family == AF_UNIX) {
+        ucred credentials{};
+        socklen_t credentialsLength = sizeof(credentials);
+
+        if (getsockopt(acceptedFd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsLength) == 0) {
+            peerKey = credentials.uid;
+        }
+    }
+
+    if (!overloadGuard.admitConnection(acceptedFd, peerKey)) {
+        countSyscalls();
+        close(acceptedFd);
+        return REJECTED_CONNECTION;
+    }
+
+    descriptors.push_back({ .fd = acceptedFd, .events = POLLIN, .revents = 0 });
+
+    if (static_cast<size_t>(acceptedFd) >= connectionNumbers.size()) {
+        connectionNumbers.resize(acceptedFd + 1, 0);
+    }
+
+    connectionNumbers[acceptedFd] = ++lastConnectionNumber;
+
+    // Connections inherit `SO_ZEROCOPY`, but sends are tracked only if it is surely set: otherwise kernel
+    // ignores `MSG_ZEROCOPY` and completions never come
+
+    if (zeroCopyMinBytes > 0) {
+        const int enable = 1;
+
+        if (setsockopt(acceptedFd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) == 0) {
+            zeroCopyConnections[acceptedFd];
+        }
+    }
+
+    return acceptedFd;
+}
+
+void StreamBackend::closeConnection(size_t index) {
+    const int fd = descriptors[index].fd;
+
+    overloadGuard.releaseConnection(fd);
+    descriptors.erase(descriptors.begin() + index);
+
+    // Completions cannot be read after close, so connection with sends in flight only stops sending
+    // and is closed once the kernel has released all its buffers
+
+    auto zeroCopy = zeroCopyConnections.find(fd);
+
+    if (zeroCopy != zeroCopyConnections.end()) {
+        readZeroCopyCompletions(fd, zeroCopy->second);
+
+        if (!zeroCopy->second.sends.empty()) {
+            countSyscalls();
+            ::shutdown(fd, SHUT_WR);
+            closingConnections.push_back(fd);
+            return;
+        }
+
+        zeroCopyConnections.erase(zeroCopy);
+    }
+
+    countSyscalls();
+    close(fd);
+}
+
+void StreamBackend::releaseClosingConnections() {
+    for (size_t i = 0; i < closingConnections.size();) {
+        const int fd = closingConnections[i];
+        auto zeroCopy = zeroCopyConnections.find(fd);
+
+        readZeroCopyCompletions(fd, zeroCopy->second);
+
+        if (!zeroCopy->second.sends.empty()) {
+            ++i;
+            continue;
+        }
+
+        zeroCopyConnections.erase(zeroCopy);
+        countSyscalls();
+        close(fd);
+
+        closingConnections[i] = closingConnections.back();
+        closingConnections.pop_back();
+    }
+}
+
+void StreamBackend::queue(Endpoint fd, const iovec *chunks, size_t numChunks) {
+    pendingMessages.push_back({ fd, pendingChunks.size(), numChunks });
+    pendingChunks.insert(pendingChunks.end(), chunks, chunks + numChunks);
+}
+
+bool StreamBackend::sendPending(int fd, size_t firstMessage, size_t lastMessage) {
+    bool isSent = true;
+
+    if (isPacketOriented) {
+        for (size_t i = firstMessage; i < lastMessage && isSent; ++i) {
+            const PendingMessage& message = pendingMessages[i];
+            isSent = sendChunks(fd, &pendingChunks[message.firstChunk], message.numChunks);
+        }
+    } else {
+        sendingChunks.clear();
+
+        for (size_t i = firstMessage; i < lastMessage; ++i) {
+            const PendingMessage& message = pendingMessages[i];
+            sendingChunks.insert(sendingChunks.end(), pendingChunks.begin() + message.firstChunk,
+                                 pendingChunks.begin() + message.firstChunk + message.numChunks);
+        }
+
+        auto zeroCopy = zeroCopyConnections.find(fd);
+
+        if (zeroCopy == zeroCopyConnections.end()) {
+            isSent = sendChunks(fd, sendingChunks.data(), sendingChunks.size());
+        } else {
+            isSent = sendWithZeroCopy(fd, zeroCopy->second, sendingChunks.data(), sendingChunks.size());
+        }
+    }
+
+    if (isCorked) {
+        countSyscalls(2);
+
+        int value = 0;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+
+        value = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+    }
+
+    return isSent;
+}
+
+bool StreamBackend::sendWithZeroCopy(int fd, ZeroCopyConnection& zeroCopy, iovec *chunks, size_t numChunks) {
+    // Runs of large chunks go with zero copy and the rest is copied as usual, one after another to keep the order
+
+    for (size_t first = 0; first < numChunks;) {
+        const bool isLarge = chunks[first].iov_len >= zeroCopyMinBytes;
+        size_t last = first + 1;
+
+        while (last < numChunks && (chunks[last].iov_len >= zeroCopyMinBytes) == isLarge) {
+            ++last;
+        }
+
+        if (!isLarge) {
+            if (!sendChunks(fd, chunks + first, last - first)) {
+                return false;
+            }
+
+            first = last;
+            continue;
+        }
+
+        // Chunk addresses are remembered before sending advances them, buffers are kept until the last call
+        // which sent any of them completes (even if sending fails later, data which has been sent stays in flight)
+
+        const size_t firstChunk = zeroCopyChunks.size();
+        const size_t numSends = zeroCopy.sends.size();
+
+        for (size_t i = first; i < last; ++i) {
+            zeroCopyChunks.push_back({ static_cast<const char*>(chunks[i].iov_base), nullptr });
+        }
+
+        const bool isSent = sendChunks(fd, chunks + first, last - first, &zeroCopy);
+
+        if (zeroCopy.sends.size() > numSends) {
+            for (size_t i = firstChunk; i < zeroCopyChunks.size(); ++i) {
+                zeroCopyChunks[i].send = &zeroCopy.sends.back();
+            }
+        } else {
+            zeroCopyChunks.resize(firstChunk);
+        }
+
+        if (!isSent) {
+            return false;
+        }
+
+        first = last;
+    }
+
+    return true;
+}
+
+bool StreamBackend::sendChunks(int fd, iovec *chunks, size_t numChunks, ZeroCopyConnection *zeroCopy) {
+    while (numChunks > 0) {
+        // Packet has to go out in a single call, stream may be split at IOV_MAX
+
+        msghdr message{};
+        message.msg_iov = chunks;
+        message.msg_iovlen = isPacketOriented ? numChunks : std::min<size_t>(numChunks, IOV_MAX);
+
+        countSyscalls();
+        const ssize_t result = sendmsg(fd, &message, MSG_NOSIGNAL | (zeroCopy ? MSG_ZEROCOPY : 0));
+
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // Out of memory for completion notifications: the rest is copied
+            if (errno == ENOBUFS && zeroCopy) {
+                zeroCopy = nullptr;
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+
+            // Socket buffer is full: wait for the peer to read, as a blocking socket would
+
+            pollfd descriptor{ .fd = fd, .events = POLLOUT, .revents = 0 };
+
+            countSyscalls();
+
+            if (poll(&descriptor, 1, sendTimeoutMs) <= 0) {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (zeroCopy) {
+            zeroCopy->sends.push_back({ static_cast<size_t>(result), false, {} });
+        }
+
+        // Skip fully sent chunks and move into the partially sent one
+
+        size_t numBytesSent = static_cast<size_t>(result);
+
+        while (numChunks > 0 && numBytesSent >= chunks->iov_len) {
+            numBytesSent -= chunks->iov_len;
+            ++chunks;
+            --numChunks;
+        }
+
+        if (numChunks > 0) {
+            chunks->iov_base = static_cast<char*>(chunks->iov_base) + numBytesSent;
+            chunks->iov_len -= numBytesSent;
+        }
+    }
+
+    return true;
+}
+
+bool StreamBackend::readZeroCopyCompletions(int fd, ZeroCopyConnection& zeroCopy) {
+    bool isRead = false;
+
+    for (;;) {
+        char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+
+        msghdr message{};
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        countSyscalls();
+
+        if (recvmsg(fd, &message, MSG_ERRQUEUE) < 0) {
+            break;
+        }
+
+        isRead = true;
+
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+
+            const sock_extended_err *error = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cmsg));
+
+            if (error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            // Notification covers the range of calls `[ee_info, ee_data]`, ids wrap around
+
+            const bool isCopied = (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+            uint64_t numBytes = 0;
+
+            for (uint32_t id = error->ee_info; ; ++id) {
+                const uint32_t index = id - zeroCopy.firstId;
+
+                if (index < zeroCopy.sends.size() && !zeroCopy.sends[index].isCompleted) {
+                    zeroCopy.sends[index].isCompleted = true;
+                    numBytes += zeroCopy.sends[index].numBytes;
+                }
+
+                if (id == error->ee_data) {
+                    break;
+                }
+            }
+
+            (isCopied ? zeroCopyCopiedBytes : zeroCopySentBytes).fetch_add(numBytes, std::memory_order_relaxed);
+        }
+    }
+
+    releaseCompletedSends(zeroCopy);
+
+    return isRead;
+}
+
+void StreamBackend::releaseCompletedSends(ZeroCopyConnection& zeroCopy) {
+    while (!zeroCopy.sends.empty() && zeroCopy.sends.front().isCompleted) {
+        for (auto& sendBuffer: zeroCopy.sends.front().buffers) {
+            recycleBuffer(sendBuffer);
+        }
+
+        zeroCopy.sends.pop_front();
+        ++zeroCopy.firstId;
+    }
+}
+
+void StreamBackend::recycleBuffer(std::string& sendBuffer) {
+    if (freeBuffers.size() < MAX_FREE_BUFFERS) {
+        sendBuffer.clear();
+        freeBuffers.push_back(std::move(sendBuffer));
+    }
+}
+
+void StreamBackend::retainResponses(std::vector<std::string>& responses) {
+    // Swap buffers sent with zero copy for recycled ones, so that `ServerCore` does not overwrite them
+
+    if (!zeroCopyChunks.empty()) {
+        for (auto& response: responses) {
+            if (response.empty()) {
+                continue;
+            }
+
+            for (auto& chunk: zeroCopyChunks) {
+                if (chunk.send && chunk.data == response.data()) {
+                    chunk.send->buffers.emplace_back();
+                    chunk.send->buffers.back().swap(response);
+
+                    if (!freeBuffers.empty()) {
+                        response.swap(freeBuffers.back());
+                        freeBuffers.pop_back();
+                    }
+
+                    chunk.send = nullptr;
+                    break;
+                }
+            }
+        }
+
+        zeroCopyChunks.clear();
+    }
+}
+
+void StreamBackend::shutdown() {
+    // 1. Let connections with zero copy sends in flight finish sending, kernel reads their buffers until then
+
+    while (descriptors.size() > FIRST_CONNECTION) {
+        closeConnection(descriptors.size() - 1);
+    }
+
+    const Clock::time_point deadline = Clock::now() + MAX_SHUTDOWN_WAIT;
+
+    while (!closingConnections.empty() && Clock::now() < deadline) {
+        poll(nullptr, 0, CLOSING_POLL_PERIOD_MS);
+        releaseClosingConnections();
+    }
+
+    // 2. Freed buffers could be reused while the kernel still sends them, so the rest are left allocated
+
+    for (int fd: closingConnections) {
+        new std::deque<ZeroCopySend>(std::move(zeroCopyConnections[fd].sends));
+        close(fd);
+    }
+
+    closingConnections.clear();
+    zeroCopyConnections.clear();
+
+    // 3. Wakeup eventfd stays open until destruction, so that late `wakeUp` calls never hit a reused descriptor
+
+    for (const auto& descriptor: descriptors) {
+        if (descriptor.fd >= 0 && descriptor.fd != wakeupFd) {
+            close(descriptor.fd);
+        }
+    }
+
+    descriptors.clear();
+}
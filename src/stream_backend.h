@@ -0,0 +1,418 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cerrno>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <socket_demo/defines.h>
+#include <socket_demo/server_stats.h>
+
+#include "busy_poll.h"
+#include "overload_guard.h"
+#include "trace.h"
+#include "utils.h"
+
+// `ServerCore` backend for connection-oriented sockets (TCP, unix stream and seqpacket).
+// Polls the listening socket and wakeup eventfd together with connection sockets; each successful read is reported
+// as data of the connection it came from. All sockets are non-blocking.
+//
+// TCP responses of at least `zeroCopyMinBytes` may be sent with `MSG_ZEROCOPY`. The kernel then reads them
+// from user memory after `sendmsg` returns, so backend takes their buffers over in `retainResponses` and
+// recycles them only once completion notifications arrive to the socket error queue
+class StreamBackend {
+public:
+    // Connection socket descriptor
+    using Endpoint = int;
+
+    static constexpr bool repliesToRejected = true;
+
+    // Lower bound of zero copy threshold: smaller sends are cheaper to copy than to pin
+    static constexpr size_t MIN_ZERO_COPY_BYTES = 4096;
+
+    // Takes ownership of bound and listening socket, which is closed if construction fails.
+    // Zero copy sends are used only if `zeroCopyMinBytes` is not 0 and the listening socket has `SO_ZEROCOPY` set
+    StreamBackend(FdGuard listeningSocket, const OverloadLimits& limits,
+                  const BusyPollOptions& busyPollOptions = BusyPollOptions(), size_t zeroCopyMinBytes = 0);
+
+    ~StreamBackend();
+
+    // Forbid copying
+
+    StreamBackend(StreamBackend&) = delete;
+    StreamBackend operator=(StreamBackend&) = delete;
+
+    template<typename Handler>
+    void start(Handler& handler) {
+        enterLatencyMode(descriptors[0].fd, busyPollOptions, handler.getLogger());
+    }
+
+    template<typename Handler>
+    void wait(Handler& handler);
+
+    template<typename Handler>
+    void drain(Handler& handler);
+
+    void wakeUp() {
+        notifyEventFd(wakeupFd);
+    }
+
+    void queue(Endpoint fd, const iovec *chunks, size_t numChunks);
+
+    template<typename Handler>
+    void flushSends(Handler& handler);
+
+    // Takes over response buffers the last `flushSends` sent with zero copy, leaving recycled ones in their place
+    void retainResponses(std::vector<std::string>& responses);
+
+    OverloadGuard::Verdict admit(Endpoint fd, size_t size, Clock::duration lag, size_t numRequests) {
+        return overloadGuard.admitConnectionRequest(fd, size, lag, numRequests);
+    }
+
+    const OverloadGuard& getOverloadGuard() const { return overloadGuard; }
+
+    // Descriptors are reused, so connections are told apart by their numbers, counted from 1
+    uint64_t getCapturePeer(Endpoint fd) const {
+        return static_cast<size_t>(fd) < connectionNumbers.size() ? connectionNumbers[fd] : 0;
+    }
+
+    void fillStats(ServerStats& stats) const {
+        overloadGuard.fillStats(stats);
+        busyPoller.fillStats(stats);
+        stats.acceptedConnections = acceptedConnections.load(std::memory_order_relaxed);
+        stats.acceptWakeups = acceptWakeups.load(std::memory_order_relaxed);
+        stats.zeroCopySentBytes = zeroCopySentBytes.load(std::memory_order_relaxed);
+        stats.zeroCopyCopiedBytes = zeroCopyCopiedBytes.load(std::memory_order_relaxed);
+        stats.loopSyscalls = syscalls.load(std::memory_order_relaxed);
+    }
+
+    // Shuts down and closes all sockets. Connections with zero copy sends in flight are waited for
+    // at most `MAX_SHUTDOWN_WAIT` first. Must not be called while event loop is running
+    void shutdown();
+
+private:
+    // Listening socket and wakeup eventfd go first in `descriptors`
+    static constexpr size_t FIRST_CONNECTION = 2;
+
+    // Returned by `acceptConnection` if connection has been closed because of connection caps
+    static constexpr int REJECTED_CONNECTION = -2;
+
+    // Bounds the time single wakeup spends accepting, so that existing connections are served too
+    static constexpr size_t MAX_ACCEPTS_PER_WAKEUP = 1024;
+
+    // Accepts pending connection respecting connection caps. Returns accepted non-blocking descriptor,
+    // `REJECTED_CONNECTION` or -1 on accept failure (`errno` tells why, EAGAIN means backlog is empty)
+    int acceptConnection();
+
+    void closeConnection(size_t index);
+
+    // Event loop thread is the only writer
+    void countSyscalls(uint64_t count = 1) {
+        syscalls.store(syscalls.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    }
+
+    // Reads connections `poll` reported as readable and reports what they sent
+    template<typename Handler>
+    void receive(Handler& handler, Clock::time_point wakeupTime);
+
+    // Zero copy `sendmsg` call waiting for its completion. Buffers are attached to the last call sending from them
+    struct ZeroCopySend {
+        size_t numBytes;
+        bool isCompleted;
+        std::vector<std::string> buffers;
+    };
+
+    // Zero copy sends of a connection. Kernel numbers them from 0 in order of calls
+    struct ZeroCopyConnection {
+        uint32_t firstId = 0;
+        std::deque<ZeroCopySend> sends;
+    };
+
+    // Chunk sent with zero copy during the current flush, waiting for `retainResponses`
+    struct ZeroCopyChunk {
+        const char *data;
+        ZeroCopySend *send;
+    };
+
+    // Closing connections are not polled, so their completions are checked at least this often
+    static constexpr int CLOSING_POLL_PERIOD_MS = 10;
+
+    // Time `shutdown` waits for completions of closing connections. Buffers of sends which are still
+    // in flight afterwards are never freed
+    static constexpr std::chrono::seconds MAX_SHUTDOWN_WAIT{ 1 };
+
+    // Recycled buffers kept at most
+    static constexpr size_t MAX_FREE_BUFFERS = 64;
+
+    // Sends all `chunks` with as few `sendmsg` calls as possible, waiting for buffer space if needed.
+    // Advances `chunks` as they are sent. Calls are made with `MSG_ZEROCOPY` and recorded if `zeroCopy` is given
+    bool sendChunks(int fd, iovec *chunks, size_t numChunks, ZeroCopyConnection *zeroCopy = nullptr);
+
+    // Sends queued messages of `fd`. Packet-oriented sockets get a packet per message
+    bool sendPending(int fd, size_t firstMessage, size_t lastMessage);
+
+    // Sends chunks of a stream connection, large ones with zero copy
+    bool sendWithZeroCopy(int fd, ZeroCopyConnection& zeroCopy, iovec *chunks, size_t numChunks);
+
+    // Reads completion notifications from the error queue of `fd` and recycles buffers of completed sends.
+    // Returns false if there were none
+    bool readZeroCopyCompletions(int fd, ZeroCopyConnection& zeroCopy);
+
+    // Recycles buffers of completed sends from the oldest one
+    void releaseCompletedSends(ZeroCopyConnection& zeroCopy);
+
+    // Reads completions of closing connections and closes those whose sends have all completed
+    void releaseClosingConnections();
+
+    void recycleBuffer(std::string& buffer);
+
+    // Listening socket and wakeup eventfd go first, connections follow
+    std::vector<pollfd> descriptors;
+    int wakeupFd;
+    std::unique_ptr<char[]> buffer;
+    OverloadGuard overloadGuard;
+    BusyPollOptions busyPollOptions;
+    BusyPoller busyPoller;
+
+    // Connections are non-blocking, so sending waits for buffer space itself, at most for
+    // the send timeout of the listening socket
+    int sendTimeoutMs;
+
+    // Connections inherit socket type and `TCP_CORK` from the listening socket. Corked connections
+    // are uncorked after each flush, otherwise kernel would hold the tail of responses
+    bool isPacketOriented;
+    bool isCorked;
+
+    // Responses queued during the current wakeup
+    struct PendingMessage {
+        int fd;
+        size_t firstChunk;
+        size_t numChunks;
+    };
+
+    std::vector<PendingMessage> pendingMessages;
+    std::vector<iovec> pendingChunks;
+    std::vector<iovec> sendingChunks;
+
+    size_t zeroCopyMinBytes;
+    std::unordered_map<int, ZeroCopyConnection> zeroCopyConnections;
+    std::vector<ZeroCopyChunk> zeroCopyChunks;
+    std::vector<std::string> freeBuffers;
+
+    // Connections closed with zero copy sends in flight. They are shut down for writing, but stay open
+    // in `zeroCopyConnections`: completions cannot be read after close, and buffers are reused only after them
+    std::vector<int> closingConnections;
+
+    // Numbers of open connections by descriptor, see `getCapturePeer`
+    std::vector<uint64_t> connectionNumbers;
+    uint64_t lastConnectionNumber = 0;
+
+    std::atomic<uint64_t> acceptedConnections{ 0 };
+    std::atomic<uint64_t> acceptWakeups{ 0 };
+    std::atomic<uint64_t> zeroCopySentBytes{ 0 };
+    std::atomic<uint64_t> zeroCopyCopiedBytes{ 0 };
+    std::atomic<uint64_t> syscalls{ 0 };
+};
+
+template<typename Handler>
+void StreamBackend::wait(Handler& handler) {
+    // 1. Poll stored descriptors until new connection is requested or
+    // any connection socket is readable. In latency mode spin for a while before blocking
+
+    int numReady = 0;
+
+    if (busyPoller.isEnabled()) {
+        numReady = busyPoller.spin([this] {
+            countSyscalls();
+            return poll(descriptors.data(), descriptors.size(), 0);
+        });
+    }
+
+    if (numReady == 0) {
+        TraceSpan span("poll");
+        countSyscalls();
+        const int timeoutMs = closingConnections.empty() ? -1 : CLOSING_POLL_PERIOD_MS;
+        numReady = poll(descriptors.data(), descriptors.size(), timeoutMs);
+    }
+
+    if (numReady < 0) {
+        if (errno == EINTR) {
+            return;
+        }
+
+        throw std::runtime_error("Socket polling failed!");
+    }
+
+    if (!closingConnections.empty()) {
+        releaseClosingConnections();
+    }
+
+    if (numReady == 0) {
+        return;
+    }
+
+    handler.onWakeup();
+
+    // Requests handled later in this iteration have been waiting since the wakeup
+
+    const Clock::time_point wakeupTime = overloadGuard.isLagTracked() ? Clock::now() : Clock::time_point();
+
+    // 2. Drain the backlog of listening socket, so that connection storms do not overflow it
+
+    if (descriptors[0].revents & POLLIN) {
+        TraceSpan span("accept");
+
+        acceptWakeups.fetch_add(1, std::memory_order_relaxed);
+
+        for (size_t numAttempts = 0; numAttempts < MAX_ACCEPTS_PER_WAKEUP; ++numAttempts) {
+            const int acceptedFd = acceptConnection();
+
+            if (acceptedFd >= 0) {
+                handler.getLogger().log("Accepted connection: ", acceptedFd);
+            } else if (acceptedFd == REJECTED_CONNECTION) {
+                handler.getLogger().log("Rejected connection because of connection caps");
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno != ECONNABORTED && errno != EINTR) {
+                // E.g. out of descriptors: keep the rest queued until the next wakeup
+                if (Handler::Logger::enabled) {
+                    handler.getLogger().log("Cannot accept connection: ", getError());
+                }
+
+                break;
+            }
+        }
+    }
+
+    // 3. Read connections, wakeups only make `wait` return
+
+    if (descriptors[1].revents & POLLIN) {
+        countSyscalls();
+        drainEventFd(wakeupFd);
+    }
+
+    receive(handler, wakeupTime);
+
+    // 4. Process whatever all readable connections sent in one go
+
+    handler.flush();
+}
+
+template<typename Handler>
+void StreamBackend::drain(Handler& handler) {
+    // 1. Stop accepting, connections still in the backlog are reset when the socket is closed
+
+    if (descriptors[0].fd >= 0) {
+        close(descriptors[0].fd);
+        descriptors[0].fd = -1;
+    }
+
+    // 2. Serve what connections have sent so far, once
+
+    if (poll(descriptors.data(), descriptors.size(), 0) > 0) {
+        receive(handler, Clock::now());
+        handler.flush();
+    }
+
+    // 3. Close connections, responses have been sent already
+
+    while (descriptors.size() > FIRST_CONNECTION) {
+        const int fd = descriptors.back().fd;
+
+        handler.getLogger().log("Closed connection: ", fd);
+        handler.onClose(fd);
+        closeConnection(descriptors.size() - 1);
+    }
+}
+
+template<typename Handler>
+void StreamBackend::receive(Handler& handler, Clock::time_point wakeupTime) {
+    for (size_t i = FIRST_CONNECTION; i < descriptors.size(); ++i) {
+        if (!(descriptors[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+
+        const int fd = descriptors[i].fd;
+
+        // Zero copy completions make the socket report an error until the error queue is read
+
+        if (descriptors[i].revents & POLLERR) {
+            auto zeroCopy = zeroCopyConnections.find(fd);
+
+            // Real socket errors are reported by `recv` below
+
+            if (zeroCopy != zeroCopyConnections.end() && readZeroCopyCompletions(fd, zeroCopy->second) &&
+                !(descriptors[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+        }
+
+        TraceSpan recvSpan("recv");
+        countSyscalls();
+        const ssize_t numBytesReceived = recv(fd, buffer.get(), MAX_MESSAGE_LENGTH_BYTES, 0);
+        recvSpan.end();
+
+        // Connections are non-blocking, readiness may turn out to be spurious
+        if (numBytesReceived < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            continue;
+        }
+
+        if (numBytesReceived <= 0) {
+            if (numBytesReceived == 0) {
+                // 0 == client disconnected
+                handler.getLogger().log("Disconnected ", fd);
+            } else if (Handler::Logger::enabled) {
+                // -1 == reading error
+                handler.getLogger().log("Cannot read message from ", fd, ": ", getError());
+            }
+
+            // In both cases close this connection
+
+            handler.onClose(fd);
+            closeConnection(i--);
+            continue;
+        }
+
+        const Clock::duration lag = overloadGuard.isLagTracked() ? Clock::now() - wakeupTime : Clock::duration::zero();
+
+        handler.onData(fd, buffer.get(), static_cast<size_t>(numBytesReceived), lag);
+    }
+}
+
+template<typename Handler>
+void StreamBackend::flushSends(Handler& handler) {
+    TraceSpan span("send");
+
+    // Responses of a connection are usually adjacent already, stable sort only groups stray ones
+    // without reordering them
+
+    std::stable_sort(pendingMessages.begin(), pendingMessages.end(),
+                     [](const PendingMessage& a, const PendingMessage& b) { return a.fd < b.fd; });
+
+    for (size_t first = 0; first < pendingMessages.size();) {
+        const int fd = pendingMessages[first].fd;
+        size_t last = first + 1;
+
+        while (last < pendingMessages.size() && pendingMessages[last].fd == fd) {
+            ++last;
+        }
+
+        if (!sendPending(fd, first, last)) {
+            handler.getLogger().log("Cannot send message to ", fd);
+        }
+
+        first = last;
+    }
+
+    pendingMessages.clear();
+    pendingChunks.clear();
+}
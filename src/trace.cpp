@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+namespace {
+
+struct TraceEvent {
+    const char *name;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+};
+
+// Keeps the latest `CAPACITY` spans of a thread. Mutex is taken only for sampled spans and dumps
+struct TraceRing {
+    static constexpr size_t CAPACITY = 1 << 16;
+
+    std::mutex mutex;
+    long threadId = 0;
+    uint64_t numRecorded = 0;
+    std::vector<TraceEvent> events;
+};
+
+// Rings outlive their threads, so spans of finished threads can still be dumped
+std::mutex ringsMutex;
+std::vector<std::shared_ptr<TraceRing>> rings;
+
+const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+TraceRing& getThreadRing() {
+    static thread_local TraceRing *threadRing = nullptr;
+
+    if (!threadRing) {
+        std::shared_ptr<TraceRing> ring = std::make_shared<TraceRing>();
+        ring->threadId = syscall(SYS_gettid);
+        ring->events.resize(TraceRing::CAPACITY);
+
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.push_back(ring);
+        threadRing = ring.get();
+    }
+
+    return *threadRing;
+}
+
+double toMicroseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+} // namespace
+
+std::atomic<uint32_t>& traceSamplingPeriod() {
+    static std::atomic<uint32_t> period{ 0 };
+    return period;
+}
+
+void setTraceSampling(uint32_t period) {
+    traceSamplingPeriod().store(period, std::memory_order_relaxed);
+}
+
+void recordTraceSpan(const char *name, std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point end) {
+    TraceRing& ring = getThreadRing();
+
+    std::lock_guard<std::mutex> lock(ring.mutex);
+    ring.events[ring.numRecorded++ % TraceRing::CAPACITY] = TraceEvent{ name, start, end };
+}
+
+void writeChromeTrace(std::ostream& stream) {
+    const long processId = getpid();
+
+    stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+    bool isFirst = true;
+
+    std::lock_guard<std::mutex> ringsLock(ringsMutex);
+
+    for (const auto& ring: rings) {
+        std::lock_guard<std::mutex> lock(ring->mutex);
+
+        // Oldest span first: once the ring wrapped, it is the one to be overwritten next
+
+        const uint64_t numEvents = std::min<uint64_t>(ring->numRecorded, TraceRing::CAPACITY);
+        const uint64_t first = ring->numRecorded - numEvents;
+
+        for (uint64_t i = first; i < ring->numRecorded; ++i) {
+            const TraceEvent& event = ring->events[i % TraceRing::CAPACITY];
+
+            // Stream formatting would switch large timestamps to exponent notation
+            char record[256];
+            std::snprintf(record, sizeof(record),
+                          "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}",
+                          isFirst ? "\n" : ",\n", event.name, processId, ring->threadId,
+                          toMicroseconds(event.start - traceEpoch), toMicroseconds(event.end - event.start));
+
+            stream << record;
+
+            isFirst = false;
+        }
+    }
+
+    stream << "\n]}" << std::endl;
+}
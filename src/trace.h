@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Sampled tracing of request lifecycles. Tracing is enabled with `setTraceSampling`, then each event loop
+// calls `beginTraceIteration` once per iteration, and every `samplingPeriod`-th iteration of the thread
+// records its `TraceSpan`s (recv, process, send, parse, sort, ...) into the thread's ring buffer.
+// `writeChromeTrace` dumps rings of all threads as Chrome Trace Event JSON, which opens in Perfetto.
+// Unsampled spans cost a thread-local flag check
+
+// Returns true if the current thread is inside a sampled iteration
+inline bool& isTraceSampled() {
+    static thread_local bool isSampled = false;
+    return isSampled;
+}
+
+// Sampling period shared by all threads, 0 disables tracing
+std::atomic<uint32_t>& traceSamplingPeriod();
+
+// Traces one of every `period` event loop iterations, 0 disables tracing
+void setTraceSampling(uint32_t period);
+
+inline void beginTraceIteration() {
+    static thread_local uint32_t numIterations = 0;
+
+    const uint32_t period = traceSamplingPeriod().load(std::memory_order_relaxed);
+
+    isTraceSampled() = period != 0 && ++numIterations % period == 0;
+}
+
+// Records span into the current thread's ring. `name` has to be a string literal (it is stored as is)
+void recordTraceSpan(const char *name, std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point end);
+
+// Measures lifetime of the scope (or until `end`) if the current iteration is sampled
+class TraceSpan {
+public:
+    explicit TraceSpan(const char *name) : name(name), isActive(isTraceSampled()) {
+        if (isActive) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceSpan() {
+        end();
+    }
+
+    void end() {
+        if (isActive) {
+            recordTraceSpan(name, start, std::chrono::steady_clock::now());
+            isActive = false;
+        }
+    }
+
+    // Forbid copying
+
+    TraceSpan(TraceSpan&) = delete;
+    TraceSpan operator=(TraceSpan&) = delete;
+
+private:
+    const char *name;
+    bool isActive;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Writes spans kept by all threads as Chrome Trace Event JSON. Safe to call while threads are tracing
+void writeChromeTrace(std::ostream& stream);
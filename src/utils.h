@@ -2,8 +2,80 @@
 
 #include <string>
 #include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 // Transforms errno to std::string
 inline std::string getError() {
     return std::string(std::strerror(errno));
-}
\ No newline at end of file
+}
+
+// Creates non-blocking eventfd used to wake up a poll loop
+inline int createEventFd() {
+    const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create eventfd: " + getError());
+    }
+
+    return fd;
+}
+
+inline void notifyEventFd(int fd) {
+    const uint64_t value = 1;
+    ssize_t result = write(fd, &value, sizeof(value));
+    (void)result;
+}
+
+inline void drainEventFd(int fd) {
+    uint64_t value;
+    ssize_t result = read(fd, &value, sizeof(value));
+    (void)result;
+}
+
+// Owns a descriptor and closes it unless ownership is given away with `release`
+class FdGuard {
+public:
+    explicit FdGuard(int fd = -1) : fd(fd) {}
+
+    FdGuard(FdGuard&& other) : fd(other.release()) {}
+
+    FdGuard& operator=(FdGuard&& other) {
+        if (this != &other) {
+            reset(other.release());
+        }
+
+        return *this;
+    }
+
+    ~FdGuard() {
+        reset();
+    }
+
+    // Forbid copying
+
+    FdGuard(const FdGuard&) = delete;
+    FdGuard& operator=(const FdGuard&) = delete;
+
+    int get() const { return fd; }
+
+    int release() {
+        const int released = fd;
+        fd = -1;
+        return released;
+    }
+
+    void reset(int newFd = -1) {
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        fd = newFd;
+    }
+
+private:
+    int fd;
+};
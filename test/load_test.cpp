@@ -0,0 +1,274 @@
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "client_factory.h"
+#include "command_line.h"
+#include "binary_protocol.h"
+#include "echo_server_delegate.h"
+#include "server_loopback.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Builds a message of roughly `size` bytes consisting of space separated numbers
+std::string generateNumbersMessage(size_t size) {
+    std::string result;
+    result.reserve(size + 8);
+
+    for (size_t i = 0; result.size() < size; ++i) {
+        result += std::to_string(i * 7919 % 100000);
+        result += ' ';
+    }
+
+    result.resize(std::max<size_t>(size, 1));
+
+    return result;
+}
+
+// Builds binary protocol request of roughly `size` bytes
+std::string generateBinaryMessage(size_t size) {
+    std::vector<Number> numbers(std::max<size_t>(1, std::min(size / sizeof(Number), BINARY_MAX_NUMBERS)));
+
+    for (size_t i = 0; i < numbers.size(); ++i) {
+        numbers[i] = static_cast<Number>(i * 7919 % 100000);
+    }
+
+    std::string result;
+    encodeBinaryRequest(numbers, result);
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+    static const uint8_t numRequiredParameters = 3;
+
+    CommandLineOptions options;
+    argc = extractOptions(argc, argv, options);
+
+    if (argc < numRequiredParameters + 1) {
+        std::cout << "Usage: " << argv[0]
+                  << " <server_address> <port> <protocol:TCP|UDP|UNIX|SEQPACKET|SHM|LOOPBACK>"
+                     " [num_connections] [num_requests] [message_size]\n"
+                  << "e.g. " << argv[0] << " 127.0.0.1 8888 TCP 8 10000 64\n"
+                  << "Arguments:\n"
+                  << "* server_address - server address, socket path for unix protocols or server name for LOOPBACK\n"
+                  << "* port - port to use (ignored for unix protocols and LOOPBACK)\n"
+                  << "* protocol - protocol to use ('TCP', 'UDP', 'UNIX', 'SEQPACKET', 'SHM' or 'LOOPBACK').\n"
+                  << "  LOOPBACK starts echo server inside this process and talks to it without sockets,\n"
+                  << "  which shows the cost of the server code itself\n"
+                  << "* num_connections - number of simultaneous connections (threads), default is 1\n"
+                  << "* num_requests - number of sequential round trips per connection, default is 10000\n"
+                  << "* message_size - request size in bytes, default is 64\n"
+                  << "Options:\n"
+                  << "* --binary - send numbers using binary protocol\n"
+                  << "* --fast-open - connect with TCP Fast Open (only when TCP is used)\n"
+                  << "* --spin-us=N - LOOPBACK server spins N microseconds before it sleeps, default is 0\n"
+                  << "* --burst=N - send N requests at once with `sendBatch`, then wait for their responses,"
+                     " default is 1 (not used for TCP and UNIX, which have no message boundaries)\n"
+                  << "* --udp-gso, --udp-gro - let UDP client use segmentation offloads (see --burst)\n"
+                  << "* --udp-coalesce - connections share one UDP client packing their requests into shared datagrams\n"
+                  << "* --linger-us=N, --max-datagram=N - how long coalesced requests wait for others and size limit\n"
+                  << "  of their datagrams, defaults are 100 and 1472 (see --udp-coalesce)\n"
+                  << "Run it against servers of different protocols to compare their round trip costs"
+                  << std::endl;
+        return 0;
+    }
+
+    // 1. Parse arguments
+
+    const std::string serverAddress = argv[1];
+    const std::string protocol(argv[3]);
+
+    const bool isLoopback = protocol == "LOOPBACK";
+
+    if (!isValidProtocol(protocol) && !isLoopback) {
+        std::cerr << "Invalid protocol : " << argv[3] << std::endl;
+        return 1;
+    }
+
+    uint16_t port = 0;
+    size_t numConnections = 1;
+    size_t numRequests = 10000;
+    size_t messageSize = 64;
+
+    try {
+        if (!isUnixProtocol(protocol) && !isLoopback) {
+            port = std::stoi(argv[2]);
+        }
+
+        if (argc > 4) {
+            numConnections = std::stoull(argv[4]);
+        }
+
+        if (argc > 5) {
+            numRequests = std::stoull(argv[5]);
+        }
+
+        if (argc > 6) {
+            messageSize = std::stoull(argv[6]);
+        }
+    } catch (...) {
+        std::cerr << "Invalid arguments" << std::endl;
+        return 1;
+    }
+
+    bool useBinary = false;
+    ClientOptions clientOptions;
+    BusyPollOptions loopbackBusyPoll;
+    size_t burst = 1;
+
+    if (!getOption(options, "binary", useBinary) || !getOption(options, "fast-open", clientOptions.tcpFastOpen) ||
+        !getOption(options, "spin-us", loopbackBusyPoll.spinMicroseconds) || !getOption(options, "burst", burst) ||
+        !getOption(options, "udp-gso", clientOptions.udpSegmentation) ||
+        !getOption(options, "udp-gro", clientOptions.udpReceiveOffload) ||
+        !getOption(options, "udp-coalesce", clientOptions.udpCoalescing.enabled) ||
+        !getOption(options, "linger-us", clientOptions.udpCoalescing.lingerMicroseconds) ||
+        !getOption(options, "max-datagram", clientOptions.udpCoalescing.maxDatagramBytes) ||
+        !checkUnknownOptions(options))
+    {
+        return 1;
+    }
+
+    // Responses of a shared client are received in order of all its requests, so bursts need a single connection
+
+    const bool isCoalescing = clientOptions.udpCoalescing.enabled;
+
+    if (isCoalescing && (protocol != "UDP" || (burst > 1 && numConnections > 1))) {
+        std::cerr << "Coalescing is supported by UDP only, and bursts need a single connection then" << std::endl;
+        return 1;
+    }
+
+    if (burst == 0 || (burst > 1 && (protocol == "TCP" || protocol == "UNIX"))) {
+        std::cerr << "Burst should be positive and is supported by message oriented protocols only" << std::endl;
+        return 1;
+    }
+
+    // 2. Host LOOPBACK server. Logging is compiled out, so that only the request path is measured
+
+    using LoopbackCore = ServerLoopback::Core<EchoServerDelegate, NullLogger>;
+
+    std::unique_ptr<LoopbackCore> loopbackServer;
+    EchoServerDelegate echoDelegate;
+    std::thread loopbackThread;
+
+    if (isLoopback) {
+        try {
+            loopbackServer.reset(new LoopbackCore(NullLogger(std::cerr), LoopbackListener::create(serverAddress, 8),
+                                                  OverloadLimits(), loopbackBusyPoll));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        loopbackThread = std::thread([&] { loopbackServer->run(&echoDelegate); });
+    }
+
+    // 3. Run round trips from multiple threads, each thread keeps its own latencies.
+    // In burst mode latency of a response is counted from the moment the whole burst was sent
+
+    const std::string message = useBinary ? generateBinaryMessage(messageSize) : generateNumbersMessage(messageSize);
+    const std::vector<std::string> batch(burst, message);
+
+    std::vector<std::vector<double>> latencies(numConnections);
+    std::vector<size_t> failures(numConnections, 0);
+    std::vector<std::thread> threads;
+    std::unique_ptr<Client> sharedClient;
+
+    if (isCoalescing) {
+        try {
+            sharedClient.reset(createClient(protocol, serverAddress, port, std::cerr, 1, clientOptions));
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    const Clock::time_point start = Clock::now();
+
+    for (size_t t = 0; t < numConnections; ++t) {
+        threads.emplace_back([&, t] {
+            std::unique_ptr<Client> ownClient;
+
+            if (!sharedClient) {
+                ownClient.reset(createClient(protocol, serverAddress, port, std::cerr, 1, clientOptions));
+            }
+
+            Client *client = sharedClient ? sharedClient.get() : ownClient.get();
+            std::string response;
+
+            latencies[t].reserve(numRequests);
+
+            for (size_t i = 0; i < numRequests && burst == 1; ++i) {
+                const Clock::time_point sentAt = Clock::now();
+
+                if (!client->request(message, response)) {
+                    ++failures[t];
+                    continue;
+                }
+
+                latencies[t].push_back(std::chrono::duration<double, std::micro>(Clock::now() - sentAt).count());
+            }
+
+            for (size_t i = 0; i < numRequests && burst > 1; i += burst) {
+                const Clock::time_point sentAt = Clock::now();
+                const size_t numSent = client->sendBatch(batch) ? burst : 0;
+
+                failures[t] += burst - numSent;
+
+                for (size_t j = 0; j < numSent; ++j) {
+                    if (!client->receive(response)) {
+                        failures[t] += numSent - j;
+                        break;
+                    }
+
+                    latencies[t].push_back(std::chrono::duration<double, std::micro>(Clock::now() - sentAt).count());
+                }
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    const double elapsedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (loopbackServer) {
+        loopbackServer->stop();
+        loopbackThread.join();
+    }
+
+    // 4. Report throughput and latency percentiles
+
+    std::vector<double> all;
+    size_t numFailures = 0;
+
+    for (size_t t = 0; t < numConnections; ++t) {
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+        numFailures += failures[t];
+    }
+
+    if (all.empty()) {
+        std::cerr << "No successful requests" << std::endl;
+        return 1;
+    }
+
+    std::sort(all.begin(), all.end());
+
+    auto percentile = [&](double p) {
+        return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))];
+    };
+
+    std::cout << std::fixed << std::setprecision(1)
+              << protocol << ": " << all.size() << " requests, " << numFailures << " failed, "
+              << all.size() / elapsedSeconds << " req/s\n"
+              << "latency us: p50 " << percentile(0.5) << ", p90 " << percentile(0.9)
+              << ", p99 " << percentile(0.99) << ", max " << all.back() << std::endl;
+
+    return numFailures == 0 ? 0 : 1;
+}
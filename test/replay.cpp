@@ -0,0 +1,302 @@
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "capture.h"
+#include "client_factory.h"
+#include "command_line.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Outcome of a single replayed request
+struct ReplayResult {
+    bool isReceived = false;
+    uint64_t latencyNs = 0;
+    std::string response;
+};
+
+// Throughput and latency distribution of a whole replay
+struct ReplaySummary {
+    size_t numReceived = 0;
+    size_t numFailed = 0;
+    double seconds = 0;
+    std::vector<double> latenciesUs;
+
+    double requestsPerSecond() const {
+        return seconds > 0 ? numReceived / seconds : 0;
+    }
+
+    double percentile(double p) const {
+        return latenciesUs[std::min(latenciesUs.size() - 1, static_cast<size_t>(p * latenciesUs.size()))];
+    }
+};
+
+ReplaySummary summarize(const std::vector<ReplayResult>& results, uint64_t durationNs) {
+    ReplaySummary summary;
+    summary.seconds = durationNs / 1e9;
+
+    for (const auto& result: results) {
+        if (result.isReceived) {
+            ++summary.numReceived;
+            summary.latenciesUs.push_back(result.latencyNs / 1e3);
+        } else {
+            ++summary.numFailed;
+        }
+    }
+
+    std::sort(summary.latenciesUs.begin(), summary.latenciesUs.end());
+
+    return summary;
+}
+
+// Results file is a capture file too: a response or failure record per request in order of requests,
+// then a summary record
+void saveResults(const std::string& path, CaptureProtocol protocol, const std::vector<ReplayResult>& results,
+                 uint64_t durationNs) {
+    CaptureWriter writer(path);
+
+    for (const auto& result: results) {
+        writer.append(CaptureRecord{ result.latencyNs, 0,
+                                     result.isReceived ? CaptureRecordType::Response : CaptureRecordType::Failure,
+                                     protocol, result.response });
+    }
+
+    writer.append(CaptureRecord{ durationNs, 0, CaptureRecordType::Summary, protocol, std::string() });
+}
+
+void loadResults(const std::string& path, std::vector<ReplayResult>& results, uint64_t& durationNs) {
+    for (auto& record: readCaptureFile(path)) {
+        if (record.type == CaptureRecordType::Summary) {
+            durationNs = record.timestampNs;
+        } else if (record.type == CaptureRecordType::Response || record.type == CaptureRecordType::Failure) {
+            ReplayResult result;
+            result.isReceived = record.type == CaptureRecordType::Response;
+            result.latencyNs = record.timestampNs;
+            result.response = std::move(record.payload);
+
+            results.push_back(std::move(result));
+        }
+    }
+}
+
+// Relative change from `before` to `after` in percent
+double change(double before, double after) {
+    return before > 0 ? (after - before) / before * 100 : 0;
+}
+
+int main(int argc, char **argv) {
+    static const uint8_t numRequiredParameters = 4;
+
+    CommandLineOptions options;
+    argc = extractOptions(argc, argv, options);
+
+    if (argc < numRequiredParameters + 1) {
+        std::cout << "Usage: " << argv[0]
+                  << " <capture_file> <server_address> <port> <protocol:TCP|UDP|UNIX|SEQPACKET|SHM> [num_connections]\n"
+                  << "e.g. " << argv[0] << " requests.cap 127.0.0.1 8888 TCP 8 --save=before.res\n"
+                  << "Arguments:\n"
+                  << "* capture_file - requests recorded by server with --capture\n"
+                  << "* server_address - server address, or socket path for unix protocols\n"
+                  << "* port - port to use (ignored for unix protocols)\n"
+                  << "* protocol - protocol to use ('TCP', 'UDP', 'UNIX', 'SEQPACKET' or 'SHM')\n"
+                  << "* num_connections - number of simultaneous connections (threads), default is 1."
+                     " Requests of the same captured peer always go through the same connection in order\n"
+                  << "Options:\n"
+                  << "* --speed=X - replay X times faster than captured, 0 sends requests as fast as possible,"
+                     " default is 1\n"
+                  << "* --save=PATH - save responses and latencies into PATH\n"
+                  << "* --baseline=PATH - compare responses, throughput and latencies with results saved earlier\n"
+                  << "* --fast-open - connect with TCP Fast Open (only when TCP is used)\n"
+                  << "Replay the same capture against two builds to see what has changed between them"
+                  << std::endl;
+        return 0;
+    }
+
+    // 1. Parse arguments
+
+    const std::string capturePath = argv[1];
+    const std::string serverAddress = argv[2];
+    const std::string protocol(argv[4]);
+
+    if (!isValidProtocol(protocol)) {
+        std::cerr << "Invalid protocol : " << argv[4] << std::endl;
+        return 1;
+    }
+
+    uint16_t port = 0;
+    size_t numConnections = 1;
+
+    try {
+        if (!isUnixProtocol(protocol)) {
+            port = std::stoi(argv[3]);
+        }
+
+        if (argc > 5) {
+            numConnections = std::stoull(argv[5]);
+        }
+    } catch (...) {
+        std::cerr << "Invalid arguments" << std::endl;
+        return 1;
+    }
+
+    if (numConnections == 0) {
+        std::cerr << "Number of connections should be positive" << std::endl;
+        return 1;
+    }
+
+    double speed = 1;
+    std::string savePath;
+    std::string baselinePath;
+    ClientOptions clientOptions;
+
+    if (!getOption(options, "speed", speed) || !getOption(options, "save", savePath) ||
+        !getOption(options, "baseline", baselinePath) ||
+        !getOption(options, "fast-open", clientOptions.tcpFastOpen) || !checkUnknownOptions(options))
+    {
+        return 1;
+    }
+
+    // 2. Load captured requests and spread them over connections by peer
+
+    std::vector<CaptureRecord> requests;
+
+    try {
+        for (auto& record: readCaptureFile(capturePath)) {
+            if (record.type == CaptureRecordType::Request) {
+                requests.push_back(std::move(record));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (requests.empty()) {
+        std::cerr << "No requests in " << capturePath << std::endl;
+        return 1;
+    }
+
+    std::vector<std::vector<size_t>> assignedRequests(numConnections);
+
+    for (size_t i = 0; i < requests.size(); ++i) {
+        assignedRequests[requests[i].peer % numConnections].push_back(i);
+    }
+
+    // 3. Replay them from multiple threads. Each request is sent not earlier than its captured time
+    // scaled by speed, but a connection never has more than one request in flight
+
+    std::vector<ReplayResult> results(requests.size());
+    std::vector<std::thread> threads;
+
+    const Clock::time_point start = Clock::now();
+
+    for (size_t t = 0; t < numConnections; ++t) {
+        if (assignedRequests[t].empty()) {
+            continue;
+        }
+
+        threads.emplace_back([&, t] {
+            std::unique_ptr<Client> client(createClient(protocol, serverAddress, port, std::cerr, 1, clientOptions));
+
+            for (const size_t i: assignedRequests[t]) {
+                if (speed > 0) {
+                    std::this_thread::sleep_until(
+                        start + std::chrono::nanoseconds(static_cast<uint64_t>(requests[i].timestampNs / speed)));
+                }
+
+                const Clock::time_point sentAt = Clock::now();
+
+                if (!client->request(requests[i].payload, results[i].response)) {
+                    results[i].response.clear();
+                    continue;
+                }
+
+                results[i].isReceived = true;
+                results[i].latencyNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - sentAt).count();
+            }
+        });
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    const uint64_t durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    const ReplaySummary summary = summarize(results, durationNs);
+
+    // 4. Report throughput and latency percentiles
+
+    std::cout << std::fixed << std::setprecision(1)
+              << protocol << ": " << summary.numReceived << " requests, " << summary.numFailed << " failed, "
+              << summary.requestsPerSecond() << " req/s\n";
+
+    if (!summary.latenciesUs.empty()) {
+        std::cout << "latency us: p50 " << summary.percentile(0.5) << ", p90 " << summary.percentile(0.9)
+                  << ", p99 " << summary.percentile(0.99) << ", max " << summary.latenciesUs.back() << "\n";
+    }
+
+    std::cout << std::flush;
+
+    if (!savePath.empty()) {
+        try {
+            saveResults(savePath, requests.front().protocol, results, durationNs);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    // 5. Compare with baseline: responses have to match, the rest is reported as relative change
+
+    size_t numMismatches = 0;
+
+    if (!baselinePath.empty()) {
+        std::vector<ReplayResult> baseline;
+        uint64_t baselineDurationNs = 0;
+
+        try {
+            loadResults(baselinePath, baseline, baselineDurationNs);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+
+        if (baseline.size() != results.size()) {
+            std::cerr << "Baseline has " << baseline.size() << " requests instead of " << results.size()
+                      << ", it was recorded from another capture" << std::endl;
+            return 1;
+        }
+
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (results[i].isReceived && baseline[i].isReceived && results[i].response != baseline[i].response) {
+                if (numMismatches++ == 0) {
+                    std::cout << "First mismatch at request " << i << ": expected \"" << baseline[i].response
+                              << "\", got \"" << results[i].response << "\"\n";
+                }
+            }
+        }
+
+        const ReplaySummary before = summarize(baseline, baselineDurationNs);
+
+        std::cout << "vs baseline: " << numMismatches << " mismatched responses, failed "
+                  << before.numFailed << " -> " << summary.numFailed
+                  << ", throughput " << std::showpos << change(before.requestsPerSecond(), summary.requestsPerSecond())
+                  << "%";
+
+        if (!before.latenciesUs.empty() && !summary.latenciesUs.empty()) {
+            std::cout << ", p50 " << change(before.percentile(0.5), summary.percentile(0.5))
+                      << "%, p90 " << change(before.percentile(0.9), summary.percentile(0.9))
+                      << "%, p99 " << change(before.percentile(0.99), summary.percentile(0.99)) << "%";
+        }
+
+        std::cout << std::noshowpos << std::endl;
+    }
+
+    return summary.numFailed == 0 && numMismatches == 0 ? 0 : 1;
+}
@@ -7,12 +7,14 @@
 
 #include <socket_demo/defines.h>
 
-#include "client_udp.h"
-#include "client_tcp.h"
+#include "client_factory.h"
+#include "command_line.h"
 #include "echo_server_delegate.h"
+#include "packed_protocol.h"
+#include "projection.h"
 
-// Generates random string containing numbers and letters separated by spaces
-std::string generateRandomString(){
+// Generates random string of up to `maxLength` characters containing numbers and letters separated by spaces
+std::string generateRandomString(size_t maxLength = MAX_MESSAGE_LENGTH_BYTES) {
     static constexpr auto chars =
         "0123456789"
         "a"
@@ -23,7 +25,7 @@ std::string generateRandomString(){
 
     // Separate distributions for characters and message length
     std::uniform_int_distribution<size_t> charDist(0, std::strlen(chars) - 1);
-    std::uniform_int_distribution<size_t> lengthDist(0, MAX_MESSAGE_LENGTH_BYTES);
+    std::uniform_int_distribution<size_t> lengthDist(1, maxLength);
 
     const std::size_t length = lengthDist(rng);
 
@@ -33,20 +35,194 @@ std::string generateRandomString(){
     return result;
 }
 
+// Generates binary protocol request holding up to `maxNumbers` random numbers
+std::string generateRandomBinaryRequest(size_t maxNumbers = BINARY_MAX_NUMBERS) {
+    thread_local std::random_device rng;
+
+    std::uniform_int_distribution<size_t> countDist(1, maxNumbers);
+    std::uniform_int_distribution<Number> numberDist;
+
+    std::vector<Number> numbers(countDist(rng));
+    std::generate(numbers.begin(), numbers.end(), [&]() { return numberDist(rng); });
+
+    std::string result;
+    encodeBinaryRequest(numbers, result);
+
+    return result;
+}
+
+// Generates projection request, text or binary, over up to `maxNumbers` random numbers. `expected` receives
+// results computed by sorting, so that they do not depend on the way the server computes them
+std::string generateRandomProjectionRequest(bool isBinary, size_t maxNumbers, std::vector<Number>& expected) {
+    thread_local std::random_device rng;
+
+    // Text numbers are kept short, so that a request of `maxNumbers` numbers stays within a message
+
+    std::uniform_int_distribution<size_t> countDist(1, maxNumbers);
+    std::uniform_int_distribution<Number> numberDist = isBinary
+        ? std::uniform_int_distribution<Number>()
+        : std::uniform_int_distribution<Number>(-1000000000, 1000000000);
+    std::uniform_int_distribution<int64_t> kindDist(static_cast<int64_t>(ProjectionKind::Sum),
+                                                    static_cast<int64_t>(ProjectionKind::Largest));
+
+    std::vector<Number> numbers(countDist(rng));
+    std::generate(numbers.begin(), numbers.end(), [&]() { return numberDist(rng); });
+
+    // k may exceed the number of numbers, then all of them are expected
+    std::uniform_int_distribution<size_t> kDist(1, std::min(numbers.size() + 2, BINARY_PROJECTION_MAX_RESULTS));
+    const Projection projection{ static_cast<ProjectionKind>(kindDist(rng)), kDist(rng) };
+
+    // 1. Compute results the straightforward way
+
+    std::vector<Number> sorted = numbers;
+    std::sort(sorted.begin(), sorted.end());
+
+    const size_t numKept = std::min(projection.k, sorted.size());
+    uint64_t sum = 0;
+
+    for (const Number number: sorted) {
+        sum += static_cast<uint64_t>(number);
+    }
+
+    switch (projection.kind) {
+        case ProjectionKind::Sum:
+            expected = { static_cast<Number>(sum) };
+            break;
+
+        case ProjectionKind::Count:
+            expected = { static_cast<Number>(sorted.size()) };
+            break;
+
+        case ProjectionKind::MinMax:
+            expected = { sorted.front(), sorted.back() };
+            break;
+
+        case ProjectionKind::Smallest:
+            expected.assign(sorted.begin(), sorted.begin() + numKept);
+            break;
+
+        case ProjectionKind::Largest:
+            expected.assign(sorted.end() - numKept, sorted.end());
+            break;
+    }
+
+    // 2. Encode request
+
+    std::string result;
+
+    if (isBinary) {
+        encodeBinaryProjectionRequest(projection, numbers, result);
+        return result;
+    }
+
+    static const char *directives[] = { "", "@sum", "@count", "@minmax", "@smallest=", "@largest=" };
+
+    result = directives[static_cast<size_t>(projection.kind)];
+
+    if (projection.kind == ProjectionKind::Smallest || projection.kind == ProjectionKind::Largest) {
+        result += std::to_string(projection.k);
+    }
+
+    for (const Number number: numbers) {
+        result += ' ' + std::to_string(number);
+    }
+
+    return result;
+}
+
+bool isExpectedProjectionResponse(bool isBinary, const std::string& response, const std::vector<Number>& expected) {
+    if (!isBinary) {
+        return response == formatProjectionResponse(expected);
+    }
+
+    std::vector<Number> results;
+
+    return decodeBinaryProjectionResponse(response, results) && results == expected;
+}
+
+// Sends a packed datagram of single number binary requests whose responses (each carries the sum too) cannot
+// all fit into a single message, so that server has to drop some of them. Every request still has to get
+// an entry under the same tag, and responses which are not dropped have to be intact
+bool checkDroppedEntries(Client& client, EchoServerDelegate& echoProcessor) {
+    static constexpr size_t REQUEST_SIZE = BINARY_MAGIC_SIZE + sizeof(Number);
+
+    size_t numRequests = 0;
+
+    while (getPackedMessageSize(numRequests + 1, (numRequests + 1) * REQUEST_SIZE) <= MAX_MESSAGE_LENGTH_BYTES) {
+        ++numRequests;
+    }
+
+    const uint64_t tag = std::random_device()();
+
+    std::vector<std::string> requests(numRequests);
+    std::string message;
+    beginPackedMessage(tag, message);
+
+    for (size_t i = 0; i < numRequests; ++i) {
+        encodeBinaryRequest({ static_cast<Number>(i) }, requests[i]);
+        appendPackedEntry(requests[i].data(), requests[i].size(), message);
+    }
+
+    std::string response;
+
+    if (!client.request(message, response)) {
+        std::cerr << "Cannot receive packed response" << std::endl;
+        return false;
+    }
+
+    uint64_t responseTag;
+    std::vector<PackedEntry> entries;
+
+    if (!decodePackedMessage(response.data(), response.size(), true, responseTag, entries) || responseTag != tag ||
+        entries.size() != numRequests) {
+        std::cerr << "Invalid packed response: " << entries.size() << " entries for " << numRequests << " requests"
+                  << std::endl;
+        return false;
+    }
+
+    size_t numDropped = 0;
+
+    for (size_t i = 0; i < numRequests; ++i) {
+        if (entries[i].size == PACKED_DROPPED_ENTRY) {
+            ++numDropped;
+        } else if (std::string(entries[i].data, entries[i].size) != echoProcessor.process(requests[i])) {
+            std::cerr << "Invalid packed response entry " << i << std::endl;
+            return false;
+        }
+    }
+
+    if (numDropped == 0) {
+        std::cerr << "Packed response has no dropped entries" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 int main(int argc, char **argv) {
     static const uint8_t numRequiredParameters = 3;
 
+    CommandLineOptions options;
+    argc = extractOptions(argc, argv, options);
+
     if (argc < numRequiredParameters + 1) {
         std::cout << "Usage: " << argv[0]
-                  << " <server_address> <port> <protocol:TCP|UDP> [operations_timeout_s] [num_connections]\n"
+                  << " <server_address> <port> <protocol:TCP|UDP|UNIX|SEQPACKET|SHM> [operations_timeout_s] [num_connections]\n"
                   << "e.g. " << argv[0] << " 127.0.0.1 8888 TCP 5 1024\n"
                   << "Arguments:\n"
-                  << "* server_address - server address\n"
-                  << "* port - port to use\n"
-                  << "* protocol - protocol to use ('TCP' or 'UDP')\n"
+                  << "* server_address - server address, or socket path for unix protocols\n"
+                  << "* port - port to use (ignored for unix protocols)\n"
+                  << "* protocol - protocol to use ('TCP', 'UDP', 'UNIX' for unix stream socket"
+                     ", 'SEQPACKET' for unix sequenced-packet socket"
+                     " or 'SHM' for shared memory)\n"
                   << "* operations_timeout_s - all operations timeout in seconds, default is 5\n"
                   << "* num_connections - number of simultaneous connections (threads), default is 512\n"
-                  << "* udp_max_tries - send-receive attempts to make until success (only when UDP is used), default is 10"
+                  << "* udp_max_tries - send-receive attempts to make until success (only when UDP is used), default is 10\n"
+                  << "Options:\n"
+                  << "* --binary - test binary protocol instead of the text one\n"
+                  << "* --projection - request response projections (see --binary) and check them against sorted numbers too\n"
+                  << "* --udp-coalesce - threads share one UDP client packing short requests into shared datagrams,\n"
+                  << "  then a packed datagram whose responses do not fit checks dropped entries (only when UDP is used)"
                   << std::endl;
         return 0;
     }
@@ -57,21 +233,23 @@ int main(int argc, char **argv) {
 
     // 2. Parse server port
 
-    uint16_t port;
+    std::string protocol(argv[3]);
 
-    try {
-        port = std::stoi(argv[2]);
-    } catch (...) {
-        std::cerr << "Invalid port number: " << argv[1] << std::endl;
-        return 1;
+    uint16_t port = 0;
+
+    if (!isUnixProtocol(protocol)) {
+        try {
+            port = std::stoi(argv[2]);
+        } catch (...) {
+            std::cerr << "Invalid port number: " << argv[2] << std::endl;
+            return 1;
+        }
     }
 
     // 3. Parse protocol
 
-    std::string protocol(argv[3]);
-
-    if (protocol != "TCP" && protocol != "UDP") {
-        std::cerr << "Invalid protocol : " << argv[2] << std::endl;
+    if (!isValidProtocol(protocol)) {
+        std::cerr << "Invalid protocol : " << argv[3] << std::endl;
         return 1;
     }
 
@@ -103,17 +281,37 @@ int main(int argc, char **argv) {
 
     // 5. Try to parse UDP max tries number
 
-    size_t udpMaxTries = 10;
+    ClientOptions clientOptions;
 
     if (argc > 6) {
         try {
-            udpMaxTries = std::stoull(argv[6]);
+            clientOptions.udpRetry.maxTries = std::stoull(argv[6]);
         } catch (...) {
             std::cerr << "Invalid UDP max tries number: " << argv[6] << std::endl;
             return 1;
         }
     }
 
+    bool useBinary = false;
+    bool useProjection = false;
+
+    if (!getOption(options, "binary", useBinary) || !getOption(options, "projection", useProjection) ||
+        !getOption(options, "udp-coalesce", clientOptions.udpCoalescing.enabled) || !checkUnknownOptions(options)) {
+        return 1;
+    }
+
+    const bool isCoalescing = clientOptions.udpCoalescing.enabled;
+
+    if (isCoalescing && protocol != "UDP") {
+        std::cerr << "--udp-coalesce requires UDP" << std::endl;
+        return 1;
+    }
+
+    // Coalesced requests are kept short, so that several of them share a datagram
+
+    const size_t maxLength = isCoalescing ? 256 : MAX_MESSAGE_LENGTH_BYTES;
+    const size_t maxNumbers = isCoalescing ? 32 : useBinary ? BINARY_PROJECTION_MAX_NUMBERS : 4096;
+
     // 6. Create echo server delegate. We need this since we need to validate
     // whether server returned correct output
 
@@ -121,63 +319,43 @@ int main(int argc, char **argv) {
 
     // 7. Spawn multiple client threads. Each thread generates random string,
     // send it to server, validates sending and receiving procedures and validates
-    // output
+    // output. Coalescing client is shared by all threads, so responses are told apart by tags
+
+    std::shared_ptr<Client> sharedClient;
+
+    if (isCoalescing) {
+        sharedClient.reset(createClient(protocol, serverAddress, port, std::cout, operationsTimoutSeconds,
+                                        clientOptions));
+    }
 
     std::vector<std::thread> threads;
     threads.reserve(numConnections);
 
     for (size_t i = 0; i < numConnections; ++i) {
         threads.emplace_back([&] {
-            std::unique_ptr<Client> client;
-
-            if (protocol == "TCP") {
-                client.reset(new ClientTcp(serverAddress, port, std::cout, operationsTimoutSeconds));
-            } else if (protocol == "UDP") {
-                client.reset(new ClientUdp(serverAddress, port, std::cout, operationsTimoutSeconds));
-            } else {
-                // Should never be there
-                throw;
-            }
+            std::shared_ptr<Client> client = sharedClient
+                ? sharedClient
+                : std::shared_ptr<Client>(createClient(protocol, serverAddress, port, std::cout,
+                                                       operationsTimoutSeconds, clientOptions));
 
-            const std::string msg = generateRandomString();
+            std::vector<Number> expected;
 
-            if (!client->send(msg)) {
-                throw std::runtime_error("Cannot send message");
-            }
+            const std::string msg = useProjection ? generateRandomProjectionRequest(useBinary, maxNumbers, expected)
+                                  : useBinary ? generateRandomBinaryRequest(isCoalescing ? maxNumbers : BINARY_MAX_NUMBERS)
+                                  : generateRandomString(maxLength);
+
+            // For UDP this is selective-repeat-like ARQ protocol, but each message fits in a single
+            // datagram, so the client basically sends the same message multiple times
 
             std::string response;
 
-            if (protocol == "TCP") {
-                // Pretty simple for TCP
-
-                if (!client->receive(response)) {
-                    throw std::runtime_error("Cannot receive message");
-                }
-            } else if (protocol == "UDP") {
-                // This is selective-repeat-like ARQ protocol, but each message fits in a single
-                // datagram, so we basically send the same message multiple times
-
-                bool receivedResponse = false;
-
-                for (size_t i = 0; i < udpMaxTries; ++i) {
-                    if (client->receive(response)) {
-                        receivedResponse = true;
-                        break;
-                    }
-
-                    client->send(msg);
-                }
-
-                if (!receivedResponse) {
-                    // At least we've tried
-                    throw std::runtime_error("Cannot receive message");
-                }
-            } else {
-                // Should never be there
-                throw;
+            if (!client->request(msg, response)) {
+                // At least we've tried
+                throw std::runtime_error("Cannot receive message");
             }
 
-            if (response != echoProcessor.process(msg)) {
+            if (response != echoProcessor.process(msg) ||
+                (useProjection && !isExpectedProjectionResponse(useBinary, response, expected))) {
                 throw std::runtime_error("Invalid response");
             }
         });
@@ -187,6 +365,20 @@ int main(int argc, char **argv) {
         t.join();
     }
 
+    // 8. Packed responses are checked with a plain client, which hands over the whole datagram
+
+    if (isCoalescing) {
+        ClientOptions plainOptions = clientOptions;
+        plainOptions.udpCoalescing.enabled = false;
+
+        std::unique_ptr<Client> client(createClient(protocol, serverAddress, port, std::cout,
+                                                    operationsTimoutSeconds, plainOptions));
+
+        if (!checkDroppedEntries(*client, echoProcessor)) {
+            return 1;
+        }
+    }
+
     std::cout << "OK!" << std::endl;
 
     return 0;